@@ -0,0 +1,1003 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Host benchmarks for the MQTT-SN stack. Results are written to
+// stdout as JSON lines, one object per measurement, so runs from two
+// commits can be diffed or loaded into a script.
+//
+// g++ -std=c++11 -O2 -Iinclude bench/mqttSN_bench.cpp -o mqttSN_bench
+// ./mqttSN_bench > bench_output.txt
+//
+//  encode      frame a message for the radio, per message type
+//  decode      parse a received frame back into a message, per type
+//  copy        memcpy of the message struct as it sits in memory,
+//              the floor encode is measured against
+//  view        validate a received frame in place with MSN_VIEW, per type
+//  dispatch    gateway Loop cost per received frame, callback and
+//              MSN_HANDLERS jump table (PINGREQ is not registered)
+//  fanout      SendToAll time against the number of known nodes
+//  match       subscription lookup for a PUBLISH against the number
+//              of subscribers, exact and wildcard filters
+//  e2e         CONNECT->CONNACK and PUBLISH->PUBACK latency percentiles
+//              in virtual time over the simulated mesh
+//  batch       network writes and channel airtime for bursts of eight
+//              PUBACKs to one node, with and without MSN_BATCH_TRANSPORT
+//  multi_radio publishes per second a gateway takes in with 1, 2 and 4
+//              radios, each its own simulated channel, under saturation
+//
+// After the measurements come {"check":...,"passed":...} lines for
+// behaviour the library relies on, and the exit status is 1 when one
+// of them failed:
+//
+//  codec_roundtrip      1024 messages of random content per type
+//                       encode, decode and encode to the same frame
+//  disconnect_duration  an encoded DISCONNECT ends the session at
+//                       Duration 0 and puts it to sleep otherwise
+//  stream_restart       a node that restarts and streams again under
+//                       the same msgID gets its new stream delivered
+//  multi_join_gating    a multi-radio gateway only runs DHCP on radios
+//                       within MSN_MULTI_JOIN_SLACK of the least loaded
+//////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mqttSNmsg.h>
+#include <mqttSN_sim.h>
+#include <mqttSN_batch.h>
+#include <mqttSN_multi.h>
+
+
+// Keeps the optimizer from dropping the work being timed.
+template<class T>
+inline void Escape(T &_Value)
+{
+    asm volatile("" : : "g"(&_Value) : "memory");
+}
+
+typedef std::chrono::steady_clock BENCH_CLOCK;
+
+inline double NsSince(BENCH_CLOCK::time_point _Start)
+{
+    return std::chrono::duration<double, std::nano>(BENCH_CLOCK::now() - _Start).count();
+}
+
+
+////// [ ENCODE / DECODE ] //////
+
+template<MSN_MsgType M_TYPE>
+void BenchCodec(const char *_Name)
+{
+    const unsigned long iterations = 2000000;
+
+    MSN_MESSAGE<M_TYPE> msg;
+    memset((void*)&msg, 'a', sizeof(msg));
+    msg.msgLength = sizeof(msg);
+
+    byte frame[MAX_PAYLOAD_SIZE];
+
+    uint16_t len = MSN_Encode(msg, frame, MAX_PAYLOAD_SIZE);
+
+    BENCH_CLOCK::time_point start = BENCH_CLOCK::now();
+
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        Escape(msg);
+        len = MSN_Encode(msg, frame, MAX_PAYLOAD_SIZE);
+        Escape(frame);
+    }
+
+    double encode_ns = NsSince(start) / iterations;
+
+    start = BENCH_CLOCK::now();
+
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        Escape(frame);
+        MSN_Decode(frame, len, msg);
+        Escape(msg);
+    }
+
+    double decode_ns = NsSince(start) / iterations;
+
+    start = BENCH_CLOCK::now();
+
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        Escape(frame);
+        MSN_VIEW<M_TYPE> view(frame, len);
+        Escape(view);
+    }
+
+    double view_ns = NsSince(start) / iterations;
+
+    byte raw[sizeof(msg)];
+
+    start = BENCH_CLOCK::now();
+
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        Escape(msg);
+        memcpy(raw, &msg, sizeof(msg));
+        Escape(raw);
+    }
+
+    double copy_ns = NsSince(start) / iterations;
+
+    printf("{\"bench\":\"encode\",\"type\":\"%s\",\"bytes\":%u,\"ns_per_op\":%.2f,\"mb_per_s\":%.1f}\n",
+        _Name, len, encode_ns, len / encode_ns * 1000.0);
+    printf("{\"bench\":\"decode\",\"type\":\"%s\",\"bytes\":%u,\"ns_per_op\":%.2f,\"mb_per_s\":%.1f}\n",
+        _Name, len, decode_ns, len / decode_ns * 1000.0);
+    printf("{\"bench\":\"copy\",\"type\":\"%s\",\"bytes\":%u,\"ns_per_op\":%.2f,\"mb_per_s\":%.1f}\n",
+        _Name, (unsigned)sizeof(msg), copy_ns, sizeof(msg) / copy_ns * 1000.0);
+    printf("{\"bench\":\"view\",\"type\":\"%s\",\"bytes\":%u,\"ns_per_op\":%.2f,\"mb_per_s\":%.1f}\n",
+        _Name, len, view_ns, len / view_ns * 1000.0);
+}
+
+void BenchCodecs()
+{
+    BenchCodec<MSN_ADVERTISE>("ADVERTISE");
+    BenchCodec<MSN_SEARCHGW>("SEARCHGW");
+    BenchCodec<MSN_GWINFO>("GWINFO");
+    BenchCodec<MSN_CONNECT>("CONNECT");
+    BenchCodec<MSN_CONNACK>("CONNACK");
+    BenchCodec<MSN_WILLTOPICREQ>("WILLTOPICREQ");
+    BenchCodec<MSN_WILLTOPIC>("WILLTOPIC");
+    BenchCodec<MSN_WILLMSGREQ>("WILLMSGREQ");
+    BenchCodec<MSN_WILLMSG>("WILLMSG");
+    BenchCodec<MSN_REGISTER>("REGISTER");
+    BenchCodec<MSN_REGACK>("REGACK");
+    BenchCodec<MSN_PUBLISH>("PUBLISH");
+    BenchCodec<MSN_PUBACK>("PUBACK");
+    BenchCodec<MSN_PUBCOMP>("PUBCOMP");
+    BenchCodec<MSN_PUBREC>("PUBREC");
+    BenchCodec<MSN_PUBREL>("PUBREL");
+    BenchCodec<MSN_SUBSCRIBE>("SUBSCRIBE");
+    BenchCodec<MSN_SUBACK>("SUBACK");
+    BenchCodec<MSN_UNSUBSCRIBE>("UNSUBSCRIBE");
+    BenchCodec<MSN_UNSUBACK>("UNSUBACK");
+    BenchCodec<MSN_PINGREQ>("PINGREQ");
+    BenchCodec<MSN_PINGRESP>("PINGRESP");
+    BenchCodec<MSN_DISCONNECT>("DISCONNECT");
+    BenchCodec<MSN_WILLTOPICUPD>("WILLTOPICUPD");
+    BenchCodec<MSN_WILLMSGUPD>("WILLMSGUPD");
+    BenchCodec<MSN_WILLTOPICRESP>("WILLTOPICRESP");
+    BenchCodec<MSN_WILLMSGRESP>("WILLMSGRESP");
+}
+
+
+////// [ BENCH TRANSPORT ] //////
+// Replays one frame as fast as it is read and swallows every write,
+// so only the library's own cost is measured.
+class BENCH_TRANSPORT
+{
+
+protected:
+    const byte *frame;
+    uint16_t frameLen;
+    unsigned long pending;
+    uint16_t peers;
+
+public:
+    unsigned long writes;
+
+    BENCH_TRANSPORT() : frame(0), frameLen(0), pending(0), peers(0), writes(0) {};
+
+    void Feed(const void *_Frame, uint16_t _Len, unsigned long _Count)
+    {
+        frame = (const byte*)_Frame;
+        frameLen = _Len;
+        pending = _Count;
+    }
+
+    void SetPeers(uint16_t _Count) { peers = _Count; }
+
+    bool Begin(uint16_t) { return true; }
+    bool Restart() { return true; }
+    void Update() {}
+    void DHCP() {}
+    bool Available() { return pending != 0; }
+
+    uint16_t Read(byte *_Buffer, uint16_t, uint16_t *_From)
+    {
+        pending--;
+        memcpy(_Buffer, frame, frameLen);
+        Escape(_Buffer);
+        *_From = 1;
+        return frameLen;
+    }
+
+    bool Write(uint16_t, const void *_Payload, uint16_t)
+    {
+        writes++;
+        Escape(_Payload);
+        return true;
+    }
+
+    bool CheckConnection() { return true; }
+    bool RenewAddress() { return true; }
+    uint16_t PeerCount() { return peers; }
+    uint16_t PeerAddress(uint16_t _Index) { return _Index + 1; }
+    unsigned long Millis() { return 0; }
+    void Delay(unsigned long) {}
+};
+
+class BENCH_GATEWAY : public DEVICE_TYPE<DT_GATEWAY, BENCH_TRANSPORT>
+{
+public:
+    BENCH_TRANSPORT &Transport() { return transport; }
+};
+
+
+////// [ DISPATCH ] //////
+
+unsigned long handled = 0;
+
+void bench_handler(byte *msg_type, byte *data_buffer, uint16_t *)
+{
+    handled += *msg_type;
+    Escape(data_buffer);
+}
+
+template<MSN_MsgType M_TYPE>
+void BenchDispatch(const char *_Name)
+{
+    const unsigned long frames = 2000000;
+
+    BENCH_GATEWAY gate;
+    MSN_MESSAGE<M_TYPE> msg = MSN_MESSAGE<M_TYPE>();
+
+    byte frame[MAX_PAYLOAD_SIZE];
+
+    gate.Setup();
+    gate.Transport().Feed(frame, MSN_Encode(msg, frame, MAX_PAYLOAD_SIZE), frames);
+
+    BENCH_CLOCK::time_point start = BENCH_CLOCK::now();
+
+    gate.Loop(&bench_handler, 0);
+
+    double ns = NsSince(start) / frames;
+
+    printf("{\"bench\":\"dispatch\",\"type\":\"%s\",\"ns_per_frame\":%.2f}\n", _Name, ns);
+}
+
+void on_connect(const MSN_VIEW<MSN_CONNECT> &_Msg, uint16_t, void *_Context)
+{
+    *(unsigned long*)_Context += _Msg.Duration();
+}
+
+void on_publish(const MSN_VIEW<MSN_PUBLISH> &_Msg, uint16_t, void *_Context)
+{
+    *(unsigned long*)_Context += _Msg.TopicID();
+}
+
+typedef MSN_HANDLERS<
+    MSN_ON<MSN_CONNECT, &on_connect>,
+    MSN_ON<MSN_PUBLISH, &on_publish>
+> BENCH_HANDLERS;
+
+template<MSN_MsgType M_TYPE>
+void BenchTableDispatch(const char *_Name)
+{
+    const unsigned long frames = 2000000;
+
+    BENCH_GATEWAY gate;
+    MSN_MESSAGE<M_TYPE> msg = MSN_MESSAGE<M_TYPE>();
+    byte frame[MAX_PAYLOAD_SIZE];
+    unsigned long context = 0;
+
+    gate.Setup();
+    gate.Transport().Feed(frame, MSN_Encode(msg, frame, MAX_PAYLOAD_SIZE), frames);
+
+    BENCH_CLOCK::time_point start = BENCH_CLOCK::now();
+
+    gate.Loop<BENCH_HANDLERS>(&context, 0);
+
+    double ns = NsSince(start) / frames;
+
+    Escape(context);
+
+    printf("{\"bench\":\"dispatch_table\",\"type\":\"%s\",\"ns_per_frame\":%.2f}\n", _Name, ns);
+}
+
+void BenchDispatches()
+{
+    BenchTableDispatch<MSN_CONNECT>("CONNECT");
+    BenchTableDispatch<MSN_PUBLISH>("PUBLISH");
+    BenchTableDispatch<MSN_PINGREQ>("PINGREQ");
+
+    BenchDispatch<MSN_CONNECT>("CONNECT");
+    BenchDispatch<MSN_PUBLISH>("PUBLISH");
+    BenchDispatch<MSN_PINGREQ>("PINGREQ");
+}
+
+
+////// [ FANOUT ] //////
+
+void BenchFanout()
+{
+    const uint16_t sizes[] = { 1, 8, 32, 64, 128, 255 };
+
+    MSN_MESSAGE<MSN_ADVERTISE> msg;
+    msg.gwID = 1;
+    msg.duration = 900;
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        const unsigned long rounds = 20000;
+
+        BENCH_GATEWAY gate;
+        gate.Setup();
+        gate.Transport().SetPeers(sizes[s]);
+
+        BENCH_CLOCK::time_point start = BENCH_CLOCK::now();
+
+        for (unsigned long i = 0; i < rounds; i++)
+        {
+            gate.SendToAll(msg);
+        }
+
+        double ns = NsSince(start) / rounds;
+
+        printf("{\"bench\":\"fanout\",\"addr_list_top\":%u,\"ns_per_send_to_all\":%.1f,\"ns_per_dest\":%.2f}\n",
+            sizes[s], ns, ns / sizes[s]);
+    }
+}
+
+
+////// [ SUBSCRIPTION MATCH ] //////
+
+void BenchMatch()
+{
+    const uint16_t sizes[] = { 16, 128, 1024, 4096 };
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        const unsigned long rounds = 200000;
+
+        typedef MSN_SUBSCRIPTIONS<16384, 8192, 64, 65535> BENCH_SUBS;
+
+        std::unique_ptr<BENCH_SUBS> subs(new BENCH_SUBS());
+        std::vector<std::string> topics;
+        char filter[TOPIC_NAME_SZ];
+
+        // every node on its own room, a tenth of them on a whole floor
+        for (uint16_t i = 0; i < sizes[s]; i++)
+        {
+            int len = snprintf(filter, sizeof(filter), "site/%u/room%u/temp", i % 8, i);
+            subs->Subscribe(i + 1, filter, len);
+            topics.push_back(filter);
+
+            if (i % 10 == 0)
+            {
+                len = snprintf(filter, sizeof(filter), "site/%u/+/temp", i % 8);
+                subs->Subscribe(i + 1, filter, len);
+            }
+        }
+
+        subs->Subscribe(0xfffe, "site/#", 6);
+
+        uint16_t out[MSN_FANOUT_DESTS];
+        unsigned long matched = 0;
+
+        BENCH_CLOCK::time_point start = BENCH_CLOCK::now();
+
+        for (unsigned long i = 0; i < rounds; i++)
+        {
+            const std::string &topic = topics[i % sizes[s]];
+
+            matched += subs->Match(topic.data(), topic.size(), out, MSN_FANOUT_DESTS);
+            Escape(out);
+        }
+
+        double ns = NsSince(start) / rounds;
+
+        printf("{\"bench\":\"match\",\"subscribers\":%u,\"avg_matched\":%.1f,\"ns_per_match\":%.1f}\n",
+            sizes[s], (double)matched / rounds, ns);
+    }
+}
+
+
+////// [ END TO END ] //////
+// Latencies are in virtual microseconds on the simulated mesh.
+
+typedef DEVICE_TYPE<DT_GATEWAY, MSN_SIM_TRANSPORT> SIM_GATEWAY;
+typedef DEVICE_TYPE<DT_NODE, MSN_SIM_TRANSPORT> SIM_NODE;
+
+struct E2E_RUN
+{
+    MSN_SIM_WORLD *world;
+    SIM_GATEWAY *gate;
+    std::vector<std::unique_ptr<SIM_NODE> > nodes;
+    std::vector<uint64_t> sentAt;
+    std::vector<uint64_t> latencies;
+    std::vector<uint64_t> pollAt;
+    uint16_t current;
+};
+
+E2E_RUN *e2e = 0;
+
+void e2e_gateway_handler(byte *msg_type, byte *, uint16_t *sender_addr)
+{
+    static MSN_MESSAGE<MSN_CONNACK> msgConAck;
+    static MSN_MESSAGE<MSN_PUBACK> msgPubAck;
+
+    if (*msg_type == MSN_CONNECT)
+    {
+        msgConAck.returnCode = RC_ACCEPTED;
+        e2e->gate->SendTo(msgConAck, *sender_addr);
+    }
+    else if (*msg_type == MSN_PUBLISH)
+    {
+        msgPubAck.returnCode = RC_ACCEPTED;
+        e2e->gate->SendTo(msgPubAck, *sender_addr);
+    }
+}
+
+void e2e_node_handler(byte *msg_type, byte *)
+{
+    if (*msg_type == MSN_CONNACK || *msg_type == MSN_PUBACK)
+    {
+        uint16_t i = e2e->current;
+
+        if (e2e->sentAt[i])
+        {
+            e2e->latencies.push_back(e2e->world->NowUs() - e2e->sentAt[i]);
+            e2e->sentAt[i] = 0;
+        }
+    }
+}
+
+// Comes back to a device while it has frames to retry.
+void e2e_keep_polling(uint16_t _Address, uint16_t _Pending)
+{
+    if (_Pending && e2e->pollAt[_Address] <= e2e->world->NowUs())
+    {
+        e2e->pollAt[_Address] = e2e->world->NowUs() + MSN_OUTBOX_TICK_MS * 1000ULL;
+        e2e->world->PollAt(_Address, e2e->pollAt[_Address]);
+    }
+}
+
+void ReportPercentiles(const char *_Name, uint16_t _Nodes, std::vector<uint64_t> &_Samples, uint64_t _Requests)
+{
+    std::sort(_Samples.begin(), _Samples.end());
+
+    uint64_t p50 = 0, p90 = 0, p99 = 0, max = 0;
+
+    if (!_Samples.empty())
+    {
+        p50 = _Samples[_Samples.size() * 50 / 100];
+        p90 = _Samples[_Samples.size() * 90 / 100];
+        p99 = _Samples[_Samples.size() * 99 / 100];
+        max = _Samples.back();
+    }
+
+    printf("{\"bench\":\"e2e\",\"flow\":\"%s\",\"nodes\":%u,\"requests\":%llu,\"completed\":%llu,"
+        "\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu}\n",
+        _Name, _Nodes, (unsigned long long)_Requests, (unsigned long long)_Samples.size(),
+        (unsigned long long)p50, (unsigned long long)p90, (unsigned long long)p99, (unsigned long long)max);
+}
+
+template<MSN_MsgType M_TYPE>
+void BenchE2E(const char *_Name, uint16_t _Nodes, uint16_t _Rounds)
+{
+    MSN_SIM_WORLD world(7);
+    SIM_GATEWAY gate(&world);
+    E2E_RUN run;
+
+    run.world = &world;
+    run.gate = &gate;
+    run.sentAt.assign(_Nodes, 0);
+    run.pollAt.assign(_Nodes + 1, 0);
+    run.current = 0;
+    e2e = &run;
+
+    world.defaultLink.loss = 0.01f;
+
+    gate.Setup();
+
+    for (uint16_t i = 0; i < _Nodes; i++)
+    {
+        run.nodes.push_back(std::unique_ptr<SIM_NODE>(new SIM_NODE(&world)));
+        run.nodes[i]->Setup(i + 1);
+    }
+
+    static MSN_MESSAGE<M_TYPE> msg;
+
+    const uint64_t round_us = 10ULL * 1000000ULL;
+
+    // each node sends once per round at a random offset
+    for (uint16_t r = 0; r < _Rounds; r++)
+    {
+        for (uint16_t i = 0; i < _Nodes; i++)
+        {
+            uint64_t at = r * round_us + (uint64_t)rand() % round_us;
+
+            world.Schedule(at, [i]() {
+                e2e->current = i;
+                e2e->sentAt[i] = e2e->world->NowUs();
+                e2e->nodes[i]->Send(msg);
+                e2e_keep_polling(i + 1, e2e->nodes[i]->Pending());
+            });
+        }
+    }
+
+    world.Run(_Rounds * round_us + round_us, [](uint16_t _Address) {
+        if (_Address == MSN_GATEWAY_ADDRESS)
+        {
+            e2e->gate->Loop(&e2e_gateway_handler, 0);
+            e2e_keep_polling(_Address, e2e->gate->Pending());
+        }
+        else
+        {
+            e2e->current = _Address - 1;
+            e2e->nodes[_Address - 1]->Loop(&e2e_node_handler, 0);
+            e2e_keep_polling(_Address, e2e->nodes[_Address - 1]->Pending());
+        }
+    });
+
+    ReportPercentiles(_Name, _Nodes, run.latencies, (uint64_t)_Nodes * _Rounds);
+
+    e2e = 0;
+}
+
+void BenchE2Es()
+{
+    const uint16_t sizes[] = { 1, 100, 1000 };
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        BenchE2E<MSN_CONNECT>("connect_connack", sizes[s], 20);
+        BenchE2E<MSN_PUBLISH>("publish_puback", sizes[s], 20);
+    }
+}
+
+
+////// [ BATCHING ] //////
+// A gateway answers a burst of eight QoS 1 publishes with eight PUBACKs
+// to the same node, every 100 ms of virtual time, and the node sends
+// three short publishes of its own. Writes are payloads handed to the
+// simulated radio, airtime is what the channel was busy for.
+
+template<class TRANSPORT>
+struct BATCH_RUN
+{
+    MSN_SIM_WORLD world;
+    DEVICE_TYPE<DT_GATEWAY, TRANSPORT> gate;
+    DEVICE_TYPE<DT_NODE, TRANSPORT> node;
+
+    unsigned long nodeGot;
+    unsigned long gateGot;
+
+    BATCH_RUN() : world(7), gate(&world), node(&world), nodeGot(0), gateGot(0) {};
+};
+
+template<class TRANSPORT>
+void BenchBatch(const char *_Name)
+{
+    const uint16_t bursts = 1000;
+
+    static BATCH_RUN<TRANSPORT> *run;
+
+    std::unique_ptr<BATCH_RUN<TRANSPORT> > owner(new BATCH_RUN<TRANSPORT>());
+    run = owner.get();
+
+    run->gate.Setup();
+    run->node.Setup(1);
+
+    for (uint16_t b = 0; b < bursts; b++)
+    {
+        run->world.Schedule(b * 100000ULL, [b]() {
+            for (uint16_t i = 0; i < 8; i++)
+            {
+                byte ack[8];
+                MSN_PubAckFrame(ack, 1, b * 8 + i, RC_ACCEPTED);
+                run->gate.SendTo(ack, 1);
+            }
+
+            byte pub[] = { 9, MSN_PUBLISH, QOS_N1 | PD_TOPIC_ID_ON, 0, 1, 0, 0, 'h', 'i' };
+
+            for (uint16_t i = 0; i < 3; i++)
+            {
+                run->node.Send(pub, sizeof(pub));
+            }
+
+            // Update writes the batches once they are due
+            run->world.PollAt(MSN_GATEWAY_ADDRESS, run->world.NowUs() + (MSN_BATCH_DELAY_MS + 1) * 1000ULL);
+            run->world.PollAt(1, run->world.NowUs() + (MSN_BATCH_DELAY_MS + 1) * 1000ULL);
+        });
+    }
+
+    run->world.Run((bursts + 1) * 100000ULL, [](uint16_t _Address) {
+        if (_Address == MSN_GATEWAY_ADDRESS)
+        {
+            run->gate.Loop([](byte*, byte*, uint16_t*) { run->gateGot++; }, 0);
+        }
+        else
+        {
+            run->node.Loop([](byte*, byte*) { run->nodeGot++; }, 0);
+        }
+    });
+
+    const MSN_SIM_STATS &stats = run->world.Stats();
+
+    printf("{\"bench\":\"batch\",\"transport\":\"%s\",\"frames\":%u,\"delivered\":%lu,\"writes\":%llu,"
+        "\"writes_per_burst\":%.2f,\"airtime_ms\":%.1f}\n",
+        _Name, bursts * 11, run->nodeGot + run->gateGot, (unsigned long long)stats.framesSent,
+        (double)stats.framesSent / bursts, stats.airtimeUs / 1000.0);
+
+    run = 0;
+}
+
+void BenchBatches()
+{
+    BenchBatch<MSN_SIM_TRANSPORT>("plain");
+    BenchBatch<MSN_BATCH_TRANSPORT<MSN_SIM_TRANSPORT> >("batched");
+}
+
+
+////// [ MULTI RADIO ] //////
+// One simulated world per radio, so each is a channel of its own, all
+// stepped together 1 ms at a time. Every node publishes at QoS 0 once
+// per period with 5% jitter, more than a channel carries, and the
+// gateway counts what reaches it. Nodes are spread evenly over the
+// radios, as MSN_MULTI_JOIN_SLACK would leave them.
+
+typedef MSN_SIM_TRANSPORT *SIM_RADIO;
+
+template<byte RADIOS>
+struct MULTI_RUN
+{
+    typedef DEVICE_TYPE<DT_GATEWAY, MSN_MULTI_TRANSPORT<MSN_SIM_TRANSPORT, RADIOS> > GATEWAY;
+
+    std::vector<std::unique_ptr<MSN_SIM_WORLD> > worlds;
+    std::vector<std::unique_ptr<MSN_SIM_TRANSPORT> > radios;
+    std::unique_ptr<GATEWAY> gate;
+    std::vector<std::unique_ptr<SIM_NODE> > nodes;
+
+    unsigned long received;
+};
+
+template<class GATEWAY>
+GATEWAY *MakeMulti(SIM_RADIO *_R, std::integral_constant<int, 1>*) { return new GATEWAY(_R[0]); }
+
+template<class GATEWAY>
+GATEWAY *MakeMulti(SIM_RADIO *_R, std::integral_constant<int, 2>*) { return new GATEWAY(_R[0], _R[1]); }
+
+template<class GATEWAY>
+GATEWAY *MakeMulti(SIM_RADIO *_R, std::integral_constant<int, 4>*) { return new GATEWAY(_R[0], _R[1], _R[2], _R[3]); }
+
+template<byte RADIOS>
+void BenchMultiRadio(uint16_t _NodesPerRadio, uint64_t _PeriodUs)
+{
+    typedef MULTI_RUN<RADIOS> RUN;
+
+    static RUN *run;
+    static MSN_MESSAGE<MSN_PUBLISH> msg;
+
+    std::unique_ptr<RUN> owner(new RUN());
+    SIM_RADIO radios[RADIOS];
+
+    run = owner.get();
+    run->received = 0;
+
+    msg.topicID = 1;
+    msg.flags = PD_TOPIC_ID_ON;
+
+    uint32_t value = 1;
+    MSN_SetPublishData(msg, &value, sizeof(value));
+
+    for (byte r = 0; r < RADIOS; r++)
+    {
+        run->worlds.push_back(std::unique_ptr<MSN_SIM_WORLD>(new MSN_SIM_WORLD(7 + r)));
+        run->worlds[r]->defaultLink.loss = 0;
+        run->radios.push_back(std::unique_ptr<MSN_SIM_TRANSPORT>(new MSN_SIM_TRANSPORT(run->worlds[r].get())));
+        radios[r] = run->radios[r].get();
+    }
+
+    run->gate.reset(MakeMulti<typename RUN::GATEWAY>(radios, (std::integral_constant<int, RADIOS>*)0));
+    run->gate->Setup();
+
+    const uint64_t end = 20ULL * 1000000ULL;
+
+    for (uint16_t i = 0; i < _NodesPerRadio * RADIOS; i++)
+    {
+        MSN_SIM_WORLD *world = run->worlds[i % RADIOS].get();
+        uint16_t id = i / RADIOS + 1;
+
+        run->nodes.push_back(std::unique_ptr<SIM_NODE>(new SIM_NODE(world)));
+        run->nodes[i]->Setup(id);
+
+        for (uint64_t at = (uint64_t)rand() % _PeriodUs; at < end; at += _PeriodUs - _PeriodUs / 20 + (uint64_t)rand() % (_PeriodUs / 10))
+        {
+            world->Schedule(at, [i, id, world]() {
+                run->nodes[i]->Send(msg);
+                world->PollAt(id, world->NowUs());
+            });
+        }
+    }
+
+    for (uint64_t t = 1000; t <= end; t += 1000)
+    {
+        for (byte r = 0; r < RADIOS; r++)
+        {
+            run->worlds[r]->Run(t, [r](uint16_t _Address) {
+                if (_Address == MSN_GATEWAY_ADDRESS)
+                {
+                    run->gate->Loop([](byte *msg_type, byte*, uint16_t*) { run->received += *msg_type == MSN_PUBLISH; }, 0);
+                }
+                else
+                {
+                    run->nodes[(_Address - 1) * RADIOS + r]->Loop([](byte*, byte*) {}, 0);
+                }
+            });
+        }
+    }
+
+    double airtime = 0;
+
+    for (byte r = 0; r < RADIOS; r++)
+    {
+        airtime += (double)run->worlds[r]->Stats().airtimeUs / end / RADIOS;
+    }
+
+    printf("{\"bench\":\"multi_radio\",\"radios\":%u,\"nodes\":%u,\"offered_per_s\":%.0f,"
+        "\"publishes_per_s\":%.0f,\"airtime_per_radio\":%.2f}\n",
+        RADIOS, _NodesPerRadio * RADIOS, _NodesPerRadio * RADIOS * 1e6 / _PeriodUs,
+        run->received * 1e6 / end, airtime);
+
+    run = 0;
+}
+
+void BenchMultiRadios()
+{
+    BenchMultiRadio<1>(40, 50000);
+    BenchMultiRadio<2>(40, 50000);
+    BenchMultiRadio<4>(40, 50000);
+}
+
+
+////// [ CHECKS ] //////
+// Behaviour the library relies on, one line each. main returns 1
+// when a check fails.
+
+bool Check(const char *_Name, bool _Passed)
+{
+    printf("{\"check\":\"%s\",\"passed\":%s}\n", _Name, _Passed ? "true" : "false");
+
+    return _Passed;
+}
+
+SIM_GATEWAY *check_gate;
+SIM_NODE *check_node;
+
+void check_gateway_handler(byte *, byte *, uint16_t *) {}
+void check_node_handler(byte *, byte *) {}
+
+// Lets a gateway and one node answer each other for a virtual second.
+void CheckSettle(MSN_SIM_WORLD &_World)
+{
+    _World.Run(_World.NowUs() + 1000000ULL, [](uint16_t _Address) {
+        if (_Address == MSN_GATEWAY_ADDRESS)
+        {
+            check_gate->Loop(&check_gateway_handler, 0);
+        }
+        else
+        {
+            check_node->Loop(&check_node_handler, 0);
+        }
+    });
+}
+
+// MSN_MESSAGE<MSN_DISCONNECT> always encodes a Duration. At 0 the
+// session ends, any other Duration puts it to sleep.
+bool CheckDisconnect()
+{
+    MSN_SIM_WORLD world(7);
+    SIM_GATEWAY gate(&world);
+    SIM_NODE node(&world);
+
+    check_gate = &gate;
+    check_node = &node;
+
+    gate.Setup();
+    node.Setup(1);
+
+    static MSN_MESSAGE<MSN_CONNECT> con;
+    static MSN_MESSAGE<MSN_DISCONNECT> disc;
+
+    strncpy(con.clientID, "check", CLIENT_ID_SZ);
+
+    node.Send(con);
+    CheckSettle(world);
+
+    disc.duration = 0;
+    node.Send(disc);
+    CheckSettle(world);
+
+    MSN_SESSION *session = gate.Session(1);
+    bool left = session && session->state == SS_DISCONNECTED;
+
+    node.Send(con);
+    CheckSettle(world);
+
+    disc.duration = 60;
+    node.Send(disc);
+    CheckSettle(world);
+
+    session = gate.Session(1);
+    bool asleep = session && session->state == SS_ASLEEP && session->duration == 60;
+
+    return Check("disconnect_duration", left && asleep);
+}
+
+byte check_stream[512];
+uint16_t check_streams;
+byte check_fill;
+
+void check_stream_source(uint16_t, byte *_Out, uint16_t _Len, void *)
+{
+    memset(_Out, check_fill, _Len);
+}
+
+void check_stream_handler(uint16_t, const byte *, uint16_t, void *)
+{
+    check_streams++;
+}
+
+// A node that restarts counts stream msgIDs from 1 again, the
+// gateway takes the stream it sends next as a new one.
+bool CheckStreamRestart()
+{
+    MSN_SIM_WORLD world(7);
+    SIM_GATEWAY gate(&world);
+    SIM_NODE node(&world);
+    SIM_NODE restarted(&world);
+
+    check_gate = &gate;
+    check_node = &node;
+    check_streams = 0;
+
+    gate.Setup();
+    gate.StreamInto(check_stream, sizeof(check_stream), &check_stream_handler, 0);
+    node.Setup(1);
+
+    check_fill = 'a';
+    node.PublishStream(1, 0, 300, &check_stream_source, 0);
+    CheckSettle(world);
+
+    restarted.Setup(1);
+    check_node = &restarted;
+
+    check_fill = 'b';
+    restarted.PublishStream(1, 0, 300, &check_stream_source, 0);
+    CheckSettle(world);
+
+    return Check("stream_restart", check_streams == 2 && check_stream[MSN_STREAM_HEADER_SZ] == 'b');
+}
+
+// Encodes CASES messages of random content, about one octet in
+// eight a NUL so strings end anywhere, and checks each frame decodes
+// and encodes again to the same octets, reads as valid in MSN_VIEW
+// and is refused by MSN_Decode when cut one octet short.
+template<MSN_MsgType M_TYPE>
+bool CheckCodec()
+{
+    const unsigned CASES = 1024;
+
+    for (unsigned c = 0; c < CASES; c++)
+    {
+        static MSN_MESSAGE<M_TYPE> msg;
+        static MSN_MESSAGE<M_TYPE> back;
+
+        byte *raw = (byte*)&msg;
+
+        for (unsigned i = 0; i < sizeof(msg); i++)
+        {
+            raw[i] = rand() % 8 ? (byte)rand() : 0;
+        }
+
+        byte frame[MAX_PAYLOAD_SIZE];
+        byte again[MAX_PAYLOAD_SIZE];
+
+        uint16_t len = MSN_Encode(msg, frame, sizeof(frame));
+
+        if (!len || len != MSN_EncodedLength(msg) || !MSN_VIEW<M_TYPE>(frame, len).Valid() ||
+            !MSN_Decode(frame, len, back) || MSN_Decode(frame, len - 1, back) ||
+            !MSN_Decode(frame, len, back) || MSN_Encode(back, again, sizeof(again)) != len ||
+            memcmp(frame, again, len) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CheckCodecs()
+{
+    return Check("codec_roundtrip",
+        CheckCodec<MSN_ADVERTISE>() && CheckCodec<MSN_SEARCHGW>() && CheckCodec<MSN_GWINFO>() &&
+        CheckCodec<MSN_CONNECT>() && CheckCodec<MSN_CONNACK>() && CheckCodec<MSN_WILLTOPICREQ>() &&
+        CheckCodec<MSN_WILLTOPIC>() && CheckCodec<MSN_WILLMSGREQ>() && CheckCodec<MSN_WILLMSG>() &&
+        CheckCodec<MSN_REGISTER>() && CheckCodec<MSN_REGACK>() && CheckCodec<MSN_PUBLISH>() &&
+        CheckCodec<MSN_PUBACK>() && CheckCodec<MSN_PUBREC>() && CheckCodec<MSN_PUBREL>() &&
+        CheckCodec<MSN_PUBCOMP>() && CheckCodec<MSN_SUBSCRIBE>() && CheckCodec<MSN_UNSUBSCRIBE>() &&
+        CheckCodec<MSN_SUBACK>() && CheckCodec<MSN_UNSUBACK>() && CheckCodec<MSN_PINGREQ>() &&
+        CheckCodec<MSN_PINGRESP>() && CheckCodec<MSN_DISCONNECT>() && CheckCodec<MSN_WILLTOPICUPD>() &&
+        CheckCodec<MSN_WILLMSGUPD>() && CheckCodec<MSN_WILLTOPICRESP>() && CheckCodec<MSN_WILLMSGRESP>());
+}
+
+// A radio that only counts the DHCP passes it is given.
+class CHECK_RADIO
+{
+
+public:
+    uint16_t peers;
+    unsigned dhcp;
+
+    CHECK_RADIO(uint16_t _Peers) : peers(_Peers), dhcp(0) {};
+
+    void DHCP() { dhcp++; }
+    uint16_t PeerCount() { return peers; }
+};
+
+// Radios at equal load all take joins. Once one has more than
+// MSN_MULTI_JOIN_SLACK nodes over the least loaded radio it gets no
+// DHCP pass, and takes joins again when the others catch up.
+bool CheckJoinGating()
+{
+    CHECK_RADIO a(5), b(5), c(5);
+    MSN_MULTI_TRANSPORT<CHECK_RADIO, 3> multi(&a, &b, &c);
+
+    multi.DHCP();
+
+    bool equal = a.dhcp == 1 && b.dhcp == 1 && c.dhcp == 1;
+
+    a.peers = 0;
+    b.peers = MSN_MULTI_JOIN_SLACK;
+    c.peers = MSN_MULTI_JOIN_SLACK + 1;
+
+    multi.DHCP();
+
+    bool skewed = a.dhcp == 2 && b.dhcp == 2 && c.dhcp == 1;
+
+    a.peers = 1;
+
+    multi.DHCP();
+
+    bool caught_up = a.dhcp == 3 && b.dhcp == 3 && c.dhcp == 2;
+
+    return Check("multi_join_gating", equal && skewed && caught_up);
+}
+
+bool Checks()
+{
+    bool passed = true;
+
+    passed &= CheckCodecs();
+    passed &= CheckDisconnect();
+    passed &= CheckStreamRestart();
+    passed &= CheckJoinGating();
+
+    return passed;
+}
+
+
+int main()
+{
+
+    BenchCodecs();
+    BenchDispatches();
+    BenchFanout();
+    BenchMatch();
+    BenchE2Es();
+    BenchBatches();
+    BenchMultiRadios();
+
+    return Checks() ? 0 : 1;
+
+}
@@ -1,3 +1,9 @@
+// An UNO has 2k of RAM, leave out what this sketch does not use:
+// QoS 1 and 2 publishing, QoS 2 receiving and streamed publishes.
+#define MSN_NODE_QOS_SLOTS 0
+#define MSN_NODE_QOS_RECEIVED 0
+#define MSN_NODE_STREAM 0
+
 #include <mqttSNmsg.h>
 
 #define NodeID 1 // can be 1-253, 0 is reserved for gateway.
@@ -20,10 +26,19 @@ void event_handler(byte *msg_type, byte *data_buffer)
 		break;
 
 	case MSN_CONNACK :
+	{
+		MSN_VIEW<MSN_CONNACK> ack(data_buffer, node.ReceivedLength());
+
+		if (!ack.Valid())
+		{
+			break;
+		}
+
 		Serial.println("Recieved connack...");
 		Serial.print("Return code: ");
-		Serial.println(data_buffer[2]);
+		Serial.println(ack.ReturnCode());
 		break;
+	}
 
 	}
 
@@ -47,7 +62,7 @@ void loop() {
 
 	node.Loop(&event_handler, 10* 1000);
 
-	node.Send(&msgCon, msgCon.msgLength);
+	node.Send(msgCon);
 
 	Serial.println("Sent message connect...");
 
@@ -6,7 +6,7 @@ DEVICE_TYPE<DT_GATEWAY> gate(4,5);
 MSN_MESSAGE<MSN_CONNACK>msgConAck;
 MSN_MESSAGE<MSN_ADVERTISE>msgAdv;
 
-void event_handler(byte *msg_type, byte *data_buffer, uint16_t *sender_addr)
+void event_handler(byte *msg_type, byte *, uint16_t *sender_addr)
 {
 
   	Serial.println("Got mail.");
@@ -20,7 +20,7 @@ void event_handler(byte *msg_type, byte *data_buffer, uint16_t *sender_addr)
 
 		msgConAck.returnCode = RC_ACCEPTED;
 
-		gate.SendTo(&msgConAck,*sender_addr);
+		gate.SendTo(msgConAck,*sender_addr);
 
 		Serial.println("Send Conack..");
 
@@ -49,6 +49,6 @@ void loop() {
 
 	Serial.println("Loop again...");
 
-	gate.SendToAll(&msgAdv);
+	gate.SendToAll(msgAdv);
 
 }
\ No newline at end of file
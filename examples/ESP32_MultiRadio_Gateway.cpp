@@ -0,0 +1,61 @@
+#include <mqttSNmsg.h>
+#include <mqttSN_multi.h>
+
+
+// Two nRF24 modules on their own CE/CSN pins, one mesh segment each.
+// Nodes are built with MSN_RF24_TRANSPORT(CE, CSN, 90, 2) and join
+// whichever segment has room.
+MSN_RF24_TRANSPORT radio0(4, 5, 90);
+MSN_RF24_TRANSPORT radio1(22, 21, 90 + MSN_RF24_CHANNEL_STEP);
+
+DEVICE_TYPE<DT_GATEWAY, MSN_MULTI_TRANSPORT<MSN_RF24_TRANSPORT, 2> > gate(&radio0, &radio1);
+
+MSN_MESSAGE<MSN_CONNACK>msgConAck;
+MSN_MESSAGE<MSN_ADVERTISE>msgAdv;
+
+void event_handler(byte *msg_type, byte *, uint16_t *sender_addr)
+{
+
+	switch (*msg_type)
+	{
+
+	case MSN_CONNECT :
+
+		Serial.print("Connect from radio ");
+		Serial.println(MSN_MULTI_TRANSPORT<MSN_RF24_TRANSPORT, 2>::RadioOf(*sender_addr));
+
+		msgConAck.returnCode = RC_ACCEPTED;
+
+		gate.SendTo(msgConAck,*sender_addr);
+
+		break;
+
+	}
+
+}
+
+
+void setup() {
+	
+	Serial.begin(115200);
+	
+	gate.Setup();
+
+	msgAdv.gwID = 0xfe;
+
+}
+
+
+
+void loop() {
+
+	gate.Loop(&event_handler, 5 * 1000);
+
+	Serial.print("Nodes per radio: ");
+	Serial.print(gate.Transport().Load(0));
+	Serial.print(" ");
+	Serial.println(gate.Transport().Load(1));
+
+	gate.SendToAll(msgAdv);
+
+}
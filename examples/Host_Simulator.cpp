@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <vector>
+
+// a session for every node the default run starts
+#define MSN_MAX_SESSIONS 2048
+
+#include <mqttSNmsg.h>
+#include <mqttSN_sim.h>
+
+// Simulates an hour of a large mesh on the virtual clock: every node
+// connects, then publishes one reading per period to the gateway.
+// g++ -std=c++11 -O2 -Iinclude examples/Host_Simulator.cpp -o simulator
+// ./simulator [nodes] [publish period s] [loss]
+
+typedef DEVICE_TYPE<DT_GATEWAY, MSN_SIM_TRANSPORT> SIM_GATEWAY;
+typedef DEVICE_TYPE<DT_NODE, MSN_SIM_TRANSPORT> SIM_NODE;
+
+
+MSN_SIM_WORLD world(42);
+SIM_GATEWAY gate(&world);
+std::vector<std::unique_ptr<SIM_NODE> > nodes;
+std::vector<uint64_t> pollAt;
+
+MSN_MESSAGE<MSN_CONNACK> msgConAck;
+MSN_MESSAGE<MSN_CONNECT> msgCon;
+MSN_MESSAGE<MSN_PUBLISH> msgPub;
+
+unsigned long connects = 0;
+unsigned long connacks = 0;
+unsigned long publishes = 0;
+unsigned long sendFailures = 0;
+
+
+void gateway_handler(byte *msg_type, byte *, uint16_t *sender_addr)
+{
+	switch (*msg_type)
+	{
+
+	case MSN_CONNECT :
+		connects++;
+		msgConAck.returnCode = RC_ACCEPTED;
+		gate.SendTo(msgConAck, *sender_addr);
+		break;
+
+	case MSN_PUBLISH :
+		publishes++;
+		break;
+
+	}
+}
+
+
+void sent_handler(uint16_t, const byte *, bool _Delivered, void *)
+{
+	if (!_Delivered)
+	{
+		sendFailures++;
+	}
+}
+
+
+// Comes back to a device while it has frames to retry.
+void keep_polling(uint16_t _Address, uint16_t _Pending)
+{
+	if (_Pending && pollAt[_Address] <= world.NowUs())
+	{
+		pollAt[_Address] = world.NowUs() + MSN_OUTBOX_TICK_MS * 1000ULL;
+		world.PollAt(_Address, pollAt[_Address]);
+	}
+}
+
+
+void node_handler(byte *msg_type, byte *)
+{
+	if (*msg_type == MSN_CONNACK)
+	{
+		connacks++;
+	}
+}
+
+
+void publish_every(uint16_t _Index, uint64_t _PeriodUs)
+{
+	if (!nodes[_Index]->Send(msgPub))
+	{
+		sendFailures++;
+	}
+
+	keep_polling(_Index + 1, nodes[_Index]->Pending());
+
+	world.Schedule(world.NowUs() + _PeriodUs, [=]() { publish_every(_Index, _PeriodUs); });
+}
+
+
+int main(int argc, char **argv)
+{
+
+	uint16_t node_count = argc > 1 ? atoi(argv[1]) : 2000;
+	uint64_t period_us = (argc > 2 ? atoi(argv[2]) : 60) * 1000000ULL;
+	world.defaultLink.loss = argc > 3 ? atof(argv[3]) : 0.01f;
+
+	const uint64_t hour_us = 3600ULL * 1000000ULL;
+
+	if (node_count > MSN_MAX_SESSIONS)
+	{
+		fprintf(stderr, "%u nodes need more than the gateway's %u sessions\n", node_count, (unsigned)MSN_MAX_SESSIONS);
+		return 1;
+	}
+
+	gate.Setup();
+	gate.OnSent(&sent_handler, 0);
+	pollAt.assign(node_count + 1, 0);
+
+	msgPub.topicID = 1;
+
+	// a 4 byte sensor reading
+	uint32_t reading = 2150;
+	MSN_SetPublishData(msgPub, &reading, sizeof(reading));
+
+	for (uint16_t i = 0; i < node_count; i++)
+	{
+		nodes.push_back(std::unique_ptr<SIM_NODE>(new SIM_NODE(&world)));
+		nodes[i]->Setup(i + 1);
+		nodes[i]->OnSent(&sent_handler, 0);
+
+		// spread joins and first readings over the first period
+		uint64_t start = (uint64_t)rand() % period_us;
+
+		world.Schedule(start, [=]() {
+			snprintf(msgCon.clientID, CLIENT_ID_SZ, "sim node %u", i + 1);
+			if (!nodes[i]->Send(msgCon))
+			{
+				sendFailures++;
+			}
+			keep_polling(i + 1, nodes[i]->Pending());
+			world.Schedule(world.NowUs() + (uint64_t)rand() % period_us, [=]() { publish_every(i, period_us); });
+		});
+	}
+
+	world.Run(hour_us, [](uint16_t _Address) {
+		if (_Address == MSN_GATEWAY_ADDRESS)
+		{
+			gate.Loop(&gateway_handler, 0);
+			keep_polling(_Address, gate.Pending());
+		}
+		else
+		{
+			nodes[_Address - 1]->Loop(&node_handler, 0);
+			keep_polling(_Address, nodes[_Address - 1]->Pending());
+		}
+	});
+
+	const MSN_SIM_STATS &stats = world.Stats();
+
+	printf("virtual time      %.1f s\n", world.NowUs() / 1e6);
+	printf("nodes             %u\n", node_count);
+	printf("connect/connack   %lu / %lu\n", connects, connacks);
+	printf("sessions open     %u\n", gate.Sessions().Count());
+	printf("publishes in      %lu\n", publishes);
+	printf("send failures     %lu\n", sendFailures);
+	printf("frames sent       %llu\n", (unsigned long long)stats.framesSent);
+	printf("frames delivered  %llu\n", (unsigned long long)stats.framesDelivered);
+	printf("frames lost       %llu\n", (unsigned long long)stats.framesLost);
+	printf("frames collided   %llu\n", (unsigned long long)stats.framesCollided);
+	printf("frames overflowed %llu\n", (unsigned long long)stats.framesOverflowed);
+	printf("gateway max queue %u\n", (unsigned)world.MaxDepth(MSN_GATEWAY_ADDRESS));
+	printf("channel airtime   %.1f %%\n", 100.0 * stats.airtimeUs / world.NowUs());
+
+	return 0;
+
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <mqttSNmsg.h>
+#include <mqttSN_bridge.h>
+
+// Linux_UDP_Gateway.cpp with its PUBLISH and SUBSCRIBE traffic bridged
+// to an MQTT broker, e.g. mosquitto, on 127.0.0.1:1883.
+// g++ -std=c++11 -Iinclude examples/Linux_Bridge_Gateway.cpp -o bridge
+
+
+DEVICE_TYPE<DT_GATEWAY, MSN_UDP_TRANSPORT> gate(MSN_UDP_BASE_PORT);
+
+MSN_MQTT_BRIDGE<DEVICE_TYPE<DT_GATEWAY, MSN_UDP_TRANSPORT> > bridge(gate, "127.0.0.1", 1883);
+
+MSN_MESSAGE<MSN_CONNACK>msgConAck;
+
+void event_handler(byte *msg_type, byte *data_buffer, uint16_t *sender_addr)
+{
+
+	switch (*msg_type)
+	{
+
+	case MSN_CONNECT :
+
+		msgConAck.returnCode = RC_ACCEPTED;
+
+		gate.SendTo(msgConAck,*sender_addr);
+
+		break;
+
+	case MSN_PUBLISH :
+	case MSN_SUBSCRIBE :
+
+		bridge.Forward(data_buffer, gate.ReceivedLength());
+
+		break;
+
+	}
+
+}
+
+
+int main()
+{
+
+	if (!gate.Setup())
+	{
+		printf("Could not bind gateway port.\n");
+		return 1;
+	}
+
+	bridge.Begin();
+
+	while (1)
+	{
+		gate.Loop(&event_handler, 10);
+
+		bridge.Service();
+	}
+
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <mqttSNmsg.h>
+#include <mqttSN_thread.h>
+
+// Linux_UDP_Gateway.cpp with the link serviced on a radio thread of its
+// own. With -DMSN_USE_RF24 use MSN_RF24_TRANSPORT and its pins instead.
+// g++ -std=c++11 -pthread -Iinclude examples/Linux_Threaded_Gateway.cpp -o gateway
+
+
+DEVICE_TYPE<DT_GATEWAY, MSN_THREADED_TRANSPORT<MSN_UDP_TRANSPORT> > gate(MSN_UDP_BASE_PORT);
+
+MSN_MESSAGE<MSN_CONNACK>msgConAck;
+MSN_MESSAGE<MSN_ADVERTISE>msgAdv;
+
+void event_handler(byte *msg_type, byte *, uint16_t *sender_addr)
+{
+
+	switch (*msg_type)
+	{
+
+	case MSN_CONNECT :
+
+		msgConAck.returnCode = RC_ACCEPTED;
+
+		gate.SendTo(msgConAck,*sender_addr);
+
+		break;
+
+	}
+
+}
+
+
+int main()
+{
+
+	if (!gate.Setup())
+	{
+		printf("Could not bind gateway port.\n");
+		return 1;
+	}
+
+	msgAdv.gwID = 0xfe;
+
+	while (1)
+	{
+		gate.Loop(&event_handler, 5 * 1000);
+
+		MSN_RADIO_STATS stats = gate.Transport().Stats();
+
+		printf("in %u out %u overruns %u dropped %u\n", stats.received, stats.written, stats.overruns, stats.dropped);
+
+		gate.SendToAll(msgAdv);
+	}
+
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <mqttSNmsg.h>
+
+// Host build of ArduinoUNO_Client.cpp, runs over UDP on 127.0.0.1.
+// g++ -std=c++11 -Iinclude examples/Linux_UDP_Client.cpp -o client
+// ./client <node id 1-253>
+
+
+DEVICE_TYPE<DT_NODE, MSN_UDP_TRANSPORT> node(MSN_UDP_BASE_PORT);
+MSN_MESSAGE<MSN_CONNECT> msgCon;
+
+
+
+void event_handler(byte *msg_type, byte *data_buffer)
+{
+	switch (*msg_type)
+	{
+
+	case MSN_ADVERTISE :
+		printf("Recieved advertise...\n");
+		break;
+
+	case MSN_CONNACK :
+	{
+		MSN_VIEW<MSN_CONNACK> ack(data_buffer, node.ReceivedLength());
+
+		if (!ack.Valid())
+		{
+			break;
+		}
+
+		printf("Recieved connack...\n");
+		printf("Return code: %u\n", ack.ReturnCode());
+		break;
+	}
+
+	}
+
+}
+
+
+
+int main(int argc, char **argv)
+{
+
+	int node_id = argc > 1 ? atoi(argv[1]) : 1;
+
+	if (!node.Setup(node_id))
+	{
+		printf("Could not bind node port.\n");
+		return 1;
+	}
+
+	strncpy(msgCon.clientID, "hello node!", CLIENT_ID_SZ);
+
+	while (1)
+	{
+		node.Loop(&event_handler, 10* 1000);
+
+		node.Send(msgCon);
+
+		printf("Sent message connect...\n");
+	}
+
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <mqttSNmsg.h>
+
+// Host build of ESP32_Gateway.cpp, runs over UDP on 127.0.0.1.
+// g++ -std=c++11 -Iinclude examples/Linux_UDP_Gateway.cpp -o gateway
+//
+// Built with -DMSN_STATS_ENABLED=1 it also writes its counters to
+// mqttsn.prom after every pass, for the node exporter's textfile
+// collector or anything else that reads the Prometheus format.
+// With -DMSN_TRACE_ENABLED=1 it writes the last frames it saw to
+// mqttsn.pcap, open it in Wireshark to see them decoded.
+
+
+DEVICE_TYPE<DT_GATEWAY, MSN_UDP_TRANSPORT> gate(MSN_UDP_BASE_PORT);
+
+MSN_MESSAGE<MSN_CONNACK>msgConAck;
+MSN_MESSAGE<MSN_ADVERTISE>msgAdv;
+
+void event_handler(byte *msg_type, byte *, uint16_t *sender_addr)
+{
+
+	printf("Got mail from %u: %u\n", *sender_addr, *msg_type);
+	switch (*msg_type)
+	{
+
+	case MSN_CONNECT :
+
+		printf("Connect Msg Rec.\n");
+
+		msgConAck.returnCode = RC_ACCEPTED;
+
+		gate.SendTo(msgConAck,*sender_addr);
+
+		printf("Send Conack..\n");
+
+		break;
+
+	}
+
+}
+
+
+void write_stats()
+{
+#if MSN_STATS_ENABLED
+	static char text[8192];
+
+	size_t len = MSN_StatsText(gate.Stats(), "mqttsn_gateway", text, sizeof(text));
+	FILE *file = fopen("mqttsn.prom.tmp", "w");
+
+	if (!file)
+	{
+		return;
+	}
+
+	fwrite(text, 1, len, file);
+	fclose(file);
+
+	// the collector never sees a half written file
+	rename("mqttsn.prom.tmp", "mqttsn.prom");
+#endif
+}
+
+
+void write_trace()
+{
+#if MSN_TRACE_ENABLED
+	FILE *file = fopen("mqttsn.pcap.tmp", "wb");
+
+	if (!file)
+	{
+		return;
+	}
+
+	int frames = MSN_TracePcap(gate.Trace(), gate.Transport().Millis(), file);
+
+	fclose(file);
+
+	if (frames >= 0)
+	{
+		rename("mqttsn.pcap.tmp", "mqttsn.pcap");
+	}
+#endif
+}
+
+
+int main()
+{
+
+	if (!gate.Setup())
+	{
+		printf("Could not bind gateway port.\n");
+		return 1;
+	}
+
+	msgAdv.gwID = 0xfe;
+
+	while (1)
+	{
+		gate.Loop(&event_handler, 5 * 1000);
+
+		printf("Loop again...\n");
+
+		write_stats();
+		write_trace();
+
+		gate.SendToAll(msgAdv);
+	}
+
+}
@@ -0,0 +1,292 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Batching transport. MSN_BATCH_TRANSPORT wraps another transport
+// and packs the frames written to the same destination within
+// MSN_BATCH_DELAY_MS into one payload of at most MSN_BATCH_SZ octets, so
+// a burst of PUBACKs, PINGRESPs and short PUBLISHes costs one network
+// write and one ack round trip instead of one each.
+//
+// A batch is the octet MSN_BATCH_MARKER followed by the frames as they
+// are, each delimited by its own Length field. A Length of 0 is not valid
+// MQTT-SN, so a device without batching drops a batch rather than
+// misreading it. A batch that ends up holding one frame goes out as that
+// frame alone. Read hands the frames of a batch out one at a time, so
+// Loop on the receiving side sees them as if they came separately.
+//
+//      DEVICE_TYPE<DT_NODE, MSN_BATCH_TRANSPORT<MSN_RF24_TRANSPORT> > node(CE_PIN, CSN_PIN);
+//
+// Both ends of a link must batch, or at least unpack. Write queues the
+// frame and Update, called by Loop, Send and SendTo, writes the batches
+// that are due. A batch the link does not take is tried again on later
+// Updates, MAX_RETRY_COUNT times in all, before it is dropped.
+// A node only talks to the gateway, build it with
+// MSN_BATCH_DESTINATIONS 1 to keep the buffers to one batch.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSNmsg.h>
+
+
+#define MSN_BATCH_MARKER 0x00
+
+static_assert(MSN_BATCH_SZ <= MAX_PAYLOAD_SIZE, "MSN_BATCH_SZ must fit what the receiver reads");
+
+
+struct MSN_BATCH_STATS
+{
+    uint32_t frames;                // frames queued by Write
+    uint32_t writes;                // payloads the link took, batches or single frames
+    uint32_t dropped;               // batches dropped after MAX_RETRY_COUNT attempts
+    uint32_t unpacked;              // frames read out of received batches
+};
+
+
+template<class INNER>
+class MSN_BATCH_TRANSPORT
+{
+
+protected:
+    INNER inner;
+
+    // Open batches, one per destination.
+    byte batch[MSN_BATCH_DESTINATIONS][MSN_BATCH_SZ];
+    uint16_t used[MSN_BATCH_DESTINATIONS];
+    byte count[MSN_BATCH_DESTINATIONS];
+    byte attempts[MSN_BATCH_DESTINATIONS];
+    uint16_t to[MSN_BATCH_DESTINATIONS];
+    unsigned long due[MSN_BATCH_DESTINATIONS];
+
+    // Received batch being handed out by Read.
+    byte in[MAX_PAYLOAD_SIZE];
+    uint16_t inLength;
+    uint16_t inNext;
+    uint16_t inFrom;
+
+    MSN_BATCH_STATS stats;
+
+    // Writes the batch in _Slot, true when the slot is free afterwards.
+    bool Send(byte _Slot)
+    {
+        bool sent = count[_Slot] == 1
+            ? inner.Write(to[_Slot], batch[_Slot] + 1, used[_Slot] - 1)
+            : inner.Write(to[_Slot], batch[_Slot], used[_Slot]);
+
+        if (sent)
+        {
+            stats.writes++;
+        }
+        else if (++attempts[_Slot] < MAX_RETRY_COUNT)
+        {
+            due[_Slot] = inner.Millis() + MSN_BATCH_DELAY_MS;
+            return false;
+        }
+        else
+        {
+            stats.dropped++;
+        }
+
+        count[_Slot] = 0;
+
+        return true;
+    }
+
+    byte Slot(uint16_t _To) const
+    {
+        for (byte i = 0; i < MSN_BATCH_DESTINATIONS; i++)
+        {
+            if (count[i] && to[i] == _To)
+            {
+                return i;
+            }
+        }
+
+        return MSN_BATCH_DESTINATIONS;
+    }
+
+    // Next frame of the received batch, 0 once it is used up.
+    uint16_t Unpack(byte *_Buffer, uint16_t _Size, uint16_t *_From)
+    {
+        uint16_t left = inLength - inNext;
+        uint16_t len = left >= 3 || (left && in[inNext] != 0x01) ? MSN_FrameLength(in + inNext) : 0;
+
+        // a malformed Length ends the batch
+        if (len < 2 || len > left)
+        {
+            inLength = inNext = 0;
+            return 0;
+        }
+
+        memcpy(_Buffer, in + inNext, len < _Size ? len : _Size);
+        *_From = inFrom;
+
+        inNext += len;
+        stats.unpacked++;
+
+        return len < _Size ? len : _Size;
+    }
+
+public:
+    // Arguments are handed to the wrapped transport.
+    template<class... ARGS>
+    MSN_BATCH_TRANSPORT(ARGS... _Args) : inner(_Args...), inLength(0), inNext(0), inFrom(0)
+    {
+        for (byte i = 0; i < MSN_BATCH_DESTINATIONS; i++)
+        {
+            count[i] = 0;
+        }
+
+        memset(&stats, 0, sizeof(stats));
+    };
+
+    bool Begin(uint16_t _NodeID) { return inner.Begin(_NodeID); }
+
+    bool Restart() { return inner.Restart(); }
+
+    // Services the link and writes the batches that are due.
+    void Update()
+    {
+        inner.Update();
+
+        unsigned long now = inner.Millis();
+
+        for (byte i = 0; i < MSN_BATCH_DESTINATIONS; i++)
+        {
+            if (count[i] && (long)(now - due[i]) >= 0)
+            {
+                Send(i);
+            }
+        }
+    }
+
+    void DHCP() { inner.DHCP(); }
+
+    bool Available() { return inNext < inLength || inner.Available(); }
+
+    uint16_t Read(byte *_Buffer, uint16_t _Size, uint16_t *_From)
+    {
+        if (inNext < inLength)
+        {
+            return Unpack(_Buffer, _Size, _From);
+        }
+
+        uint16_t len = inner.Read(_Buffer, _Size, _From);
+
+        if (len < 2 || _Buffer[0] != MSN_BATCH_MARKER)
+        {
+            return len;
+        }
+
+        memcpy(in, _Buffer, len);
+        inLength = len;
+        inNext = 1;
+        inFrom = *_From;
+
+        return Unpack(_Buffer, _Size, _From);
+    }
+
+    // Adds the frame to the batch toward _To, writing that batch
+    // first when the frame does not fit. Frames too long to share
+    // a batch are written straight away, after the batch toward _To.
+    // False when a batch that had to go out could not.
+    bool Write(uint16_t _To, const void *_Payload, uint16_t _Len)
+    {
+        byte slot = Slot(_To);
+
+        if (slot != MSN_BATCH_DESTINATIONS && used[slot] + _Len > MSN_BATCH_SZ && !Send(slot))
+        {
+            return false;
+        }
+
+        if (_Len + 1 > MSN_BATCH_SZ)
+        {
+            if (!inner.Write(_To, _Payload, _Len))
+            {
+                return false;
+            }
+
+            stats.frames++;
+            stats.writes++;
+
+            return true;
+        }
+
+        slot = Slot(_To);
+
+        if (slot == MSN_BATCH_DESTINATIONS)
+        {
+            byte oldest = 0;
+
+            for (slot = 0; slot < MSN_BATCH_DESTINATIONS && count[slot]; slot++)
+            {
+                if ((long)(due[slot] - due[oldest]) < 0)
+                {
+                    oldest = slot;
+                }
+            }
+
+            // every slot busy, the one closest to due makes room
+            if (slot == MSN_BATCH_DESTINATIONS)
+            {
+                if (!Send(oldest))
+                {
+                    return false;
+                }
+
+                slot = oldest;
+            }
+
+            batch[slot][0] = MSN_BATCH_MARKER;
+            used[slot] = 1;
+            attempts[slot] = 0;
+            to[slot] = _To;
+            due[slot] = inner.Millis() + MSN_BATCH_DELAY_MS;
+        }
+
+        memcpy(batch[slot] + used[slot], _Payload, _Len);
+        used[slot] += _Len;
+        count[slot]++;
+
+        stats.frames++;
+
+        return true;
+    }
+
+    // Writes every open batch now, e.g. before a node sleeps.
+    void Flush()
+    {
+        for (byte i = 0; i < MSN_BATCH_DESTINATIONS; i++)
+        {
+            while (count[i] && !Send(i)) {}
+        }
+    }
+
+    bool CheckConnection() { return inner.CheckConnection(); }
+
+    bool RenewAddress() { return inner.RenewAddress(); }
+
+    uint16_t PeerCount() { return inner.PeerCount(); }
+
+    uint16_t PeerAddress(uint16_t _Index) { return inner.PeerAddress(_Index); }
+
+    unsigned long Millis() { return inner.Millis(); }
+
+    void Delay(unsigned long _Ms) { inner.Delay(_Ms); }
+
+    // Frames waiting in open batches.
+    uint16_t Queued() const
+    {
+        uint16_t queued = 0;
+
+        for (byte i = 0; i < MSN_BATCH_DESTINATIONS; i++)
+        {
+            queued += count[i];
+        }
+
+        return queued;
+    }
+
+    const MSN_BATCH_STATS &Stats() const { return stats; }
+
+    INNER &Inner() { return inner; }
+};
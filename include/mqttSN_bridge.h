@@ -0,0 +1,744 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Bridge from a Linux hosted gateway to an MQTT 3.1.1 broker. The
+// bridge aggregates: the whole mesh shares one TCP connection, so its cost
+// per message does not grow with the number of clients. PUBLISH frames
+// from the mesh are published to the broker under their topic name and
+// SUBSCRIBE frames subscribe the bridge to the same filter, once for
+// every client asking. Broker messages for those filters are handed to
+// SendToSubscribers.
+//
+// The socket is non-blocking and packets are only ever appended to a
+// fixed send buffer, Service writes out as much as the kernel takes and
+// parses whatever came in. Publishes are pipelined, the next one does
+// not wait for the broker's ack of the last. No heap is used.
+//
+//      MSN_MQTT_BRIDGE<GATEWAY> bridge(gate, "127.0.0.1", 1883);
+//
+//      void event_handler(byte *msg_type, byte *data_buffer, uint16_t *sender_addr)
+//      {
+//          bridge.Forward(data_buffer, gate.ReceivedLength());
+//      }
+//
+//      for (;;)
+//      {
+//          gate.Loop(&event_handler, 10);
+//          bridge.Service();
+//      }
+//
+// Pre-defined topic id n is bridged as MSN_BRIDGE_PD_PREFIX followed by n.
+// Mesh publishes reach mesh subscribers through the broker, the handler
+// should not also forward them itself. Publishes from the mesh while the
+// broker is unreachable are dropped and counted.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSNmsg.h>
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+enum MSN_BridgeState
+{
+    BS_DOWN = 0,        // waiting to reconnect
+    BS_CONNECTING,      // TCP connect in progress
+    BS_HANDSHAKE,       // CONNECT sent, waiting for CONNACK
+    BS_UP
+};
+
+struct MSN_BRIDGE_STATS
+{
+    uint32_t published;             // PUBLISH sent to the broker
+    uint32_t acked;                 // of those, acked at QoS 1 or 2
+    uint32_t received;              // PUBLISH from the broker passed on
+    uint32_t dropped;               // not sent, broker down or buffer full
+    uint32_t connects;              // CONNACKs accepted
+};
+
+
+template<class GATEWAY>
+class MSN_MQTT_BRIDGE
+{
+
+protected:
+    GATEWAY &gate;
+
+    char host[64];
+    uint16_t port;
+    char clientID[64];
+
+    int sock;
+    byte state;
+    unsigned long stateSince;
+    unsigned long lastRx;
+    unsigned long lastTx;
+    uint16_t nextPacketID;
+
+    byte tx[MSN_BRIDGE_TX_SZ];
+    uint32_t txHead;
+    uint32_t txTail;
+
+    byte rx[MSN_BRIDGE_RX_SZ];
+    uint32_t rxLength;
+
+    char filterArena[MSN_BRIDGE_FILTER_ARENA];
+    uint16_t filterOffset[MSN_BRIDGE_FILTERS];
+    byte filterLength[MSN_BRIDGE_FILTERS];
+    uint16_t filterCount;
+    uint16_t arenaUsed;
+
+    MSN_BRIDGE_STATS stats;
+
+    static unsigned long Millis()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+    }
+
+    void Enter(byte _State)
+    {
+        state = _State;
+        stateSince = Millis();
+    }
+
+    ////// [ SEND BUFFER ] //////
+
+    // Starts a packet of _Type with _Remaining octets after the
+    // fixed header, false when the send buffer has no room for it.
+    bool Packet(byte _Type, uint32_t _Remaining)
+    {
+        uint32_t size = 1 + (_Remaining < 128 ? 1 : _Remaining < 16384 ? 2 : _Remaining < 2097152 ? 3 : 4) + _Remaining;
+
+        if (MSN_BRIDGE_TX_SZ - (txTail - txHead) < size)
+        {
+            return false;
+        }
+
+        if (MSN_BRIDGE_TX_SZ - txTail < size)
+        {
+            memmove(tx, tx + txHead, txTail - txHead);
+            txTail -= txHead;
+            txHead = 0;
+        }
+
+        tx[txTail++] = _Type;
+
+        do
+        {
+            byte digit = _Remaining & 0x7f;
+
+            _Remaining >>= 7;
+            tx[txTail++] = digit | (_Remaining ? 0x80 : 0x00);
+
+        } while (_Remaining);
+
+        return true;
+    }
+
+    void Put8(byte _Value) { tx[txTail++] = _Value; }
+
+    void Put16(uint16_t _Value)
+    {
+        tx[txTail++] = _Value >> 8;
+        tx[txTail++] = _Value & 0xff;
+    }
+
+    void PutBytes(const void *_Data, uint16_t _Len)
+    {
+        memcpy(tx + txTail, _Data, _Len);
+        txTail += _Len;
+    }
+
+    void PutString(const char *_String, uint16_t _Len)
+    {
+        Put16(_Len);
+        PutBytes(_String, _Len);
+    }
+
+    uint16_t PacketID()
+    {
+        if (++nextPacketID == 0)
+        {
+            nextPacketID = 1;
+        }
+
+        return nextPacketID;
+    }
+
+    void SendConnect()
+    {
+        uint16_t id_len = strlen(clientID);
+
+        if (!Packet(0x10, 10 + 2 + id_len))
+        {
+            return;
+        }
+
+        PutString("MQTT", 4);
+        Put8(0x04);                 // protocol level 3.1.1
+        Put8(0x02);                 // clean session
+        Put16(MSN_BRIDGE_KEEPALIVE);
+        PutString(clientID, id_len);
+    }
+
+    bool SendSubscribe(const char *_Filter, uint16_t _Len)
+    {
+        if (!Packet(0x82, 2 + 2 + _Len + 1))
+        {
+            return false;
+        }
+
+        Put16(PacketID());
+        PutString(_Filter, _Len);
+        Put8(0x01);                 // at most QoS 1 back
+
+        return true;
+    }
+
+    // Acks and the PUBREL of QoS 2, two octets of packet id.
+    void SendAck(byte _Type, uint16_t _PacketID)
+    {
+        if (Packet(_Type, 2))
+        {
+            Put16(_PacketID);
+        }
+    }
+
+    ////// [ SOCKET ] //////
+
+    void Drop()
+    {
+        if (sock >= 0)
+        {
+            close(sock);
+            sock = -1;
+        }
+
+        txHead = txTail = 0;
+        rxLength = 0;
+
+        Enter(BS_DOWN);
+    }
+
+    void Open()
+    {
+        addrinfo hints;
+        addrinfo *found = 0;
+        char service[8];
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        snprintf(service, sizeof(service), "%u", port);
+
+        Enter(BS_DOWN);
+
+        if (getaddrinfo(host, service, &hints, &found) != 0 || !found)
+        {
+            return;
+        }
+
+        sock = socket(found->ai_family, SOCK_STREAM, 0);
+
+        if (sock >= 0)
+        {
+            int one = 1;
+
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            if (connect(sock, found->ai_addr, found->ai_addrlen) == 0 || errno == EINPROGRESS)
+            {
+                Enter(BS_CONNECTING);
+            }
+            else
+            {
+                Drop();
+            }
+        }
+
+        freeaddrinfo(found);
+    }
+
+    // True once a non-blocking connect has gone through.
+    bool Connected()
+    {
+        pollfd writable = { sock, POLLOUT, 0 };
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        if (poll(&writable, 1, 0) <= 0)
+        {
+            return false;
+        }
+
+        return getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+    }
+
+    void Flush()
+    {
+        while (txTail > txHead)
+        {
+            ssize_t sent = send(sock, tx + txHead, txTail - txHead, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            if (sent < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    Drop();
+                }
+
+                return;
+            }
+
+            txHead += sent;
+            lastTx = Millis();
+        }
+
+        txHead = txTail = 0;
+    }
+
+    void Fill()
+    {
+        for (;;)
+        {
+            ssize_t got = recv(sock, rx + rxLength, MSN_BRIDGE_RX_SZ - rxLength, MSG_DONTWAIT);
+
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                Drop();
+                return;
+            }
+
+            if (got < 0)
+            {
+                return;
+            }
+
+            rxLength += got;
+            lastRx = Millis();
+
+            uint32_t used = 0;
+
+            while (used < rxLength)
+            {
+                uint32_t remaining = 0;
+                uint32_t header = 1;
+                bool complete = false;
+
+                for (byte shift = 0; header < 5 && used + header < rxLength; shift += 7)
+                {
+                    byte digit = rx[used + header++];
+
+                    remaining |= (uint32_t)(digit & 0x7f) << shift;
+
+                    if (!(digit & 0x80))
+                    {
+                        complete = true;
+                        break;
+                    }
+                }
+
+                if (!complete && header == 5)
+                {
+                    Drop();
+                    return;
+                }
+
+                if (!complete || used + header + remaining > rxLength)
+                {
+                    break;
+                }
+
+                Parse(rx[used], rx + used + header, remaining);
+
+                if (sock < 0)
+                {
+                    return;
+                }
+
+                used += header + remaining;
+            }
+
+            if (used == 0 && rxLength == MSN_BRIDGE_RX_SZ)
+            {
+                // a packet bigger than the receive buffer
+                Drop();
+                return;
+            }
+
+            memmove(rx, rx + used, rxLength - used);
+            rxLength -= used;
+        }
+    }
+
+    ////// [ BROKER PACKETS ] //////
+
+    void Parse(byte _Header, const byte *_Body, uint32_t _Len)
+    {
+        switch (_Header >> 4)
+        {
+
+        case 2:     // CONNACK
+
+            if (_Len >= 2 && _Body[1] == 0)
+            {
+                Enter(BS_UP);
+                stats.connects++;
+
+                for (uint16_t i = 0; i < filterCount; i++)
+                {
+                    SendSubscribe(filterArena + filterOffset[i], filterLength[i]);
+                }
+            }
+            else
+            {
+                Drop();
+            }
+
+            break;
+
+        case 3:     // PUBLISH
+
+            Received(_Header, _Body, _Len);
+            break;
+
+        case 4:     // PUBACK
+        case 7:     // PUBCOMP
+
+            stats.acked++;
+            break;
+
+        case 5:     // PUBREC
+
+            if (_Len >= 2)
+            {
+                SendAck(0x62, ((uint16_t)_Body[0] << 8) | _Body[1]);
+            }
+
+            break;
+        }
+    }
+
+    // A broker PUBLISH, passed on to the mesh clients subscribed to it.
+    void Received(byte _Header, const byte *_Body, uint32_t _Len)
+    {
+        byte qos = (_Header >> 1) & 0x03;
+
+        if (_Len < 2)
+        {
+            return;
+        }
+
+        uint16_t topic_len = ((uint16_t)_Body[0] << 8) | _Body[1];
+        uint32_t data_at = 2 + topic_len + (qos ? 2 : 0);
+
+        if (data_at > _Len)
+        {
+            return;
+        }
+
+        const char *topic = (const char*)_Body + 2;
+
+        if (qos)
+        {
+            SendAck(0x40, ((uint16_t)_Body[2 + topic_len] << 8) | _Body[3 + topic_len]);
+        }
+
+        uint32_t data_len = _Len - data_at;
+        uint16_t prefix = sizeof(MSN_BRIDGE_PD_PREFIX) - 1;
+        byte flags = (qos ? QOS_1 : 0) | (_Header & 0x01 ? RET_ON : 0);
+        uint16_t topic_id = MSN_NO_TOPIC;
+
+        if (topic_len > prefix && topic_len - prefix <= 5 && memcmp(topic, MSN_BRIDGE_PD_PREFIX, prefix) == 0)
+        {
+            char digits[6];
+            char *end;
+
+            memcpy(digits, topic + prefix, topic_len - prefix);
+            digits[topic_len - prefix] = 0;
+
+            unsigned long id = strtoul(digits, &end, 10);
+
+            if (*end == 0 && id > 0 && id < 0xffff)
+            {
+                topic_id = (uint16_t)id;
+                flags |= PD_TOPIC_ID_ON;
+            }
+        }
+
+        if (topic_id == MSN_NO_TOPIC)
+        {
+            topic_id = gate.Topics().Register(topic, topic_len);
+        }
+
+        if (topic_id == MSN_NO_TOPIC || data_len > PUBLISH_SZ)
+        {
+            stats.dropped++;
+            return;
+        }
+
+        byte frame[7 + PUBLISH_SZ] =
+        {
+            (byte)(7 + data_len), MSN_PUBLISH, flags,
+            (byte)(topic_id >> 8), (byte)(topic_id & 0xff),
+            0x00, 0x00
+        };
+
+        memcpy(frame + 7, _Body + data_at, data_len);
+
+        gate.SendToSubscribers(frame);
+        stats.received++;
+    }
+
+public:
+    MSN_MQTT_BRIDGE(GATEWAY &_Gate, const char *_Host = "127.0.0.1", uint16_t _Port = 1883,
+        const char *_ClientID = "mqttsn-gateway")
+        : gate(_Gate), port(_Port), sock(-1), state(BS_DOWN), stateSince(0), lastRx(0), lastTx(0),
+          nextPacketID(0), txHead(0), txTail(0), rxLength(0), filterCount(0), arenaUsed(0)
+    {
+        strncpy(host, _Host, sizeof(host) - 1);
+        host[sizeof(host) - 1] = 0;
+
+        strncpy(clientID, _ClientID, sizeof(clientID) - 1);
+        clientID[sizeof(clientID) - 1] = 0;
+
+        memset(&stats, 0, sizeof(stats));
+    };
+
+    MSN_MQTT_BRIDGE(const MSN_MQTT_BRIDGE&) = delete;
+    MSN_MQTT_BRIDGE& operator=(const MSN_MQTT_BRIDGE&) = delete;
+
+    ~MSN_MQTT_BRIDGE()
+    {
+        if (sock >= 0)
+        {
+            close(sock);
+        }
+    }
+
+    // Starts connecting, Service finishes it.
+    void Begin() { Open(); }
+
+    bool Up() const { return state == BS_UP; }
+    MSN_BridgeState State() const { return (MSN_BridgeState)state; }
+    const MSN_BRIDGE_STATS &Stats() const { return stats; }
+
+    // Octets waiting to go to the broker.
+    uint32_t Queued() const { return txTail - txHead; }
+
+    // Moves data both ways without blocking, keeps the broker
+    // connection alive and reconnects it when it drops. Call it
+    // from the same loop as the gateway's Loop.
+    void Service()
+    {
+        unsigned long now = Millis();
+
+        switch (state)
+        {
+
+        case BS_DOWN:
+
+            if (now - stateSince >= MSN_BRIDGE_RETRY_MS)
+            {
+                Open();
+            }
+
+            return;
+
+        case BS_CONNECTING:
+
+            if (Connected())
+            {
+                Enter(BS_HANDSHAKE);
+                lastRx = lastTx = now;
+
+                // nothing may go out ahead of the CONNECT
+                txHead = txTail = 0;
+                SendConnect();
+            }
+            else if (now - stateSince >= MSN_BRIDGE_RETRY_MS)
+            {
+                Drop();
+            }
+
+            return;
+
+        case BS_HANDSHAKE:
+
+            if (now - stateSince >= (unsigned long)MSN_BRIDGE_KEEPALIVE * 1000)
+            {
+                Drop();
+                return;
+            }
+
+            break;
+
+        case BS_UP:
+
+            if (now - lastRx >= (unsigned long)MSN_BRIDGE_KEEPALIVE * 1500)
+            {
+                Drop();
+                return;
+            }
+
+            if (now - lastTx >= (unsigned long)MSN_BRIDGE_KEEPALIVE * 500 && Packet(0xc0, 0))
+            {
+                lastTx = now;
+            }
+
+            break;
+        }
+
+        Flush();
+
+        if (sock >= 0)
+        {
+            Fill();
+        }
+
+        if (sock >= 0)
+        {
+            Flush();
+        }
+    }
+
+    // Publishes _Data under _Topic at MQTT QoS _QoS. False, and
+    // counted as dropped, while the broker is not connected or the
+    // send buffer is full.
+    bool Publish(const char *_Topic, uint16_t _TopicLen, const void *_Data, uint16_t _Len, byte _QoS, bool _Retain)
+    {
+        if (state != BS_UP || !Packet(0x30 | (_QoS << 1) | (_Retain ? 0x01 : 0x00), 2 + _TopicLen + (_QoS ? 2 : 0) + _Len))
+        {
+            stats.dropped++;
+            return false;
+        }
+
+        PutString(_Topic, _TopicLen);
+
+        if (_QoS)
+        {
+            Put16(PacketID());
+        }
+
+        PutBytes(_Data, _Len);
+        stats.published++;
+
+        return true;
+    }
+
+    // Subscribes the bridge to _Filter, once. Filters are kept and
+    // subscribed again after every reconnect. False when there is
+    // no room to keep it.
+    bool Subscribe(const char *_Filter, uint16_t _Len)
+    {
+        for (uint16_t i = 0; i < filterCount; i++)
+        {
+            if (filterLength[i] == _Len && memcmp(filterArena + filterOffset[i], _Filter, _Len) == 0)
+            {
+                return true;
+            }
+        }
+
+        if (_Len == 0 || _Len > 255 || filterCount == MSN_BRIDGE_FILTERS || MSN_BRIDGE_FILTER_ARENA - arenaUsed < _Len)
+        {
+            return false;
+        }
+
+        memcpy(filterArena + arenaUsed, _Filter, _Len);
+        filterOffset[filterCount] = arenaUsed;
+        filterLength[filterCount] = _Len;
+        filterCount++;
+        arenaUsed += _Len;
+
+        if (state == BS_UP)
+        {
+            SendSubscribe(_Filter, _Len);
+        }
+
+        return true;
+    }
+
+    // Passes a frame received from the mesh on to the broker:
+    // PUBLISH is published, SUBSCRIBE subscribes the bridge.
+    // Other frames are left to the application.
+    void Forward(const byte *_Frame, uint16_t _Len)
+    {
+        byte type = MSN_FrameType(_Frame);
+        char name[sizeof(MSN_BRIDGE_PD_PREFIX) + 5];
+
+        if (type == MSN_PUBLISH)
+        {
+            MSN_VIEW<MSN_PUBLISH> pub(_Frame, _Len);
+
+            if (!pub.Valid())
+            {
+                return;
+            }
+
+            byte qos = pub.Flags() & QOS_MASK;
+            const char *topic;
+            uint16_t topic_len;
+            char short_name[2] = { (char)(pub.TopicID() >> 8), (char)(pub.TopicID() & 0xff) };
+
+            if ((pub.Flags() & TOPIC_ID_TYPE) == PD_TOPIC_ID_ON)
+            {
+                topic_len = snprintf(name, sizeof(name), MSN_BRIDGE_PD_PREFIX "%u", pub.TopicID());
+                topic = name;
+            }
+            else if ((pub.Flags() & TOPIC_ID_TYPE) == TOPIC_NAME)
+            {
+                topic = short_name;
+                topic_len = 2;
+            }
+            else
+            {
+                topic = gate.Topics().Name(pub.TopicID(), &topic_len);
+            }
+
+            if (!topic)
+            {
+                return;
+            }
+
+            Publish(topic, topic_len, pub.Data(), pub.DataLength(),
+                qos == QOS_2 ? 2 : qos == QOS_1 ? 1 : 0, (pub.Flags() & RET_ON) != 0);
+        }
+        else if (type == MSN_SUBSCRIBE)
+        {
+            MSN_VIEW<MSN_SUBSCRIBE> sub(_Frame, _Len);
+
+            if (!sub.Valid())
+            {
+                return;
+            }
+
+            if (sub.HasTopicID())
+            {
+                Subscribe(name, snprintf(name, sizeof(name), MSN_BRIDGE_PD_PREFIX "%u", sub.TopicID()));
+            }
+            else
+            {
+                Subscribe(sub.TopicName(), sub.TopicNameLength());
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,370 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Wire encoding of MSN_MESSAGE<...>. Only the bytes a message
+// actually uses go on air: string fields (clientID, willTopic, willMsg)
+// are sent up to their terminating NUL, PUBLISH data up to the length
+// set with MSN_SetPublishData, and msgLength is computed from that
+// content. Messages over 255 octets use the 3-octet Length form.
+// 2-octet fields are sent most-significant octet first, per the spec.
+//
+// Each message type lists its fields after the MsgType in MSN_SCHEMA,
+// as MSN_FIELD descriptors. MSN_Encode, MSN_Decode and
+// MSN_EncodedLength are generated from that list per type, and a
+// static_assert checks every message at its longest fits
+// MAX_PAYLOAD_SIZE.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSNmsg.h>
+
+
+static_assert(7 + PUBLISH_SZ <= 255, "PUBLISH_SZ must fit the 1-octet msgLength of MSN_MESSAGE<MSN_PUBLISH>");
+
+
+////// [ FIELD DESCRIPTORS ] //////
+
+// One field of message M on air. Each descriptor knows the octets it
+// may take (MIN, MAX), how many it takes for a given message (Size),
+// and writes or reads them. Everything is resolved at compile time:
+// the member is a template argument and 2-octet fields are shifted
+// into place, so an encoder is a run of byte stores with no table
+// lookups or host byte order checks.
+template<class M>
+struct MSN_FIELD
+{
+    template<byte M::*F>
+    struct U8
+    {
+        static const uint16_t MIN = 1;
+        static const uint16_t MAX = 1;
+
+        static uint16_t Size(const M &) { return 1; }
+
+        static byte *Write(const M &_Msg, byte *_Out)
+        {
+            *_Out = _Msg.*F;
+            return _Out + 1;
+        }
+
+        static bool Read(M &_Msg, const byte *&_In, const byte *_End)
+        {
+            if (_End - _In < 1) { return false; }
+
+            _Msg.*F = *_In++;
+            return true;
+        }
+    };
+
+    // Most-significant octet first, per the spec.
+    template<uint16_t M::*F>
+    struct U16
+    {
+        static const uint16_t MIN = 2;
+        static const uint16_t MAX = 2;
+
+        static uint16_t Size(const M &) { return 2; }
+
+        static byte *Write(const M &_Msg, byte *_Out)
+        {
+            _Out[0] = (_Msg.*F) >> 8;
+            _Out[1] = (_Msg.*F) & 0xff;
+            return _Out + 2;
+        }
+
+        static bool Read(M &_Msg, const byte *&_In, const byte *_End)
+        {
+            if (_End - _In < 2) { return false; }
+
+            _Msg.*F = ((uint16_t)_In[0] << 8) | _In[1];
+            _In += 2;
+            return true;
+        }
+    };
+
+    // Sent up to its terminating NUL, read from the rest of the frame.
+    template<uint16_t CAP, char (M::*F)[CAP]>
+    struct STR
+    {
+        static const uint16_t MIN = 0;
+        static const uint16_t MAX = CAP;
+
+        static uint16_t Size(const M &_Msg) { return strnlen(_Msg.*F, CAP); }
+
+        static byte *Write(const M &_Msg, byte *_Out)
+        {
+            uint16_t len = Size(_Msg);
+
+            memcpy(_Out, _Msg.*F, len);
+            return _Out + len;
+        }
+
+        static bool Read(M &_Msg, const byte *&_In, const byte *_End)
+        {
+            uint16_t len = _End - _In;
+
+            if (len > CAP) { return false; }
+
+            memcpy(_Msg.*F, _In, len);
+            memset(_Msg.*F + len, 0, CAP - len);
+            _In += len;
+            return true;
+        }
+    };
+
+    // Sent up to the length in LEN, less the HEADER octets before it.
+    template<uint16_t CAP, char (M::*F)[CAP], byte M::*LEN, byte HEADER>
+    struct DATA
+    {
+        static const uint16_t MIN = 0;
+        static const uint16_t MAX = CAP;
+
+        static uint16_t Size(const M &_Msg)
+        {
+            uint16_t len = (uint16_t)(_Msg.*LEN - HEADER);
+
+            return len < CAP ? len : CAP;
+        }
+
+        static byte *Write(const M &_Msg, byte *_Out)
+        {
+            uint16_t len = Size(_Msg);
+
+            memcpy(_Out, _Msg.*F, len);
+            return _Out + len;
+        }
+
+        static bool Read(M &_Msg, const byte *&_In, const byte *_End)
+        {
+            return STR<CAP, F>::Read(_Msg, _In, _End);
+        }
+    };
+
+    // SUBSCRIBE and UNSUBSCRIBE carry a pre-defined topic id, or a
+    // topic name in its place. The flags come earlier in the frame,
+    // so the reader has them by the time it gets here.
+    template<byte M::*FLAGS, uint16_t M::*ID, char (M::*NAME)[TOPIC_NAME_SZ]>
+    struct TOPIC
+    {
+        static const uint16_t MIN = 0;
+        static const uint16_t MAX = TOPIC_NAME_SZ > 2 ? TOPIC_NAME_SZ : 2;
+
+        static bool Predefined(const M &_Msg) { return ((_Msg.*FLAGS) & TOPIC_ID_TYPE) == PD_TOPIC_ID_ON; }
+
+        static uint16_t Size(const M &_Msg)
+        {
+            return Predefined(_Msg) ? U16<ID>::Size(_Msg) : STR<TOPIC_NAME_SZ, NAME>::Size(_Msg);
+        }
+
+        static byte *Write(const M &_Msg, byte *_Out)
+        {
+            return Predefined(_Msg) ? U16<ID>::Write(_Msg, _Out) : STR<TOPIC_NAME_SZ, NAME>::Write(_Msg, _Out);
+        }
+
+        static bool Read(M &_Msg, const byte *&_In, const byte *_End)
+        {
+            return Predefined(_Msg) ? U16<ID>::Read(_Msg, _In, _End) : STR<TOPIC_NAME_SZ, NAME>::Read(_Msg, _In, _End);
+        }
+    };
+};
+
+
+// The fields after the MsgType, in order on air.
+template<class... FIELDS>
+struct MSN_FIELDS;
+
+template<>
+struct MSN_FIELDS<>
+{
+    static const uint16_t MIN = 0;
+    static const uint16_t MAX = 0;
+
+    template<class M> static uint16_t Size(const M &) { return 0; }
+
+    template<class M> static byte *Write(const M &, byte *_Out) { return _Out; }
+
+    template<class M> static bool Read(M &, const byte *&, const byte *) { return true; }
+};
+
+template<class FIELD, class... REST>
+struct MSN_FIELDS<FIELD, REST...>
+{
+    static const uint16_t MIN = FIELD::MIN + MSN_FIELDS<REST...>::MIN;
+    static const uint16_t MAX = FIELD::MAX + MSN_FIELDS<REST...>::MAX;
+
+    template<class M> static uint16_t Size(const M &_Msg)
+    {
+        return FIELD::Size(_Msg) + MSN_FIELDS<REST...>::Size(_Msg);
+    }
+
+    template<class M> static byte *Write(const M &_Msg, byte *_Out)
+    {
+        return MSN_FIELDS<REST...>::Write(_Msg, FIELD::Write(_Msg, _Out));
+    }
+
+    template<class M> static bool Read(M &_Msg, const byte *&_In, const byte *_End)
+    {
+        return FIELD::Read(_Msg, _In, _End) && MSN_FIELDS<REST...>::Read(_Msg, _In, _End);
+    }
+};
+
+
+////// [ MESSAGE SCHEMA ] //////
+
+template<MSN_MsgType M_TYPE>
+struct MSN_SCHEMA;
+
+// Names the message and its descriptors for the lists below.
+template<MSN_MsgType M_TYPE>
+struct MSN_SCHEMA_BASE
+{
+    typedef MSN_MESSAGE<M_TYPE> M;
+    typedef MSN_FIELD<M> F;
+};
+
+template<> struct MSN_SCHEMA<MSN_ADVERTISE> : MSN_SCHEMA_BASE<MSN_ADVERTISE> { typedef MSN_FIELDS<F::U8<&M::gwID>, F::U16<&M::duration> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_SEARCHGW> : MSN_SCHEMA_BASE<MSN_SEARCHGW> { typedef MSN_FIELDS<F::U8<&M::radius> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_GWINFO> : MSN_SCHEMA_BASE<MSN_GWINFO> { typedef MSN_FIELDS<F::U8<&M::gwID>, F::U16<&M::gwAdd> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_CONNECT> : MSN_SCHEMA_BASE<MSN_CONNECT> { typedef MSN_FIELDS<F::U8<&M::flags>, F::U8<&M::protoID>, F::U16<&M::duration>, F::STR<CLIENT_ID_SZ, &M::clientID> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_CONNACK> : MSN_SCHEMA_BASE<MSN_CONNACK> { typedef MSN_FIELDS<F::U8<&M::returnCode> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_WILLTOPICREQ> : MSN_SCHEMA_BASE<MSN_WILLTOPICREQ> { typedef MSN_FIELDS<> FIELDS; };
+template<> struct MSN_SCHEMA<MSN_WILLTOPIC> : MSN_SCHEMA_BASE<MSN_WILLTOPIC> { typedef MSN_FIELDS<F::U8<&M::flags>, F::STR<WILL_TOPIC_SZ, &M::willTopic> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_WILLMSGREQ> : MSN_SCHEMA_BASE<MSN_WILLMSGREQ> { typedef MSN_FIELDS<> FIELDS; };
+template<> struct MSN_SCHEMA<MSN_WILLMSG> : MSN_SCHEMA_BASE<MSN_WILLMSG> { typedef MSN_FIELDS<F::STR<WILL_MSG_SZ, &M::willMsg> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_REGISTER> : MSN_SCHEMA_BASE<MSN_REGISTER> { typedef MSN_FIELDS<F::U16<&M::topicID>, F::U16<&M::msgID>, F::STR<TOPIC_NAME_SZ, &M::topicName> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_REGACK> : MSN_SCHEMA_BASE<MSN_REGACK> { typedef MSN_FIELDS<F::U16<&M::topicID>, F::U16<&M::msgID>, F::U8<&M::returnCode> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_PUBLISH> : MSN_SCHEMA_BASE<MSN_PUBLISH> { typedef MSN_FIELDS<F::U8<&M::flags>, F::U16<&M::topicID>, F::U16<&M::msgID>, F::DATA<PUBLISH_SZ, &M::msgData, &M::msgLength, 7> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_PUBACK> : MSN_SCHEMA_BASE<MSN_PUBACK> { typedef MSN_FIELDS<F::U8<&M::flags>, F::U16<&M::topicID>, F::U16<&M::msgID>, F::U8<&M::returnCode> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_PUBREC> : MSN_SCHEMA_BASE<MSN_PUBREC> { typedef MSN_FIELDS<F::U16<&M::msgID> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_PUBREL> : MSN_SCHEMA_BASE<MSN_PUBREL> { typedef MSN_FIELDS<F::U16<&M::msgID> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_PUBCOMP> : MSN_SCHEMA_BASE<MSN_PUBCOMP> { typedef MSN_FIELDS<F::U16<&M::msgID> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_SUBSCRIBE> : MSN_SCHEMA_BASE<MSN_SUBSCRIBE> { typedef MSN_FIELDS<F::U8<&M::flags>, F::U16<&M::msgID>, F::TOPIC<&M::flags, &M::topicID, &M::topicName> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_UNSUBSCRIBE> : MSN_SCHEMA_BASE<MSN_UNSUBSCRIBE> { typedef MSN_FIELDS<F::U8<&M::flags>, F::U16<&M::msgID>, F::TOPIC<&M::flags, &M::topicID, &M::topicName> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_SUBACK> : MSN_SCHEMA_BASE<MSN_SUBACK> { typedef MSN_FIELDS<F::U8<&M::flags>, F::U16<&M::topicID>, F::U16<&M::msgID>, F::U8<&M::returnCode> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_UNSUBACK> : MSN_SCHEMA_BASE<MSN_UNSUBACK> { typedef MSN_FIELDS<F::U16<&M::msgID> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_PINGREQ> : MSN_SCHEMA_BASE<MSN_PINGREQ> { typedef MSN_FIELDS<F::STR<CLIENT_ID_SZ, &M::clientID> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_PINGRESP> : MSN_SCHEMA_BASE<MSN_PINGRESP> { typedef MSN_FIELDS<> FIELDS; };
+template<> struct MSN_SCHEMA<MSN_DISCONNECT> : MSN_SCHEMA_BASE<MSN_DISCONNECT> { typedef MSN_FIELDS<F::U16<&M::duration> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_WILLTOPICUPD> : MSN_SCHEMA_BASE<MSN_WILLTOPICUPD> { typedef MSN_FIELDS<F::U8<&M::flags>, F::STR<WILL_TOPIC_SZ, &M::willTopic> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_WILLMSGUPD> : MSN_SCHEMA_BASE<MSN_WILLMSGUPD> { typedef MSN_FIELDS<F::STR<WILL_MSG_SZ, &M::willMsg> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_WILLTOPICRESP> : MSN_SCHEMA_BASE<MSN_WILLTOPICRESP> { typedef MSN_FIELDS<F::U8<&M::returnCode> > FIELDS; };
+template<> struct MSN_SCHEMA<MSN_WILLMSGRESP> : MSN_SCHEMA_BASE<MSN_WILLMSGRESP> { typedef MSN_FIELDS<F::U8<&M::returnCode> > FIELDS; };
+
+
+// Longest frame of a message type, Length field included.
+template<MSN_MsgType M_TYPE>
+struct MSN_FRAME_MAX
+{
+    static const uint16_t VALUE = 2 + MSN_SCHEMA<M_TYPE>::FIELDS::MAX > 255
+        ? 4 + MSN_SCHEMA<M_TYPE>::FIELDS::MAX
+        : 2 + MSN_SCHEMA<M_TYPE>::FIELDS::MAX;
+};
+
+// Every message at its longest must fit one payload.
+template<MSN_MsgType... M_TYPES>
+struct MSN_SCHEMA_FITS
+{
+    static const bool VALUE = true;
+};
+
+template<MSN_MsgType M_TYPE, MSN_MsgType... REST>
+struct MSN_SCHEMA_FITS<M_TYPE, REST...>
+{
+    static_assert(MSN_FRAME_MAX<M_TYPE>::VALUE <= MAX_PAYLOAD_SIZE, "a message at its longest does not fit MAX_PAYLOAD_SIZE, lower its _SZ");
+
+    static const bool VALUE = MSN_SCHEMA_FITS<REST...>::VALUE;
+};
+
+static_assert(MSN_SCHEMA_FITS<MSN_ADVERTISE, MSN_SEARCHGW, MSN_GWINFO, MSN_CONNECT, MSN_CONNACK,
+    MSN_WILLTOPICREQ, MSN_WILLTOPIC, MSN_WILLMSGREQ, MSN_WILLMSG, MSN_REGISTER, MSN_REGACK,
+    MSN_PUBLISH, MSN_PUBACK, MSN_PUBREC, MSN_PUBREL, MSN_PUBCOMP, MSN_SUBSCRIBE, MSN_UNSUBSCRIBE,
+    MSN_SUBACK, MSN_UNSUBACK, MSN_PINGREQ, MSN_PINGRESP, MSN_DISCONNECT, MSN_WILLTOPICUPD,
+    MSN_WILLMSGUPD, MSN_WILLTOPICRESP, MSN_WILLMSGRESP>::VALUE, "message schema");
+
+
+////// [ ENCODE / DECODE ] //////
+
+// Octets the message takes on air, Length field included.
+template<MSN_MsgType M_TYPE>
+uint16_t MSN_EncodedLength(const MSN_MESSAGE<M_TYPE> &_Msg)
+{
+    uint16_t total = 2 + MSN_SCHEMA<M_TYPE>::FIELDS::Size(_Msg);
+
+    return total > 255 ? total + 2 : total;
+}
+
+// Writes the message into _Out and returns the frame length,
+// or 0 when it does not fit in _Size octets.
+template<MSN_MsgType M_TYPE>
+uint16_t MSN_Encode(const MSN_MESSAGE<M_TYPE> &_Msg, byte *_Out, uint16_t _Size)
+{
+    uint16_t total = MSN_EncodedLength(_Msg);
+
+    if (total > _Size)
+    {
+        return 0;
+    }
+
+    if (total > 255)
+    {
+        *_Out++ = 0x01;
+        *_Out++ = total >> 8;
+        *_Out++ = total & 0xff;
+    }
+    else
+    {
+        *_Out++ = total;
+    }
+
+    *_Out++ = M_TYPE;
+
+    MSN_SCHEMA<M_TYPE>::FIELDS::Write(_Msg, _Out);
+
+    return total;
+}
+
+// Parses a frame of _Len octets into _Msg. Fails on a short frame,
+// a frame of another type or a variable field too long for _Msg.
+template<MSN_MsgType M_TYPE>
+bool MSN_Decode(const byte *_In, uint16_t _Len, MSN_MESSAGE<M_TYPE> &_Msg)
+{
+    if (_Len < 2)
+    {
+        return false;
+    }
+
+    uint16_t header = MSN_HeaderLength(_In);
+    uint16_t total = MSN_FrameLength(_In);
+
+    if (header + 1 > _Len || total < header + 1 || total > _Len || _In[header] != M_TYPE)
+    {
+        return false;
+    }
+
+    const byte *in = _In + header + 1;
+    const byte *end = _In + total;
+
+    if (!MSN_SCHEMA<M_TYPE>::FIELDS::Read(_Msg, in, end) || in != end)
+    {
+        return false;
+    }
+
+    _Msg.msgLength = total > 255 ? 0 : total;
+
+    return true;
+}
+
+// Copies _Len octets of application data into a PUBLISH and
+// sizes it so only those octets go on air.
+inline bool MSN_SetPublishData(MSN_MESSAGE<MSN_PUBLISH> &_Msg, const void *_Data, byte _Len)
+{
+    if (_Len > PUBLISH_SZ)
+    {
+        return false;
+    }
+
+    memcpy(_Msg.msgData, _Data, _Len);
+    _Msg.msgLength = 7 + _Len;
+
+    return true;
+}
@@ -1,13 +1,339 @@
-
-
 #define MAX_RETRY_COUNT 10
 
 #define CLIENT_ID_SZ 23
 #define WILL_TOPIC_SZ 32
 #define WILL_MSG_SZ 32
 #define PUBLISH_SZ 32
+#define TOPIC_NAME_SZ 32
 
 // Max payload in bytes. 
 // Defined in RF24Network_config.h as 144 can
 // be over wrtten here.
 #define MAX_PAYLOAD_SIZE 144
+
+// Host (Linux) transport settings. A device binds
+// MSN_UDP_BASE_PORT + its node id, the gateway is node 0.
+#ifndef MSN_UDP_BASE_PORT
+#define MSN_UDP_BASE_PORT 47000
+#endif
+
+// Max number of nodes the UDP gateway remembers for SendToAll.
+#ifndef MSN_UDP_MAX_PEERS
+#define MSN_UDP_MAX_PEERS 255
+#endif
+
+// Frames the gateway and a node keep for retransmission
+// while they go on with their Loop, see mqttSN_outbox.h. With
+// 0 a frame the transport does not take is dropped.
+#ifndef MSN_GATEWAY_OUTBOX
+#define MSN_GATEWAY_OUTBOX 16
+#endif
+
+#ifndef MSN_NODE_OUTBOX
+#define MSN_NODE_OUTBOX 2
+#endif
+
+// Largest frame an outbox slot holds, lower it on small
+// boards when the messages sent are short.
+#ifndef MSN_OUTBOX_FRAME_SZ
+#define MSN_OUTBOX_FRAME_SZ MAX_PAYLOAD_SIZE
+#endif
+
+// Time between two attempts at a frame, in ms.
+#ifndef MSN_RETRY_INTERVAL
+#define MSN_RETRY_INTERVAL 1000
+#endif
+
+// SendToAll fan-out, see mqttSN_fanout.h. Destinations one
+// fan-out covers and dead addresses the gateway remembers.
+#ifndef MSN_FANOUT_DESTS
+#define MSN_FANOUT_DESTS 255
+#endif
+
+#ifndef MSN_FANOUT_DEAD
+#define MSN_FANOUT_DEAD 32
+#endif
+
+// Time between two passes over the pending destinations, the
+// time a fan-out may take and how long a dead node is skipped,
+// all in ms.
+#ifndef MSN_FANOUT_RETRY_MS
+#define MSN_FANOUT_RETRY_MS 100
+#endif
+
+#ifndef MSN_FANOUT_DEADLINE
+#define MSN_FANOUT_DEADLINE 3000
+#endif
+
+#ifndef MSN_FANOUT_DEAD_MS
+#define MSN_FANOUT_DEAD_MS 60000
+#endif
+
+// Clients the gateway keeps a session for, a power of two.
+#ifndef MSN_MAX_SESSIONS
+#define MSN_MAX_SESSIONS 256
+#endif
+
+// Topic names the gateway registers, a power of two, and the
+// octets of name storage they share.
+#ifndef MSN_MAX_TOPICS
+#define MSN_MAX_TOPICS 256
+#endif
+
+#ifndef MSN_TOPIC_ARENA
+#define MSN_TOPIC_ARENA 4096
+#endif
+
+// Gateway subscription index, see mqttSN_subscription.h: trie
+// levels (a power of two), subscriptions, pre-defined topic ids
+// subscribed to (a power of two), octets of level names and the
+// deepest topic name matched.
+#ifndef MSN_SUB_NODES
+#define MSN_SUB_NODES 256
+#endif
+
+#ifndef MSN_SUB_ENTRIES
+#define MSN_SUB_ENTRIES 512
+#endif
+
+#ifndef MSN_SUB_IDS
+#define MSN_SUB_IDS 64
+#endif
+
+#ifndef MSN_SUB_ARENA
+#define MSN_SUB_ARENA 2048
+#endif
+
+#ifndef MSN_SUB_MAX_LEVELS
+#define MSN_SUB_MAX_LEVELS 8
+#endif
+
+// QoS 1 and 2 in-flight windows, see mqttSN_qos.h. Slots on a node
+// and on the gateway (powers of two, 0 turns QoS 1 and 2 publishes
+// down), publishes outstanding toward one destination and the time
+// to wait for an ack, in ms.
+#ifndef MSN_NODE_QOS_SLOTS
+#define MSN_NODE_QOS_SLOTS 4
+#endif
+
+#ifndef MSN_GATEWAY_QOS_SLOTS
+#define MSN_GATEWAY_QOS_SLOTS 64
+#endif
+
+// Largest PUBLISH frame an in-flight slot holds. The gateway's take
+// any frame SendToSubscribers passes on, a node only sends what
+// MSN_MESSAGE<MSN_PUBLISH> encodes to.
+#ifndef MSN_NODE_QOS_FRAME_SZ
+#define MSN_NODE_QOS_FRAME_SZ (7 + PUBLISH_SZ)
+#endif
+
+#ifndef MSN_GATEWAY_QOS_FRAME_SZ
+#define MSN_GATEWAY_QOS_FRAME_SZ MAX_PAYLOAD_SIZE
+#endif
+
+#ifndef MSN_QOS_INFLIGHT
+#define MSN_QOS_INFLIGHT 4
+#endif
+
+#ifndef MSN_QOS_RETRY_MS
+#define MSN_QOS_RETRY_MS 3000
+#endif
+
+// Buckets of a QoS window's retry wheel, a window of fewer slots
+// has as many buckets as slots.
+#ifndef MSN_QOS_BUCKETS
+#define MSN_QOS_BUCKETS 64
+#endif
+
+// QoS 2 publishes a node and the gateway can be receiving at
+// once, between PUBLISH and PUBREL, powers of two. With 0 every
+// QoS 2 PUBLISH is turned down.
+#ifndef MSN_NODE_QOS_RECEIVED
+#define MSN_NODE_QOS_RECEIVED 4
+#endif
+
+#ifndef MSN_GATEWAY_QOS_RECEIVED
+#define MSN_GATEWAY_QOS_RECEIVED 64
+#endif
+
+// A client is lost once it has been silent for this percentage
+// of its keep alive Duration, see mqttSN_keepalive.h.
+#ifndef MSN_KEEPALIVE_GRACE
+#define MSN_KEEPALIVE_GRACE 150
+#endif
+
+// Downlink buffering for sleeping clients, see mqttSN_sleep.h:
+// frames held per client, frames held in all and the largest
+// frame held.
+#ifndef MSN_SLEEP_DEPTH
+#define MSN_SLEEP_DEPTH 4
+#endif
+
+#ifndef MSN_SLEEP_FRAMES
+#define MSN_SLEEP_FRAMES 32
+#endif
+
+#ifndef MSN_SLEEP_FRAME_SZ
+#define MSN_SLEEP_FRAME_SZ (7 + PUBLISH_SZ)
+#endif
+
+// MQTT broker bridge on Linux, see mqttSN_bridge.h: octets queued
+// toward the broker and read from it, broker keep alive in s, time
+// between reconnects in ms, topic filters the bridge subscribes
+// to and the octets of filter names they share.
+#ifndef MSN_BRIDGE_TX_SZ
+#define MSN_BRIDGE_TX_SZ 65536
+#endif
+
+#ifndef MSN_BRIDGE_RX_SZ
+#define MSN_BRIDGE_RX_SZ 8192
+#endif
+
+#ifndef MSN_BRIDGE_KEEPALIVE
+#define MSN_BRIDGE_KEEPALIVE 30
+#endif
+
+#ifndef MSN_BRIDGE_RETRY_MS
+#define MSN_BRIDGE_RETRY_MS 2000
+#endif
+
+#ifndef MSN_BRIDGE_FILTERS
+#define MSN_BRIDGE_FILTERS 64
+#endif
+
+#ifndef MSN_BRIDGE_FILTER_ARENA
+#define MSN_BRIDGE_FILTER_ARENA 2048
+#endif
+
+// Broker topic a pre-defined topic id n is bridged to, the
+// prefix followed by n in decimal.
+#ifndef MSN_BRIDGE_PD_PREFIX
+#define MSN_BRIDGE_PD_PREFIX "mqttsn/pd/"
+#endif
+
+// Threaded transport, frames queued between the radio thread and the
+// gateway in each direction (powers of two), how long the radio thread
+// sleeps on a pass with nothing to do, how long Available waits for a
+// frame, how many passes a failed write is tried on before it is
+// dropped and how often the peer list is copied for SendToAll.
+#ifndef MSN_RADIO_RX_SLOTS
+#define MSN_RADIO_RX_SLOTS 256
+#endif
+
+#ifndef MSN_RADIO_TX_SLOTS
+#define MSN_RADIO_TX_SLOTS 256
+#endif
+
+#ifndef MSN_RADIO_IDLE_US
+#define MSN_RADIO_IDLE_US 100
+#endif
+
+#ifndef MSN_RADIO_WAIT_MS
+#define MSN_RADIO_WAIT_MS 1
+#endif
+
+#ifndef MSN_RADIO_WRITE_TRIES
+#define MSN_RADIO_WRITE_TRIES 3
+#endif
+
+#ifndef MSN_RADIO_PEERS
+#define MSN_RADIO_PEERS 255
+#endif
+
+#ifndef MSN_RADIO_PEER_MS
+#define MSN_RADIO_PEER_MS 100
+#endif
+
+// Batching transport, destinations with a batch open at once, how long
+// the first frame of a batch may wait for more and the octets a batch
+// holds, at most what the receiver reads in one go.
+#ifndef MSN_BATCH_DESTINATIONS
+#define MSN_BATCH_DESTINATIONS 8
+#endif
+
+#ifndef MSN_BATCH_DELAY_MS
+#define MSN_BATCH_DELAY_MS 5
+#endif
+
+#ifndef MSN_BATCH_SZ
+#define MSN_BATCH_SZ MAX_PAYLOAD_SIZE
+#endif
+
+// Streamed publishes, whether a node can send them (0 leaves the
+// sender out), the octets of one CHUNK frame, how many chunks
+// may be unacked at once, how long before unacked chunks are sent
+// again and how long the gateway keeps a stream that went quiet.
+#ifndef MSN_NODE_STREAM
+#define MSN_NODE_STREAM 1
+#endif
+
+#ifndef MSN_STREAM_CHUNK_SZ
+#define MSN_STREAM_CHUNK_SZ MAX_PAYLOAD_SIZE
+#endif
+
+#ifndef MSN_STREAM_WINDOW
+#define MSN_STREAM_WINDOW 4
+#endif
+
+#ifndef MSN_STREAM_RETRY_MS
+#define MSN_STREAM_RETRY_MS 1000
+#endif
+
+#ifndef MSN_STREAM_IDLE_MS
+#define MSN_STREAM_IDLE_MS 60000
+#endif
+
+// Octets a device keeps for the frame it is handling. Each device
+// has its own, frames longer than this are cut short and fail to
+// parse, so a node that only ever gets short frames can go lower.
+#ifndef MSN_RX_BUFFER_SZ
+#define MSN_RX_BUFFER_SZ MAX_PAYLOAD_SIZE
+#endif
+
+// nRF24 channel a transport starts on, RF24Mesh's default, and the
+// spacing between the channels of a multi-radio gateway. At 1Mbps a
+// channel is 1MHz wide, 5 keeps neighbouring segments apart.
+#ifndef MSN_RF24_CHANNEL
+#define MSN_RF24_CHANNEL 97
+#endif
+
+#ifndef MSN_RF24_CHANNEL_STEP
+#define MSN_RF24_CHANNEL_STEP 5
+#endif
+
+// Multi-radio gateway, the low address bits that are a radio's own
+// address, the rest number the radio. A radio only takes joining
+// nodes while it has at most MSN_MULTI_JOIN_SLACK more than the
+// least loaded one.
+#ifndef MSN_MULTI_ADDRESS_BITS
+#define MSN_MULTI_ADDRESS_BITS 12
+#endif
+
+#ifndef MSN_MULTI_JOIN_SLACK
+#define MSN_MULTI_JOIN_SLACK 2
+#endif
+
+// Device counters and ack round trip histograms, see mqttSN_stats.h,
+// off unless set to 1, and how many destinations retries are kept for.
+#ifndef MSN_STATS_ENABLED
+#define MSN_STATS_ENABLED 0
+#endif
+
+#ifndef MSN_STATS_DESTS
+#define MSN_STATS_DESTS 8
+#endif
+
+// Frame trace, see mqttSN_trace.h, off unless set to 1. Records in
+// the ring, a power of two, and the octets kept of each frame. A
+// record takes about a dozen octets more than MSN_TRACE_SNAP.
+#ifndef MSN_TRACE_ENABLED
+#define MSN_TRACE_ENABLED 0
+#endif
+
+#ifndef MSN_TRACE_RECORDS
+#define MSN_TRACE_RECORDS 128
+#endif
+
+#ifndef MSN_TRACE_SNAP
+#define MSN_TRACE_SNAP 32
+#endif
@@ -0,0 +1,115 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Compile-time handler dispatch. Handlers are registered per
+// MSN_MsgType in a template list and the library builds a dense table,
+// indexed by MsgType, with one entry per type. Registered types point
+// at a thunk that validates an MSN_VIEW and calls the handler directly,
+// every other entry is empty, so a type the application does not
+// handle costs one table load and no call.
+//
+//      void OnConnect(const MSN_VIEW<MSN_CONNECT> &_Msg, uint16_t _From, void *_Context);
+//      void OnPublish(const MSN_VIEW<MSN_PUBLISH> &_Msg, uint16_t _From, void *_Context);
+//
+//      typedef MSN_HANDLERS<
+//          MSN_ON<MSN_CONNECT, &OnConnect>,
+//          MSN_ON<MSN_PUBLISH, &OnPublish>
+//      > APP_HANDLERS;
+//
+//      gate.Loop<APP_HANDLERS>(&app, 5 * 1000);
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSNmsg.h>
+
+
+typedef void (*MSN_THUNK)(const byte*, uint16_t, uint16_t, void*);
+
+
+// Registers HANDLER for frames of type M_TYPE.
+template<MSN_MsgType M_TYPE, void (*HANDLER)(const MSN_VIEW<M_TYPE>&, uint16_t, void*)>
+struct MSN_ON
+{
+    static const unsigned TYPE = M_TYPE;
+
+    static void Call(const byte *_Frame, uint16_t _Len, uint16_t _From, void *_Context)
+    {
+        MSN_VIEW<M_TYPE> view(_Frame, _Len);
+
+        if (view.Valid())
+        {
+            HANDLER(view, _From, _Context);
+        }
+    }
+};
+
+
+////// [ TABLE GENERATION ] //////
+
+template<unsigned... I>
+struct MSN_INDEXES {};
+
+template<unsigned N, unsigned... I>
+struct MSN_MAKE_INDEXES : MSN_MAKE_INDEXES<N - 1, N - 1, I...> {};
+
+template<unsigned... I>
+struct MSN_MAKE_INDEXES<0, I...>
+{
+    typedef MSN_INDEXES<I...> type;
+};
+
+// Thunk of the first handler registered for TYPE, or none.
+template<unsigned TYPE, class... HANDLERS>
+struct MSN_FIND
+{
+    static constexpr MSN_THUNK Get() { return 0; }
+};
+
+template<unsigned TYPE, class HANDLER, class... REST>
+struct MSN_FIND<TYPE, HANDLER, REST...>
+{
+    static constexpr MSN_THUNK Get()
+    {
+        return HANDLER::TYPE == TYPE ? &HANDLER::Call : MSN_FIND<TYPE, REST...>::Get();
+    }
+};
+
+template<class INDEXES, class... HANDLERS>
+struct MSN_JUMP_TABLE;
+
+template<unsigned... I, class... HANDLERS>
+struct MSN_JUMP_TABLE<MSN_INDEXES<I...>, HANDLERS...>
+{
+    static const MSN_THUNK table[sizeof...(I)];
+};
+
+template<unsigned... I, class... HANDLERS>
+const MSN_THUNK MSN_JUMP_TABLE<MSN_INDEXES<I...>, HANDLERS...>::table[sizeof...(I)] =
+{
+    MSN_FIND<I, HANDLERS...>::Get()...
+};
+
+
+// A list of MSN_ON<...> registrations, passed to Loop<HANDLERS>.
+template<class... HANDLERS>
+struct MSN_HANDLERS
+{
+    typedef MSN_JUMP_TABLE<typename MSN_MAKE_INDEXES<MSN_TYPE_COUNT>::type, HANDLERS...> TABLE;
+
+    static void Dispatch(const byte *_Frame, uint16_t _Len, uint16_t _From, void *_Context)
+    {
+        byte type = MSN_FrameType(_Frame);
+
+        if (type >= MSN_TYPE_COUNT)
+        {
+            return;
+        }
+
+        MSN_THUNK thunk = TABLE::table[type];
+
+        if (thunk)
+        {
+            thunk(_Frame, _Len, _From, _Context);
+        }
+    }
+};
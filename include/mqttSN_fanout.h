@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: SendToAll fan-out. The gateway keeps one copy of the frame and
+// one entry per destination, then writes in passes: every pass tries each
+// destination still pending once, so a node that does not answer costs
+// one write per pass instead of holding up the ones after it. Passes run
+// from Loop/Update every MSN_FANOUT_RETRY_MS until every destination has
+// an outcome or MSN_FANOUT_DEADLINE ms have gone by.
+//
+// A destination that never took the frame is remembered as dead for
+// MSN_FANOUT_DEAD_MS, later fan-outs skip it until it is heard from again.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+#include <mqttSN_transport.h>
+
+
+enum MSN_FanoutResult
+{
+    FO_PENDING = 0,     // still being tried
+    FO_DELIVERED,       // the transport took the frame
+    FO_TIMED_OUT,       // out of attempts or past the deadline
+    FO_SKIPPED          // known dead, or no room in the fan-out
+};
+
+// Called once per destination when its outcome is known.
+typedef void (*MSN_FANOUT_HANDLER)(uint16_t _ToAddress, MSN_FanoutResult _Result, void *_Context);
+
+
+template<uint16_t DESTS, uint16_t DEAD>
+class MSN_FANOUT
+{
+
+protected:
+    byte frame[MSN_OUTBOX_FRAME_SZ];
+    uint16_t length;
+
+    uint16_t to[DESTS];
+    byte attempts[DESTS];
+    byte result[DESTS];
+    uint16_t count;
+    uint16_t open;
+
+    unsigned long deadline;
+    unsigned long nextPass;
+
+    uint16_t dead[DEAD];
+    unsigned long deadUntil[DEAD];
+    uint16_t deadCount;
+
+    int16_t FindDead(uint16_t _Address) const
+    {
+        for (uint16_t i = 0; i < deadCount; i++)
+        {
+            if (dead[i] == _Address)
+            {
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    void MarkDead(uint16_t _Address, unsigned long _Until)
+    {
+        int16_t i = FindDead(_Address);
+
+        if (i < 0)
+        {
+            if (deadCount < DEAD)
+            {
+                i = deadCount++;
+            }
+            else
+            {
+                // full, replace the one that comes back soonest
+                i = 0;
+
+                for (uint16_t j = 1; j < DEAD; j++)
+                {
+                    if ((long)(deadUntil[j] - deadUntil[i]) < 0)
+                    {
+                        i = j;
+                    }
+                }
+            }
+        }
+
+        dead[i] = _Address;
+        deadUntil[i] = _Until;
+    }
+
+public:
+    MSN_FANOUT() : length(0), count(0), open(0), deadline(0), nextPass(0), deadCount(0) {};
+
+    bool Active() const { return open > 0; }
+
+    // Takes a copy of the frame for a new fan-out, false while
+    // the last one is still running or the frame is too long.
+    bool Start(const void *_Frame, uint16_t _Len, unsigned long _Now)
+    {
+        if (open || _Len > MSN_OUTBOX_FRAME_SZ)
+        {
+            return false;
+        }
+
+        memcpy(frame, _Frame, _Len);
+        length = _Len;
+        count = 0;
+        deadline = _Now + MSN_FANOUT_DEADLINE;
+        nextPass = _Now;
+
+        return true;
+    }
+
+    // Adds a destination, returns FO_PENDING or, when it will
+    // not be tried, the outcome to report for it right away.
+    MSN_FanoutResult Add(uint16_t _Address, unsigned long _Now)
+    {
+        int16_t d = FindDead(_Address);
+
+        if (d >= 0)
+        {
+            if ((long)(_Now - deadUntil[d]) < 0)
+            {
+                return FO_SKIPPED;
+            }
+
+            dead[d] = dead[--deadCount];
+            deadUntil[d] = deadUntil[deadCount];
+        }
+
+        if (count == DESTS)
+        {
+            return FO_SKIPPED;
+        }
+
+        to[count] = _Address;
+        attempts[count] = 0;
+        result[count] = FO_PENDING;
+        count++;
+        open++;
+
+        return FO_PENDING;
+    }
+
+    // A frame came in from _Address, it is no longer dead.
+    void Alive(uint16_t _Address)
+    {
+        if (!deadCount)
+        {
+            return;
+        }
+
+        int16_t d = FindDead(_Address);
+
+        if (d >= 0)
+        {
+            dead[d] = dead[--deadCount];
+            deadUntil[d] = deadUntil[deadCount];
+        }
+    }
+
+    // True when a pass is due at _Now, and schedules the next one.
+    bool PassDue(unsigned long _Now)
+    {
+        if (!open || (long)(_Now - nextPass) < 0)
+        {
+            return false;
+        }
+
+        nextPass = _Now + MSN_FANOUT_RETRY_MS;
+
+        return true;
+    }
+
+    bool Expired(unsigned long _Now) const { return (long)(_Now - deadline) >= 0; }
+
+    // Counts an attempt at destination _Index, false once it
+    // has had MAX_RETRY_COUNT.
+    bool Attempt(uint16_t _Index) { return ++attempts[_Index] <= MAX_RETRY_COUNT; }
+
+    void Finish(uint16_t _Index, MSN_FanoutResult _Result, unsigned long _Now)
+    {
+        result[_Index] = _Result;
+        open--;
+
+        if (_Result == FO_TIMED_OUT)
+        {
+            MarkDead(to[_Index], _Now + MSN_FANOUT_DEAD_MS);
+        }
+    }
+
+    const byte *Frame() const { return frame; }
+    uint16_t Length() const { return length; }
+
+    // Destinations of the current, or last, fan-out.
+    uint16_t Count() const { return count; }
+    uint16_t Address(uint16_t _Index) const { return to[_Index]; }
+    MSN_FanoutResult Result(uint16_t _Index) const { return (MSN_FanoutResult)result[_Index]; }
+};
@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Gateway side keep alive supervision. Every session with a
+// Duration has a timer in a hierarchical wheel, indexed by its session
+// record, set to when the client is overdue: MSN_KEEPALIVE_GRACE percent
+// of its Duration after it was last heard from. Frames from the client
+// only move lastSeen, the timer is checked against it when it fires and
+// set again if the client spoke in the meantime, so a busy client costs
+// one timer per Duration and Loop only touches clients that are overdue.
+//
+// The will a client left with WILLTOPIC / WILLMSG is kept next to its
+// timer and published for it when it is lost. No heap is used.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+#include <mqttSN_timer.h>
+
+
+#define MSN_KEEPALIVE_TICK_MS 1000
+
+// 64^3 ticks of a second, past the longest Duration with its grace.
+#define MSN_KEEPALIVE_LEVELS 3
+
+
+struct MSN_WILL
+{
+    byte flags;                     // QoS and retain of the will
+    byte topicLength;               // 0 when there is no will
+    byte msgLength;
+    char topic[WILL_TOPIC_SZ];
+    char msg[WILL_MSG_SZ];
+};
+
+
+template<uint16_t CAPACITY>
+class MSN_KEEPALIVE
+{
+
+protected:
+    MSN_TIMER_HIERARCHY<CAPACITY, MSN_KEEPALIVE_LEVELS, MSN_KEEPALIVE_TICK_MS> timers;
+    MSN_WILL wills[CAPACITY];
+
+public:
+    MSN_KEEPALIVE()
+    {
+        for (uint16_t i = 0; i < CAPACITY; i++)
+        {
+            wills[i].topicLength = 0;
+            wills[i].msgLength = 0;
+        }
+    };
+
+    // Time a client with a Duration of _Duration s may stay silent, in ms.
+    static unsigned long Grace(uint16_t _Duration)
+    {
+        return (unsigned long)_Duration * MSN_KEEPALIVE_GRACE * 10;
+    }
+
+    // Watches session _Record, last heard from at _LastSeen, or stops
+    // watching it when _Duration is 0.
+    void Watch(uint16_t _Record, unsigned long _LastSeen, uint16_t _Duration, unsigned long _Now)
+    {
+        if (!_Duration)
+        {
+            timers.Cancel(_Record);
+            return;
+        }
+
+        timers.Schedule(_Record, _LastSeen + Grace(_Duration), _Now);
+    }
+
+    void Stop(uint16_t _Record) { timers.Cancel(_Record); }
+
+    // Clients being watched.
+    uint16_t Count() const { return timers.Count(); }
+
+    // Next session record whose timer ran out at _Now, MSN_NO_TIMER
+    // when none did. Its client may have been heard from since.
+    uint16_t Due(unsigned long _Now) { return timers.Pop(_Now); }
+
+    MSN_WILL &Will(uint16_t _Record) { return wills[_Record]; }
+
+    // Will topic and flags, from WILLTOPIC or WILLTOPICUPD. The will
+    // message is kept.
+    void SetWillTopic(uint16_t _Record, byte _Flags, const char *_Topic, uint16_t _Len)
+    {
+        MSN_WILL &will = wills[_Record];
+
+        if (_Len > WILL_TOPIC_SZ)
+        {
+            _Len = WILL_TOPIC_SZ;
+        }
+
+        will.flags = _Flags;
+        will.topicLength = _Len;
+
+        memcpy(will.topic, _Topic, _Len);
+    }
+
+    void SetWillMsg(uint16_t _Record, const char *_Msg, uint16_t _Len)
+    {
+        MSN_WILL &will = wills[_Record];
+
+        if (_Len > WILL_MSG_SZ)
+        {
+            _Len = WILL_MSG_SZ;
+        }
+
+        will.msgLength = _Len;
+
+        memcpy(will.msg, _Msg, _Len);
+    }
+
+    void ClearWill(uint16_t _Record)
+    {
+        wills[_Record].topicLength = 0;
+        wills[_Record].msgLength = 0;
+    }
+};
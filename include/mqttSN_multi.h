@@ -0,0 +1,225 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Multi-radio gateway. MSN_MULTI_TRANSPORT drives several radios
+// of one transport type, each on its own channel and each running its
+// own mesh segment, as one link. The gateway built on it is still one
+// DEVICE_TYPE, so its sessions, topic registry and subscriptions are
+// shared by every segment and a PUBLISH from one reaches subscribers
+// on all of them. Each segment has the airtime of its own channel, so
+// with nodes spread evenly throughput grows with the number of radios.
+//
+//      MSN_RF24_TRANSPORT radio0(22, 21, 90), radio1(4, 5, 95);
+//
+//      DEVICE_TYPE<DT_GATEWAY, MSN_MULTI_TRANSPORT<MSN_RF24_TRANSPORT, 2> > gate(&radio0, &radio1);
+//
+// Addresses of nodes behind radio r have r in the bits above
+// MSN_MULTI_ADDRESS_BITS, radio 0's are the same as without this
+// transport. Nodes are given the gateway's channels, e.g.
+// MSN_RF24_TRANSPORT(9, 10, 90, 2), and join whichever answers. A
+// radio only answers joins while it has at most MSN_MULTI_JOIN_SLACK
+// more nodes than the least loaded one, so new nodes go to the emptier
+// segments. A node that loses its segment joins again the same way.
+// Read takes turns over the radios, so a busy segment cannot starve
+// the others.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_transport.h>
+
+
+#define MSN_MULTI_ADDRESS_MASK ((1 << MSN_MULTI_ADDRESS_BITS) - 1)
+
+
+template<class INNER, byte RADIOS>
+class MSN_MULTI_TRANSPORT
+{
+
+    static_assert(RADIOS > 0 && RADIOS <= (1 << (16 - MSN_MULTI_ADDRESS_BITS)), "too many radios for MSN_MULTI_ADDRESS_BITS");
+
+protected:
+    INNER *radios[RADIOS];
+
+    // Radio Read looks at first.
+    byte next;
+
+    // Radios over their share skip DHCP, so joins go elsewhere.
+    bool Joinable(byte _Radio)
+    {
+        uint16_t least = 0xffff;
+
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            uint16_t peers = radios[i]->PeerCount();
+
+            if (peers < least)
+            {
+                least = peers;
+            }
+        }
+
+        return radios[_Radio]->PeerCount() <= least + MSN_MULTI_JOIN_SLACK;
+    }
+
+public:
+    // The radios, one for each of RADIOS, owned by the caller.
+    template<class... RADIO>
+    MSN_MULTI_TRANSPORT(RADIO*... _Radios) : radios{ _Radios... }, next(0)
+    {
+        static_assert(sizeof...(RADIO) == RADIOS, "give MSN_MULTI_TRANSPORT one transport per radio");
+    };
+
+    // A node's address on one radio as the gateway sees it, and the
+    // radio such an address is behind.
+    static uint16_t Address(byte _Radio, uint16_t _Address) { return ((uint16_t)_Radio << MSN_MULTI_ADDRESS_BITS) | _Address; }
+    static byte RadioOf(uint16_t _Address) { return _Address >> MSN_MULTI_ADDRESS_BITS; }
+
+    bool Begin(uint16_t _NodeID)
+    {
+        bool ok = true;
+
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            ok = radios[i]->Begin(_NodeID) && ok;
+        }
+
+        return ok;
+    }
+
+    bool Restart()
+    {
+        bool ok = true;
+
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            ok = radios[i]->Restart() && ok;
+        }
+
+        return ok;
+    }
+
+    void Update()
+    {
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            radios[i]->Update();
+        }
+    }
+
+    void DHCP()
+    {
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            if (Joinable(i))
+            {
+                radios[i]->DHCP();
+            }
+        }
+    }
+
+    bool Available()
+    {
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            if (radios[i]->Available())
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    uint16_t Read(byte *_Buffer, uint16_t _Size, uint16_t *_From)
+    {
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            byte r = (next + i) % RADIOS;
+
+            if (!radios[r]->Available())
+            {
+                continue;
+            }
+
+            next = (r + 1) % RADIOS;
+
+            uint16_t len = radios[r]->Read(_Buffer, _Size, _From);
+
+            *_From = Address(r, *_From);
+
+            return len;
+        }
+
+        return 0;
+    }
+
+    bool Write(uint16_t _To, const void *_Payload, uint16_t _Len)
+    {
+        byte r = RadioOf(_To);
+
+        return r < RADIOS && radios[r]->Write(_To & MSN_MULTI_ADDRESS_MASK, _Payload, _Len);
+    }
+
+    bool CheckConnection()
+    {
+        bool ok = true;
+
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            ok = radios[i]->CheckConnection() && ok;
+        }
+
+        return ok;
+    }
+
+    bool RenewAddress()
+    {
+        bool ok = true;
+
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            ok = radios[i]->RenewAddress() && ok;
+        }
+
+        return ok;
+    }
+
+    // The nodes of every segment, radio by radio.
+    uint16_t PeerCount()
+    {
+        uint16_t count = 0;
+
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            count += radios[i]->PeerCount();
+        }
+
+        return count;
+    }
+
+    uint16_t PeerAddress(uint16_t _Index)
+    {
+        for (byte i = 0; i < RADIOS; i++)
+        {
+            uint16_t count = radios[i]->PeerCount();
+
+            if (_Index < count)
+            {
+                return Address(i, radios[i]->PeerAddress(_Index));
+            }
+
+            _Index -= count;
+        }
+
+        return 0;
+    }
+
+    unsigned long Millis() { return radios[0]->Millis(); }
+
+    void Delay(unsigned long _Ms) { radios[0]->Delay(_Ms); }
+
+    // Nodes on one segment.
+    uint16_t Load(byte _Radio) { return radios[_Radio]->PeerCount(); }
+
+    INNER &Radio(byte _Radio) { return *radios[_Radio]; }
+};
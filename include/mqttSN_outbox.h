@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Bounded outbound queue. SendTo and Send make one attempt at a
+// frame and, if the transport does not take it, copy it into a free
+// slot here and return. Each slot has a timer on a wheel, and Loop or
+// Update writes it again when it is due, every MSN_RETRY_INTERVAL ms,
+// up to MAX_RETRY_COUNT attempts. The outcome of a queued frame is
+// reported through the handler set with OnSent.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+#include <mqttSN_timer.h>
+
+
+// Resolution and span of the retransmit wheel, a retry further
+// out than one revolution simply waits for the next one.
+#define MSN_OUTBOX_TICK_MS 50
+#define MSN_OUTBOX_BUCKETS 32
+
+
+// Called once a queued frame was delivered, or dropped after
+// MAX_RETRY_COUNT attempts. _Frame is only valid during the call.
+typedef void (*MSN_SENT_HANDLER)(uint16_t _ToAddress, const byte *_Frame, bool _Delivered, void *_Context);
+
+
+template<uint16_t SLOTS>
+class MSN_OUTBOX
+{
+
+protected:
+    byte frame[SLOTS][MSN_OUTBOX_FRAME_SZ];
+    uint16_t length[SLOTS];
+    uint16_t to[SLOTS];
+    byte attempts[SLOTS];
+    bool used[SLOTS];
+
+    uint16_t pending;
+
+    MSN_TIMER_WHEEL<SLOTS, MSN_OUTBOX_BUCKETS, MSN_OUTBOX_TICK_MS> timers;
+
+public:
+    MSN_OUTBOX() : pending(0)
+    {
+        for (uint16_t i = 0; i < SLOTS; i++)
+        {
+            used[i] = false;
+        }
+    };
+
+    // Queues a frame that has had one attempt already, to be
+    // written again at _RetryAt. False when it is full.
+    bool Push(uint16_t _ToAddress, const void *_Frame, uint16_t _Len, unsigned long _RetryAt)
+    {
+        if (_Len > MSN_OUTBOX_FRAME_SZ || pending == SLOTS)
+        {
+            return false;
+        }
+
+        uint16_t slot = 0;
+
+        while (used[slot])
+        {
+            slot++;
+        }
+
+        if (_Frame != frame[slot])
+        {
+            memcpy(frame[slot], _Frame, _Len);
+        }
+
+        length[slot] = _Len;
+        to[slot] = _ToAddress;
+        attempts[slot] = 1;
+        used[slot] = true;
+        pending++;
+
+        timers.Schedule(slot, _RetryAt);
+
+        return true;
+    }
+
+    // The frame of the slot Push takes next, to build a frame in
+    // without a buffer of its own. Push then queues it without a
+    // copy. 0 when the outbox is full.
+    byte *Spare()
+    {
+        if (pending == SLOTS)
+        {
+            return 0;
+        }
+
+        uint16_t slot = 0;
+
+        while (used[slot])
+        {
+            slot++;
+        }
+
+        return frame[slot];
+    }
+
+    // Next slot due at _Now, MSN_NO_TIMER when there is none.
+    uint16_t Due(unsigned long _Now) { return timers.Pop(_Now); }
+
+    // Counts another attempt at _Slot, false when it has had its
+    // MAX_RETRY_COUNT and should be released instead.
+    bool Retry(uint16_t _Slot, unsigned long _RetryAt)
+    {
+        if (++attempts[_Slot] >= MAX_RETRY_COUNT)
+        {
+            return false;
+        }
+
+        timers.Schedule(_Slot, _RetryAt);
+
+        return true;
+    }
+
+    void Release(uint16_t _Slot)
+    {
+        timers.Cancel(_Slot);
+        used[_Slot] = false;
+        pending--;
+    }
+
+    uint16_t To(uint16_t _Slot) const { return to[_Slot]; }
+    const byte *Frame(uint16_t _Slot) const { return frame[_Slot]; }
+    uint16_t Length(uint16_t _Slot) const { return length[_Slot]; }
+
+    // Frames still waiting for a retry.
+    uint16_t Pending() const { return pending; }
+};
+
+
+// An outbox of no slots, e.g. MSN_NODE_OUTBOX 0: a frame gets its one
+// attempt and is dropped if the transport does not take it.
+template<>
+class MSN_OUTBOX<0>
+{
+
+public:
+    bool Push(uint16_t, const void *, uint16_t, unsigned long) { return false; }
+    byte *Spare() { return 0; }
+    uint16_t Due(unsigned long) { return MSN_NO_TIMER; }
+    bool Retry(uint16_t, unsigned long) { return false; }
+    void Release(uint16_t) {}
+
+    uint16_t To(uint16_t) const { return 0; }
+    const byte *Frame(uint16_t) const { return 0; }
+    uint16_t Length(uint16_t) const { return 0; }
+
+    uint16_t Pending() const { return 0; }
+};
@@ -0,0 +1,441 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: In-flight window for acknowledged PUBLISH. Each slot keeps a copy
+// of one PUBLISH frame, or the PUBREL that follows it at QoS 2, who it
+// went to and which ack it waits for. Up to
+// MSN_QOS_INFLIGHT publishes per destination can be outstanding at once, so
+// a node can pipeline readings instead of waiting on each PUBACK. A slot
+// that is not acked within MSN_QOS_RETRY_MS is sent again with DUP_ON, up
+// to MAX_RETRY_COUNT times, from a timer wheel driven by Loop.
+//
+// Message ids are handed out so that msgID % SLOTS is the slot the
+// publish sits in, an ack finds its slot with one mask and a compare.
+//
+// The receiving side of QoS 2 remembers each (sender, msgID) between
+// the PUBLISH and its PUBREL in an open addressing set, so a PUBLISH
+// sent again because a PUBREC was lost is acked but not delivered
+// twice. No heap is used.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+#include <mqttSN_timer.h>
+
+
+// QoS bits of the PUBLISH flags.
+#define QOS_MASK        0b00000110
+
+#define MSN_QOS_TICK_MS 100
+
+// How long a receiver waits for a PUBREL before it forgets the
+// PUBLISH, by then the sender has run out of attempts.
+#define MSN_QOS_RECEIVED_MS ((unsigned long)MSN_QOS_RETRY_MS * (MAX_RETRY_COUNT + 1))
+
+
+// What an in-flight slot is waiting for.
+enum MSN_QosState
+{
+    QS_FREE = 0,
+    QS_PUBACK,          // QoS 1, sent and not acked yet
+    QS_PUBREC,          // QoS 2, PUBLISH sent and not received yet
+    QS_PUBCOMP          // QoS 2, PUBREL sent and not completed yet
+};
+
+// What a receiver does with an incoming QoS 2 PUBLISH.
+enum MSN_QosReceived
+{
+    QR_NEW = 0,         // deliver it and send PUBREC
+    QR_DUPLICATE,       // seen already, only send PUBREC again
+    QR_FULL             // no room to track it, reject it
+};
+
+// Called once an acknowledged publish is done: _Delivered with the
+// ReturnCode of the ack, or not after MAX_RETRY_COUNT attempts.
+typedef void (*MSN_PUBLISHED_HANDLER)(uint16_t _ToAddress, uint16_t _MsgID, bool _Delivered, byte _ReturnCode, void *_Context);
+
+
+// PUBACK frame for a PUBLISH, in the layout of MSN_MESSAGE<MSN_PUBACK>.
+inline void MSN_PubAckFrame(byte *_Out, uint16_t _TopicID, uint16_t _MsgID, byte _ReturnCode)
+{
+    _Out[0] = 8;
+    _Out[1] = MSN_PUBACK;
+    _Out[2] = 0x00;
+    _Out[3] = _TopicID >> 8;
+    _Out[4] = _TopicID & 0xff;
+    _Out[5] = _MsgID >> 8;
+    _Out[6] = _MsgID & 0xff;
+    _Out[7] = _ReturnCode;
+}
+
+
+// PUBREC, PUBREL and PUBCOMP frames, all a MsgID and nothing else.
+inline void MSN_MsgIdFrame(byte *_Out, byte _MsgType, uint16_t _MsgID)
+{
+    _Out[0] = 4;
+    _Out[1] = _MsgType;
+    _Out[2] = _MsgID >> 8;
+    _Out[3] = _MsgID & 0xff;
+}
+
+
+// SLOTS publishes of at most FRAME_SZ octets each.
+template<uint16_t SLOTS, uint16_t FRAME_SZ>
+class MSN_QOS_WINDOW
+{
+
+    static_assert(SLOTS && (SLOTS & (SLOTS - 1)) == 0, "QoS window slots must be a power of two");
+
+protected:
+    byte frame[SLOTS][FRAME_SZ];
+    uint16_t length[SLOTS];
+    byte state[SLOTS];
+    byte attempts[SLOTS];
+    uint16_t to[SLOTS];
+    uint16_t msgID[SLOTS];
+    uint16_t epoch[SLOTS];
+    uint16_t used;
+
+#if MSN_STATS_ENABLED
+    // When each publish was first sent, for its round trip.
+    unsigned long opened[SLOTS];
+#endif
+
+    // No more buckets than slots, a small window spends its
+    // RAM on publishes and goes round the wheel more often.
+    static const uint16_t BUCKETS = SLOTS < MSN_QOS_BUCKETS ? SLOTS : MSN_QOS_BUCKETS;
+
+    MSN_TIMER_WHEEL<SLOTS, BUCKETS, MSN_QOS_TICK_MS> timers;
+
+public:
+    MSN_QOS_WINDOW() : used(0)
+    {
+        for (uint16_t i = 0; i < SLOTS; i++)
+        {
+            state[i] = QS_FREE;
+            epoch[i] = 0;
+        }
+    };
+
+    uint16_t Used() const { return used; }
+
+    // Publishes outstanding toward _ToAddress.
+    uint16_t InFlight(uint16_t _ToAddress) const
+    {
+        uint16_t count = 0;
+
+        for (uint16_t i = 0; i < SLOTS; i++)
+        {
+            count += state[i] != QS_FREE && to[i] == _ToAddress;
+        }
+
+        return count;
+    }
+
+    // Whether a PUBLISH frame of _Len octets fits a slot.
+    static bool Fits(uint16_t _Len) { return _Len <= FRAME_SZ; }
+
+    // Takes a slot for a PUBLISH frame to _ToAddress, gives it a fresh
+    // msgID, patched into the copy, and arms its retry. Returns the
+    // slot, or MSN_NO_TIMER when the window toward _ToAddress or the
+    // whole table is full, or the frame does not Fit.
+    uint16_t Open(uint16_t _ToAddress, const byte *_Frame, uint16_t _Len, byte _State, unsigned long _RetryAt)
+    {
+        if (!Fits(_Len) || used == SLOTS || InFlight(_ToAddress) >= MSN_QOS_INFLIGHT)
+        {
+            return MSN_NO_TIMER;
+        }
+
+        uint16_t slot = 0;
+
+        while (state[slot] != QS_FREE)
+        {
+            slot++;
+        }
+
+        uint16_t id;
+
+        do
+        {
+            id = (uint16_t)(++epoch[slot] * SLOTS + slot);
+        } while (id == 0);
+
+        uint16_t header = MSN_HeaderLength(_Frame);
+
+        memcpy(frame[slot], _Frame, _Len);
+        frame[slot][header + 4] = id >> 8;
+        frame[slot][header + 5] = id & 0xff;
+
+        length[slot] = _Len;
+        state[slot] = _State;
+        attempts[slot] = 1;
+        to[slot] = _ToAddress;
+        msgID[slot] = id;
+        used++;
+
+#if MSN_STATS_ENABLED
+        opened[slot] = _RetryAt - MSN_QOS_RETRY_MS;
+#endif
+
+        timers.Schedule(slot, _RetryAt);
+
+        return slot;
+    }
+
+    // Slot of the publish to _ToAddress with _MsgID waiting in
+    // _State, MSN_NO_TIMER if there is none.
+    uint16_t Find(uint16_t _ToAddress, uint16_t _MsgID, byte _State) const
+    {
+        uint16_t slot = _MsgID & (SLOTS - 1);
+
+        if (state[slot] == _State && msgID[slot] == _MsgID && to[slot] == _ToAddress)
+        {
+            return slot;
+        }
+
+        return MSN_NO_TIMER;
+    }
+
+    // Next slot whose ack is overdue at _Now, MSN_NO_TIMER when none is.
+    uint16_t Due(unsigned long _Now) { return timers.Pop(_Now); }
+
+    // Marks a PUBLISH in _Slot as a duplicate and counts another
+    // attempt, false once it has had MAX_RETRY_COUNT.
+    bool Retry(uint16_t _Slot, unsigned long _RetryAt)
+    {
+        if (attempts[_Slot]++ >= MAX_RETRY_COUNT)
+        {
+            return false;
+        }
+
+        if (state[_Slot] != QS_PUBCOMP)
+        {
+            frame[_Slot][MSN_HeaderLength(frame[_Slot]) + 1] |= DUP_ON;
+        }
+
+        timers.Schedule(_Slot, _RetryAt);
+
+        return true;
+    }
+
+    // Moves the retry of _Slot to _RetryAt without counting an
+    // attempt, e.g. while its client sleeps.
+    void Defer(uint16_t _Slot, unsigned long _RetryAt) { timers.Schedule(_Slot, _RetryAt); }
+
+    // Next slot toward _ToAddress from _Slot on, MSN_NO_TIMER when
+    // there is none, for walking the publishes to one client.
+    uint16_t Next(uint16_t _ToAddress, uint16_t _Slot) const
+    {
+        for (; _Slot < SLOTS; _Slot++)
+        {
+            if (state[_Slot] != QS_FREE && to[_Slot] == _ToAddress)
+            {
+                return _Slot;
+            }
+        }
+
+        return MSN_NO_TIMER;
+    }
+
+    // QoS 2: the PUBLISH in _Slot was received, the slot now
+    // holds its PUBREL and waits for the PUBCOMP.
+    void Release(uint16_t _Slot, unsigned long _RetryAt)
+    {
+        MSN_MsgIdFrame(frame[_Slot], MSN_PUBREL, msgID[_Slot]);
+
+        length[_Slot] = 4;
+        state[_Slot] = QS_PUBCOMP;
+        attempts[_Slot] = 1;
+
+        timers.Schedule(_Slot, _RetryAt);
+    }
+
+    void Close(uint16_t _Slot)
+    {
+        timers.Cancel(_Slot);
+        state[_Slot] = QS_FREE;
+        used--;
+    }
+
+    const byte *Frame(uint16_t _Slot) const { return frame[_Slot]; }
+    uint16_t Length(uint16_t _Slot) const { return length[_Slot]; }
+    uint16_t To(uint16_t _Slot) const { return to[_Slot]; }
+    uint16_t MsgID(uint16_t _Slot) const { return msgID[_Slot]; }
+    byte State(uint16_t _Slot) const { return state[_Slot]; }
+
+#if MSN_STATS_ENABLED
+    unsigned long Opened(uint16_t _Slot) const { return opened[_Slot]; }
+#else
+    unsigned long Opened(uint16_t) const { return 0; }
+#endif
+};
+
+
+// A window of no slots, e.g. MSN_NODE_QOS_SLOTS 0 on a node that
+// never publishes at QoS 1 or 2. Open turns every publish down.
+template<uint16_t FRAME_SZ>
+class MSN_QOS_WINDOW<0, FRAME_SZ>
+{
+
+public:
+    uint16_t Used() const { return 0; }
+    uint16_t InFlight(uint16_t) const { return 0; }
+    static bool Fits(uint16_t) { return false; }
+    uint16_t Open(uint16_t, const byte *, uint16_t, byte, unsigned long) { return MSN_NO_TIMER; }
+    uint16_t Find(uint16_t, uint16_t, byte) const { return MSN_NO_TIMER; }
+    uint16_t Due(unsigned long) { return MSN_NO_TIMER; }
+    bool Retry(uint16_t, unsigned long) { return false; }
+    void Defer(uint16_t, unsigned long) {}
+    uint16_t Next(uint16_t, uint16_t) const { return MSN_NO_TIMER; }
+    void Release(uint16_t, unsigned long) {}
+    void Close(uint16_t) {}
+    const byte *Frame(uint16_t) const { return 0; }
+    uint16_t Length(uint16_t) const { return 0; }
+    uint16_t To(uint16_t) const { return 0; }
+    uint16_t MsgID(uint16_t) const { return 0; }
+    byte State(uint16_t) const { return QS_FREE; }
+    unsigned long Opened(uint16_t) const { return 0; }
+};
+
+
+template<uint16_t CAPACITY>
+class MSN_QOS_RECEIVED
+{
+
+    static_assert(CAPACITY && (CAPACITY & (CAPACITY - 1)) == 0, "QoS 2 receive capacity must be a power of two");
+    static_assert(CAPACITY <= 0x4000, "QoS 2 receive capacity must be at most 16384");
+
+    static const uint16_t SLOTS = 2 * CAPACITY;
+    static const uint16_t MASK = SLOTS - 1;
+
+protected:
+    uint16_t from[SLOTS];
+    uint16_t msgID[SLOTS];
+    unsigned long since[SLOTS];
+    bool used[SLOTS];
+    uint16_t count;
+
+    static uint16_t Hash(uint16_t _From, uint16_t _MsgID)
+    {
+        return (uint16_t)((_From * 40503u) ^ (_MsgID * 9973u));
+    }
+
+    uint16_t Probe(uint16_t _From, uint16_t _MsgID) const
+    {
+        uint16_t i = Hash(_From, _MsgID) & MASK;
+
+        while (used[i] && (from[i] != _From || msgID[i] != _MsgID))
+        {
+            i = (i + 1) & MASK;
+        }
+
+        return i;
+    }
+
+    // Empties slot _I and moves the entries probed
+    // past it back toward their home slots.
+    void Erase(uint16_t _I)
+    {
+        uint16_t i = _I;
+
+        for (uint16_t j = (i + 1) & MASK; used[j]; j = (j + 1) & MASK)
+        {
+            uint16_t home = Hash(from[j], msgID[j]) & MASK;
+
+            // j may move to i only if its home is not in (i, j]
+            if (((j - home) & MASK) >= ((j - i) & MASK))
+            {
+                from[i] = from[j];
+                msgID[i] = msgID[j];
+                since[i] = since[j];
+                i = j;
+            }
+        }
+
+        used[i] = false;
+        count--;
+    }
+
+    // Forgets the publishes whose PUBREL is overdue.
+    void Expire(unsigned long _Now)
+    {
+        for (uint16_t i = 0; i < SLOTS; )
+        {
+            if (used[i] && (long)(_Now - since[i]) >= (long)MSN_QOS_RECEIVED_MS)
+            {
+                // the shift may pull another entry into i
+                Erase(i);
+                continue;
+            }
+
+            i++;
+        }
+    }
+
+public:
+    MSN_QOS_RECEIVED() : count(0)
+    {
+        for (uint16_t i = 0; i < SLOTS; i++)
+        {
+            used[i] = false;
+        }
+    };
+
+    uint16_t Count() const { return count; }
+
+    // Records a QoS 2 PUBLISH from _From, or tells it is a
+    // duplicate of one still waiting for its PUBREL.
+    MSN_QosReceived Accept(uint16_t _From, uint16_t _MsgID, unsigned long _Now)
+    {
+        uint16_t i = Probe(_From, _MsgID);
+
+        if (used[i])
+        {
+            return QR_DUPLICATE;
+        }
+
+        if (count == CAPACITY)
+        {
+            Expire(_Now);
+
+            if (count == CAPACITY)
+            {
+                return QR_FULL;
+            }
+
+            i = Probe(_From, _MsgID);
+        }
+
+        from[i] = _From;
+        msgID[i] = _MsgID;
+        since[i] = _Now;
+        used[i] = true;
+        count++;
+
+        return QR_NEW;
+    }
+
+    // The PUBREL for _MsgID came in, a PUBLISH with it is new again.
+    void Release(uint16_t _From, uint16_t _MsgID)
+    {
+        uint16_t i = Probe(_From, _MsgID);
+
+        if (used[i])
+        {
+            Erase(i);
+        }
+    }
+};
+
+
+// Remembers nothing, e.g. MSN_NODE_QOS_RECEIVED 0 on a node that
+// subscribes at QoS 0 and 1 only. A QoS 2 PUBLISH is turned down.
+template<>
+class MSN_QOS_RECEIVED<0>
+{
+
+public:
+    uint16_t Count() const { return 0; }
+    MSN_QosReceived Accept(uint16_t, uint16_t, unsigned long) { return QR_FULL; }
+    void Release(uint16_t, uint16_t) {}
+};
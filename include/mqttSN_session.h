@@ -0,0 +1,294 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Gateway side client sessions. A fixed array of MSN_SESSION
+// records and two open addressing indexes over it, one keyed by mesh
+// address and one by clientID, each a power of two array of record
+// numbers at most half full and probed linearly. Removing a session
+// shifts the entries after it back, so there are no tombstones and a
+// lookup touches a handful of adjacent uint16_t. No heap is used.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+#include <mqttSN_transport.h>
+
+
+#define MSN_NO_SESSION 0xffff
+
+
+// Client states, as in section 6.14 of the specification.
+enum MSN_SessionState
+{
+    SS_DISCONNECTED = 0,
+    SS_ACTIVE,
+    SS_ASLEEP,
+    SS_AWAKE,
+    SS_LOST
+};
+
+
+struct MSN_SESSION
+{
+    uint16_t address;               // mesh address the client talks from
+    char clientID[CLIENT_ID_SZ + 1];
+    byte state;                     // MSN_SessionState
+    byte flags;                     // CONNECT flags, WILL_ON, CLEAN_ON
+    uint16_t duration;              // keep alive, or sleep, in seconds
+    unsigned long lastSeen;         // Millis() of the last frame from it
+    uint16_t clientHash;
+};
+
+
+template<uint16_t CAPACITY>
+class MSN_SESSION_TABLE
+{
+
+    static_assert(CAPACITY && (CAPACITY & (CAPACITY - 1)) == 0, "session capacity must be a power of two");
+    static_assert(CAPACITY <= 0x4000, "session capacity must be at most 16384");
+
+    static const uint16_t SLOTS = 2 * CAPACITY;
+    static const uint16_t MASK = SLOTS - 1;
+
+protected:
+    MSN_SESSION sessions[CAPACITY];
+    bool used[CAPACITY];
+    uint16_t count;
+
+    uint16_t byAddress[SLOTS];
+    uint16_t byClient[SLOTS];
+
+    static uint16_t HashAddress(uint16_t _Address)
+    {
+        return (uint16_t)(_Address * 40503u);
+    }
+
+    static uint16_t HashClient(const char *_ClientID, uint16_t _Len)
+    {
+        uint32_t hash = 2166136261u;
+
+        for (uint16_t i = 0; i < _Len; i++)
+        {
+            hash = (hash ^ (byte)_ClientID[i]) * 16777619u;
+        }
+
+        return (uint16_t)(hash ^ (hash >> 16));
+    }
+
+    uint16_t Home(const uint16_t *_Index, uint16_t _Record) const
+    {
+        return (_Index == byAddress ? HashAddress(sessions[_Record].address) : sessions[_Record].clientHash) & MASK;
+    }
+
+    void Insert(uint16_t *_Index, uint16_t _Hash, uint16_t _Record)
+    {
+        uint16_t i = _Hash & MASK;
+
+        while (_Index[i] != MSN_NO_SESSION)
+        {
+            i = (i + 1) & MASK;
+        }
+
+        _Index[i] = _Record;
+    }
+
+    // Takes _Record out of _Index and moves the entries
+    // probed past it back toward their home slots.
+    void Erase(uint16_t *_Index, uint16_t _Hash, uint16_t _Record)
+    {
+        uint16_t i = _Hash & MASK;
+
+        while (_Index[i] != _Record)
+        {
+            i = (i + 1) & MASK;
+        }
+
+        for (uint16_t j = (i + 1) & MASK; _Index[j] != MSN_NO_SESSION; j = (j + 1) & MASK)
+        {
+            uint16_t home = Home(_Index, _Index[j]);
+
+            // j may move to i only if its home is not in (i, j]
+            if (((j - home) & MASK) >= ((j - i) & MASK))
+            {
+                _Index[i] = _Index[j];
+                i = j;
+            }
+        }
+
+        _Index[i] = MSN_NO_SESSION;
+    }
+
+    uint16_t FindAddress(uint16_t _Address) const
+    {
+        for (uint16_t i = HashAddress(_Address) & MASK; byAddress[i] != MSN_NO_SESSION; i = (i + 1) & MASK)
+        {
+            if (sessions[byAddress[i]].address == _Address)
+            {
+                return byAddress[i];
+            }
+        }
+
+        return MSN_NO_SESSION;
+    }
+
+    uint16_t FindClient(const char *_ClientID, uint16_t _Len, uint16_t _Hash) const
+    {
+        for (uint16_t i = _Hash & MASK; byClient[i] != MSN_NO_SESSION; i = (i + 1) & MASK)
+        {
+            const MSN_SESSION &s = sessions[byClient[i]];
+
+            if (s.clientHash == _Hash && strncmp(s.clientID, _ClientID, _Len) == 0 && s.clientID[_Len] == 0)
+            {
+                return byClient[i];
+            }
+        }
+
+        return MSN_NO_SESSION;
+    }
+
+public:
+    MSN_SESSION_TABLE() : count(0)
+    {
+        for (uint16_t i = 0; i < CAPACITY; i++)
+        {
+            used[i] = false;
+        }
+
+        for (uint16_t i = 0; i < SLOTS; i++)
+        {
+            byAddress[i] = MSN_NO_SESSION;
+            byClient[i] = MSN_NO_SESSION;
+        }
+    };
+
+    uint16_t Count() const { return count; }
+    uint16_t Capacity() const { return CAPACITY; }
+
+    // Session of the client at _Address, or 0.
+    MSN_SESSION *Find(uint16_t _Address)
+    {
+        uint16_t record = FindAddress(_Address);
+
+        return record == MSN_NO_SESSION ? 0 : &sessions[record];
+    }
+
+    // Session of the client called _ClientID (_Len octets, not
+    // necessarily NUL terminated), or 0.
+    MSN_SESSION *Find(const char *_ClientID, uint16_t _Len)
+    {
+        uint16_t record = FindClient(_ClientID, _Len, HashClient(_ClientID, _Len));
+
+        return record == MSN_NO_SESSION ? 0 : &sessions[record];
+    }
+
+    // The session that has been disconnected or lost longest, or 0
+    // when every client is still connected or asleep.
+    MSN_SESSION *Idle()
+    {
+        MSN_SESSION *idle = 0;
+
+        for (uint16_t i = 0; i < CAPACITY; i++)
+        {
+            MSN_SESSION &s = sessions[i];
+
+            if (used[i] && (s.state == SS_DISCONNECTED || s.state == SS_LOST) &&
+                (!idle || (long)(s.lastSeen - idle->lastSeen) < 0))
+            {
+                idle = &s;
+            }
+        }
+
+        return idle;
+    }
+
+    // Opens or resumes the session of _ClientID at _Address for a
+    // CONNECT. A client that comes back from a new address keeps its
+    // session, a session left on _Address by another client is
+    // closed. When the table is full the Idle session makes room,
+    // returns 0 when there is none.
+    MSN_SESSION *Connect(uint16_t _Address, const char *_ClientID, uint16_t _Len,
+        byte _Flags, uint16_t _Duration, unsigned long _Now)
+    {
+        if (_Len > CLIENT_ID_SZ)
+        {
+            return 0;
+        }
+
+        uint16_t hash = HashClient(_ClientID, _Len);
+        uint16_t record = FindClient(_ClientID, _Len, hash);
+        uint16_t other = FindAddress(_Address);
+
+        if (other != MSN_NO_SESSION && other != record)
+        {
+            Remove(&sessions[other]);
+        }
+
+        if (record == MSN_NO_SESSION)
+        {
+            if (count == CAPACITY)
+            {
+                MSN_SESSION *idle = Idle();
+
+                if (!idle)
+                {
+                    return 0;
+                }
+
+                Remove(idle);
+            }
+
+            record = 0;
+
+            while (used[record])
+            {
+                record++;
+            }
+
+            MSN_SESSION &s = sessions[record];
+
+            memcpy(s.clientID, _ClientID, _Len);
+            s.clientID[_Len] = 0;
+            s.clientHash = hash;
+            s.address = _Address;
+
+            used[record] = true;
+            count++;
+
+            Insert(byClient, hash, record);
+            Insert(byAddress, HashAddress(_Address), record);
+        }
+        else if (sessions[record].address != _Address)
+        {
+            Erase(byAddress, HashAddress(sessions[record].address), record);
+            sessions[record].address = _Address;
+            Insert(byAddress, HashAddress(_Address), record);
+        }
+
+        MSN_SESSION &s = sessions[record];
+
+        s.state = SS_ACTIVE;
+        s.flags = _Flags;
+        s.duration = _Duration;
+        s.lastSeen = _Now;
+
+        return &s;
+    }
+
+    void Remove(MSN_SESSION *_Session)
+    {
+        uint16_t record = _Session - sessions;
+
+        Erase(byAddress, HashAddress(_Session->address), record);
+        Erase(byClient, _Session->clientHash, record);
+
+        used[record] = false;
+        count--;
+    }
+
+    // Sessions by record number, for walking the table.
+    // Unused records return 0.
+    MSN_SESSION *At(uint16_t _Record) { return used[_Record] ? &sessions[_Record] : 0; }
+
+    // Record number of _Session, for tables kept beside this one.
+    uint16_t Record(const MSN_SESSION *_Session) const { return _Session - sessions; }
+};
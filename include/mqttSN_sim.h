@@ -0,0 +1,548 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Host side discrete-event mesh simulator. MSN_SIM_TRANSPORT stands
+// in for RF24/RF24Network/RF24Mesh and every device shares one
+// MSN_SIM_WORLD, which owns a virtual clock and an event queue of frames
+// in flight. Links have loss and latency, frames take airtime and two
+// frames overlapping at the same receiver collide.
+//
+// The mesh is modeled as a star, each node one hop from the gateway.
+// Devices are driven by MSN_SIM_WORLD::Run, which calls back with the
+// address of every device that has frames waiting; the callback should
+// run that device's Loop with a _BlockTime of 0, and ask for a PollAt
+// while the device has frames in its outbox. A blocking wait (Delay)
+// moves only that device's own clock ahead: its
+// writes are stamped with its local time and it is not polled again
+// until the world clock catches up, while the rest of the mesh runs on.
+//
+// Host only, uses the standard library.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_transport.h>
+
+#include <deque>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+
+// Time a single 32 byte radio packet and its auto-ack hold the
+// channel, in microseconds (1Mbps, ack and turnaround included).
+#ifndef MSN_SIM_PACKET_US
+#define MSN_SIM_PACKET_US 600
+#endif
+
+// RF24Network payload bytes carried per radio packet.
+#define MSN_SIM_PACKET_PAYLOAD 24
+
+// Frames a receiver holds before dropping, RF24Network's frame queue.
+#ifndef MSN_SIM_RX_QUEUE
+#define MSN_SIM_RX_QUEUE 12
+#endif
+
+
+struct MSN_SIM_LINK
+{
+    // Probability in [0,1] that a frame on this link is lost.
+    float loss;
+
+    // One way latency in microseconds on top of airtime.
+    uint32_t latencyUs;
+};
+
+
+struct MSN_SIM_STATS
+{
+    uint64_t framesSent;
+    uint64_t framesDelivered;
+    uint64_t framesLost;
+    uint64_t framesCollided;
+    uint64_t framesOverflowed;
+    uint64_t bytesSent;
+    uint64_t airtimeUs;
+};
+
+
+class MSN_SIM_TRANSPORT;
+
+
+class MSN_SIM_WORLD
+{
+
+protected:
+    struct FRAME
+    {
+        uint16_t from;
+        std::vector<byte> data;
+    };
+
+    struct ENDPOINT
+    {
+        MSN_SIM_TRANSPORT *transport;
+        std::deque<FRAME> inbox;
+        uint64_t busyFromUs;
+        uint64_t busyUntilUs;
+        uint64_t blockedUntilUs;
+        uint64_t lastSeq;
+        uint64_t received;
+        size_t maxDepth;
+        bool ready;
+    };
+
+    struct EVENT
+    {
+        uint64_t atUs;
+        uint64_t seq;
+        uint16_t to;
+        FRAME frame;
+
+        bool operator<(const EVENT &_Other) const
+        {
+            // priority_queue is a max heap, earliest event first
+            if (atUs != _Other.atUs)
+            {
+                return atUs > _Other.atUs;
+            }
+
+            return seq > _Other.seq;
+        }
+    };
+
+    struct TIMER
+    {
+        uint64_t atUs;
+        uint64_t seq;
+        std::function<void()> callback;
+
+        bool operator<(const TIMER &_Other) const
+        {
+            if (atUs != _Other.atUs)
+            {
+                return atUs > _Other.atUs;
+            }
+
+            return seq > _Other.seq;
+        }
+    };
+
+    uint64_t nowUs;
+    uint64_t nextSeq;
+    uint64_t rng;
+
+    std::priority_queue<EVENT> events;
+    std::priority_queue<TIMER> timers;
+    std::unordered_map<uint16_t, ENDPOINT> endpoints;
+    std::unordered_map<uint32_t, MSN_SIM_LINK> links;
+    std::unordered_map<uint64_t, bool> collided;
+    std::vector<uint16_t> peers;
+    std::vector<uint16_t> readyList;
+
+    MSN_SIM_STATS stats;
+
+    // xorshift64*, deterministic for a given seed
+    double Random()
+    {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+
+        return (double)((rng * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+    }
+
+    const MSN_SIM_LINK &Link(uint16_t _From, uint16_t _To) const
+    {
+        std::unordered_map<uint32_t, MSN_SIM_LINK>::const_iterator it = links.find(((uint32_t)_From << 16) | _To);
+
+        return it == links.end() ? defaultLink : it->second;
+    }
+
+    void Deliver(EVENT &_Event)
+    {
+        std::unordered_map<uint64_t, bool>::iterator hit = collided.find(_Event.seq);
+
+        if (hit != collided.end())
+        {
+            collided.erase(hit);
+            stats.framesCollided++;
+            return;
+        }
+
+        std::unordered_map<uint16_t, ENDPOINT>::iterator it = endpoints.find(_Event.to);
+
+        if (it == endpoints.end())
+        {
+            stats.framesLost++;
+            return;
+        }
+
+        ENDPOINT &ep = it->second;
+
+        if (ep.inbox.size() >= rxQueueLimit)
+        {
+            stats.framesOverflowed++;
+            return;
+        }
+
+        ep.inbox.push_back(std::move(_Event.frame));
+        ep.received++;
+        stats.framesDelivered++;
+
+        if (ep.inbox.size() > ep.maxDepth)
+        {
+            ep.maxDepth = ep.inbox.size();
+        }
+
+        if (!ep.ready)
+        {
+            ep.ready = true;
+            readyList.push_back(_Event.to);
+        }
+    }
+
+    // Delivers the next frame due by _UntilUs into its inbox.
+    bool PumpFrame(uint64_t _UntilUs)
+    {
+        if (events.empty() || events.top().atUs > _UntilUs)
+        {
+            return false;
+        }
+
+        EVENT ev = events.top();
+        events.pop();
+
+        if (ev.atUs > nowUs)
+        {
+            nowUs = ev.atUs;
+        }
+
+        Deliver(ev);
+
+        return true;
+    }
+
+    // Runs the next timer due by _UntilUs.
+    bool PumpTimer(uint64_t _UntilUs)
+    {
+        if (timers.empty() || timers.top().atUs > _UntilUs)
+        {
+            return false;
+        }
+
+        TIMER timer = timers.top();
+        timers.pop();
+
+        if (timer.atUs > nowUs)
+        {
+            nowUs = timer.atUs;
+        }
+
+        timer.callback();
+
+        return true;
+    }
+
+public:
+    MSN_SIM_LINK defaultLink;
+    uint32_t packetUs;
+    size_t rxQueueLimit;
+
+    MSN_SIM_WORLD(uint64_t _Seed = 1)
+        : nowUs(0), nextSeq(1), rng(_Seed ? _Seed : 1),
+            packetUs(MSN_SIM_PACKET_US), rxQueueLimit(MSN_SIM_RX_QUEUE)
+    {
+        defaultLink.loss = 0.0f;
+        defaultLink.latencyUs = 1000;
+        memset(&stats, 0, sizeof(stats));
+    };
+
+    uint64_t NowUs() const { return nowUs; }
+
+    const MSN_SIM_STATS &Stats() const { return stats; }
+
+    // Per direction link settings, overrides defaultLink.
+    void SetLink(uint16_t _From, uint16_t _To, float _Loss, uint32_t _LatencyUs)
+    {
+        MSN_SIM_LINK link;
+        link.loss = _Loss;
+        link.latencyUs = _LatencyUs;
+
+        links[((uint32_t)_From << 16) | _To] = link;
+    }
+
+    uint32_t Airtime(uint16_t _Len) const
+    {
+        uint16_t packets = (_Len + MSN_SIM_PACKET_PAYLOAD - 1) / MSN_SIM_PACKET_PAYLOAD;
+
+        return (packets ? packets : 1) * packetUs;
+    }
+
+    // Frames received by _Address and the deepest its queue got.
+    uint64_t Received(uint16_t _Address) const { return endpoints.at(_Address).received; }
+    size_t MaxDepth(uint16_t _Address) const { return endpoints.at(_Address).maxDepth; }
+
+    // Runs _Callback once the clock reaches _AtUs.
+    void Schedule(uint64_t _AtUs, std::function<void()> _Callback)
+    {
+        TIMER timer;
+        timer.atUs = _AtUs < nowUs ? nowUs : _AtUs;
+        timer.seq = nextSeq++;
+        timer.callback = std::move(_Callback);
+
+        timers.push(std::move(timer));
+    }
+
+    // Polls _Address once the clock reaches _AtUs even with nothing
+    // in its inbox, so its Loop can work its outbox.
+    void PollAt(uint16_t _Address, uint64_t _AtUs)
+    {
+        Schedule(_AtUs, [this, _Address]() {
+            ENDPOINT &ep = endpoints[_Address];
+
+            if (!ep.ready)
+            {
+                ep.ready = true;
+                readyList.push_back(_Address);
+            }
+        });
+    }
+
+    // Processes events until the clock reaches _UntilUs, calling
+    // _Poll(address) for every device with frames waiting.
+    void Run(uint64_t _UntilUs, const std::function<void(uint16_t)> &_Poll)
+    {
+        for (;;)
+        {
+            while (!readyList.empty())
+            {
+                std::vector<uint16_t> ready;
+                ready.swap(readyList);
+
+                for (size_t i = 0; i < ready.size(); i++)
+                {
+                    ENDPOINT &ep = endpoints[ready[i]];
+
+                    ep.ready = false;
+
+                    // still inside a blocking wait, look again once it ends
+                    if (ep.blockedUntilUs > nowUs)
+                    {
+                        uint16_t address = ready[i];
+
+                        Schedule(ep.blockedUntilUs, [this, address]() { Wake(address); });
+
+                        continue;
+                    }
+
+                    _Poll(ready[i]);
+                }
+            }
+
+            bool frame_first = !events.empty() &&
+                (timers.empty() || events.top().atUs <= timers.top().atUs);
+
+            if (!(frame_first ? PumpFrame(_UntilUs) : PumpTimer(_UntilUs)))
+            {
+                break;
+            }
+        }
+
+        if (nowUs < _UntilUs)
+        {
+            nowUs = _UntilUs;
+        }
+    }
+
+    ////// [ CALLED BY MSN_SIM_TRANSPORT ] //////
+
+    bool Attach(uint16_t _Address, MSN_SIM_TRANSPORT *_Transport)
+    {
+        ENDPOINT &ep = endpoints[_Address];
+
+        bool joined = ep.transport == 0;
+
+        ep.transport = _Transport;
+
+        if (joined && _Address != MSN_GATEWAY_ADDRESS)
+        {
+            peers.push_back(_Address);
+        }
+
+        return true;
+    }
+
+    void Wake(uint16_t _Address)
+    {
+        ENDPOINT &ep = endpoints[_Address];
+
+        if (!ep.ready && !ep.inbox.empty())
+        {
+            ep.ready = true;
+            readyList.push_back(_Address);
+        }
+    }
+
+    void Block(uint16_t _Address, uint64_t _UntilUs)
+    {
+        endpoints[_Address].blockedUntilUs = _UntilUs;
+    }
+
+    // Sends a frame that leaves _From at _AtUs, the sender's local time.
+    bool Transmit(uint16_t _From, uint16_t _To, const void *_Payload, uint16_t _Len, uint64_t _AtUs)
+    {
+        const MSN_SIM_LINK &link = Link(_From, _To);
+
+        uint32_t air = Airtime(_Len);
+
+        stats.framesSent++;
+        stats.bytesSent += _Len;
+        stats.airtimeUs += air;
+
+        if (Random() < link.loss)
+        {
+            stats.framesLost++;
+            return false;
+        }
+
+        EVENT ev;
+        ev.atUs = _AtUs + air + link.latencyUs;
+        ev.seq = nextSeq++;
+        ev.to = _To;
+        ev.frame.from = _From;
+        ev.frame.data.assign((const byte*)_Payload, (const byte*)_Payload + _Len);
+
+        std::unordered_map<uint16_t, ENDPOINT>::iterator it = endpoints.find(_To);
+
+        if (it != endpoints.end())
+        {
+            ENDPOINT &ep = it->second;
+
+            // Overlaps the frame already on air toward this receiver,
+            // both are lost. The earlier sender has already seen its
+            // write succeed, like an ack lost after the fact.
+            if (_AtUs < ep.busyUntilUs && _AtUs + air > ep.busyFromUs)
+            {
+                collided[ep.lastSeq] = true;
+                stats.framesCollided++;
+                return false;
+            }
+
+            ep.busyFromUs = _AtUs;
+            ep.busyUntilUs = _AtUs + air;
+            ep.lastSeq = ev.seq;
+        }
+
+        events.push(std::move(ev));
+
+        return true;
+    }
+
+    bool Available(uint16_t _Address)
+    {
+        return !endpoints[_Address].inbox.empty();
+    }
+
+    uint16_t Receive(uint16_t _Address, byte *_Buffer, uint16_t _Size, uint16_t *_From)
+    {
+        ENDPOINT &ep = endpoints[_Address];
+
+        if (ep.inbox.empty())
+        {
+            return 0;
+        }
+
+        FRAME &frame = ep.inbox.front();
+
+        uint16_t len = frame.data.size() < _Size ? frame.data.size() : _Size;
+
+        memcpy(_Buffer, frame.data.data(), len);
+        *_From = frame.from;
+
+        ep.inbox.pop_front();
+
+        return len;
+    }
+
+    uint16_t PeerCount() const { return peers.size(); }
+
+    uint16_t PeerAddress(uint16_t _Index) const { return peers[_Index]; }
+};
+
+
+////// [ SIMULATED MESH TRANSPORT ] //////
+// Addresses are node ids, the gateway is node 0.
+class MSN_SIM_TRANSPORT
+{
+
+protected:
+    MSN_SIM_WORLD *world;
+    uint16_t address;
+    uint64_t localUs;
+    bool attached;
+
+    // The device's own clock, ahead of the world while it is blocked.
+    uint64_t LocalUs()
+    {
+        if (localUs < world->NowUs())
+        {
+            localUs = world->NowUs();
+        }
+
+        return localUs;
+    }
+
+public:
+    MSN_SIM_TRANSPORT(MSN_SIM_WORLD *_World)
+        : world(_World), address(0), localUs(0), attached(false) {};
+
+    bool Begin(uint16_t _NodeID)
+    {
+        address = _NodeID;
+        attached = world->Attach(_NodeID, this);
+
+        return attached;
+    }
+
+    bool Restart() { return Begin(address); }
+
+    void Update() {}
+
+    void DHCP() {}
+
+    bool Available() { return world->Available(address); }
+
+    uint16_t Read(byte *_Buffer, uint16_t _Size, uint16_t *_From)
+    {
+        return world->Receive(address, _Buffer, _Size, _From);
+    }
+
+    // Returns once the frame is on air, like the radio, so frames
+    // written back to back follow one another instead of overlapping.
+    bool Write(uint16_t _To, const void *_Payload, uint16_t _Len)
+    {
+        uint64_t at = LocalUs();
+
+        localUs = at + world->Airtime(_Len);
+
+        return world->Transmit(address, _To, _Payload, _Len, at);
+    }
+
+    bool CheckConnection() { return attached; }
+
+    bool RenewAddress() { return attached; }
+
+    uint16_t PeerCount() { return world->PeerCount(); }
+
+    uint16_t PeerAddress(uint16_t _Index) { return world->PeerAddress(_Index); }
+
+    unsigned long Millis() { return (unsigned long)(LocalUs() / 1000); }
+
+    void Delay(unsigned long _Ms)
+    {
+        localUs = LocalUs() + (uint64_t)_Ms * 1000;
+
+        world->Block(address, localUs);
+    }
+};
@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Downlink buffering for sleeping clients. Frames the gateway sends
+// toward a client that is asleep are held here instead of being written,
+// and go out in one burst when it wakes with a PINGREQ. Each client has a
+// ring of up to DEPTH frames, indexed by its session record. The frames
+// themselves come from one shared pool of FRAMES slots, so a client that
+// holds nothing costs a few octets. A full ring drops its oldest frame to
+// make room. No heap is used.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+#include <mqttSN_transport.h>
+
+
+#define MSN_NO_FRAME 0xffff
+
+
+template<uint16_t CLIENTS, byte DEPTH, uint16_t FRAMES>
+class MSN_DOWNLINK
+{
+
+    static_assert(MSN_SLEEP_FRAME_SZ <= 255, "MSN_SLEEP_FRAME_SZ must fit a 1-octet length");
+
+protected:
+    byte frame[FRAMES][MSN_SLEEP_FRAME_SZ];
+    byte length[FRAMES];
+    uint16_t nextFree[FRAMES];
+    uint16_t freeHead;
+    uint16_t used;
+
+    uint16_t ring[CLIENTS][DEPTH];
+    byte head[CLIENTS];
+    byte count[CLIENTS];
+
+    void Release(uint16_t _Slot)
+    {
+        nextFree[_Slot] = freeHead;
+        freeHead = _Slot;
+        used--;
+    }
+
+public:
+    MSN_DOWNLINK() : freeHead(0), used(0)
+    {
+        for (uint16_t i = 0; i < FRAMES; i++)
+        {
+            nextFree[i] = i + 1 < FRAMES ? i + 1 : MSN_NO_FRAME;
+        }
+
+        for (uint16_t i = 0; i < CLIENTS; i++)
+        {
+            head[i] = 0;
+            count[i] = 0;
+        }
+    };
+
+    // Frames held for every client together.
+    uint16_t Used() const { return used; }
+
+    // Frames held for client _Record.
+    byte Count(uint16_t _Record) const { return count[_Record]; }
+
+    // Holds a copy of _Frame for client _Record. False when the
+    // frame is too long or every slot is taken.
+    bool Push(uint16_t _Record, const void *_Frame, uint16_t _Len)
+    {
+        if (_Len > MSN_SLEEP_FRAME_SZ)
+        {
+            return false;
+        }
+
+        if (count[_Record] == DEPTH)
+        {
+            Pop(_Record);
+        }
+
+        if (freeHead == MSN_NO_FRAME)
+        {
+            return false;
+        }
+
+        uint16_t slot = freeHead;
+
+        freeHead = nextFree[slot];
+        used++;
+
+        memcpy(frame[slot], _Frame, _Len);
+        length[slot] = _Len;
+
+        ring[_Record][(head[_Record] + count[_Record]) % DEPTH] = slot;
+        count[_Record]++;
+
+        return true;
+    }
+
+    // Oldest frame held for client _Record and its length, 0 if none.
+    const byte *Front(uint16_t _Record, uint16_t *_Len) const
+    {
+        if (!count[_Record])
+        {
+            *_Len = 0;
+            return 0;
+        }
+
+        uint16_t slot = ring[_Record][head[_Record]];
+
+        *_Len = length[slot];
+
+        return frame[slot];
+    }
+
+    void Pop(uint16_t _Record)
+    {
+        if (!count[_Record])
+        {
+            return;
+        }
+
+        Release(ring[_Record][head[_Record]]);
+
+        head[_Record] = (head[_Record] + 1) % DEPTH;
+        count[_Record]--;
+    }
+
+    void Clear(uint16_t _Record)
+    {
+        while (count[_Record])
+        {
+            Pop(_Record);
+        }
+    }
+};
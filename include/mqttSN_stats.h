@@ -0,0 +1,324 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Device counters, for finding where the airtime goes. Built with
+// MSN_STATS_ENABLED 1 a gateway or node counts, from inside Loop,
+// Send, SendTo and SendToAll:
+//
+//      frames and octets in and out, by MsgType
+//      writes the link refused, retries and frames given up on, also
+//      for each of the MSN_STATS_DESTS destinations retried most
+//      joins, restarts and address renewals of the link
+//      outbox and QoS window depth, now and at their peak
+//      PUBLISH to final ack round trips, in fixed buckets of ms
+//
+// and gate.Stats() returns them all as an MSN_STATS_SNAPSHOT. Counting
+// is a few increments per frame, with no clock reads beyond the ones
+// Loop makes anyway. Without MSN_STATS_ENABLED every call below is
+// empty and Stats() is all zeros, so nothing is paid for it.
+//
+// On Linux MSN_StatsText writes a snapshot in the Prometheus text
+// format, e.g. for a scrape endpoint or a file the node exporter reads.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+
+#if defined(__linux__)
+#include <stdio.h>
+#endif
+
+
+// MsgTypes 0x00 to 0x1F, and one for any other.
+#define MSN_STATS_TYPES 33
+
+#define MSN_STATS_BUCKETS 11
+
+// Upper bounds of the round trip buckets in ms, the last takes the rest.
+static const uint16_t MSN_STATS_BOUNDS[MSN_STATS_BUCKETS - 1] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000 };
+
+
+struct MSN_STATS_DEST
+{
+    uint16_t address;
+    uint32_t retries;               // frames written to it again
+    uint32_t dropped;               // frames given up on
+};
+
+struct MSN_STATS_SNAPSHOT
+{
+    uint32_t framesIn[MSN_STATS_TYPES];
+    uint32_t framesOut[MSN_STATS_TYPES];
+    uint32_t bytesIn;
+    uint32_t bytesOut;
+
+    uint32_t writeFailures;         // writes the link refused
+    uint32_t retries;               // outbox and QoS retransmissions
+    uint32_t dropped;               // frames given up on
+
+    uint32_t begins;                // Setup joining the network
+    uint32_t restarts;              // joining it again after a lost link
+    uint32_t renewals;              // address renewals
+
+    uint16_t outboxDepth;
+    uint16_t outboxPeak;
+    uint16_t inflightDepth;
+    uint16_t inflightPeak;
+
+    // Acked publishes, by round trip.
+    uint32_t acks;
+    uint32_t ackMsTotal;
+    uint32_t ackBuckets[MSN_STATS_BUCKETS];
+
+    MSN_STATS_DEST destinations[MSN_STATS_DESTS];
+};
+
+
+inline byte MSN_StatsType(byte _MsgType)
+{
+    return _MsgType < MSN_STATS_TYPES - 1 ? _MsgType : MSN_STATS_TYPES - 1;
+}
+
+
+#if MSN_STATS_ENABLED
+
+class MSN_DEVICE_STATS
+{
+
+protected:
+    MSN_STATS_SNAPSHOT s;
+
+    // The destination's entry, or the one retried least,
+    // which it takes over.
+    MSN_STATS_DEST &Destination(uint16_t _Address)
+    {
+        byte least = 0;
+
+        for (byte i = 0; i < MSN_STATS_DESTS; i++)
+        {
+            MSN_STATS_DEST &d = s.destinations[i];
+
+            if (d.address == _Address && (d.retries || d.dropped))
+            {
+                return d;
+            }
+
+            if (d.retries + d.dropped < s.destinations[least].retries + s.destinations[least].dropped)
+            {
+                least = i;
+            }
+        }
+
+        MSN_STATS_DEST &d = s.destinations[least];
+
+        d.address = _Address;
+        d.retries = d.dropped = 0;
+
+        return d;
+    }
+
+public:
+    MSN_DEVICE_STATS() { memset(&s, 0, sizeof(s)); }
+
+    void In(const byte *_Frame, uint16_t _Len)
+    {
+        s.framesIn[MSN_StatsType(MSN_FrameType(_Frame))]++;
+        s.bytesIn += _Len;
+    }
+
+    void Out(const void *_Frame, uint16_t _Len, bool _Written)
+    {
+        if (!_Written)
+        {
+            s.writeFailures++;
+            return;
+        }
+
+        s.framesOut[MSN_StatsType(MSN_FrameType(_Frame))]++;
+        s.bytesOut += _Len;
+    }
+
+    void Retry(uint16_t _To)
+    {
+        s.retries++;
+        Destination(_To).retries++;
+    }
+
+    void Drop(uint16_t _To)
+    {
+        s.dropped++;
+        Destination(_To).dropped++;
+    }
+
+    void Begin() { s.begins++; }
+    void Restart() { s.restarts++; }
+    void Renew() { s.renewals++; }
+
+    void Depth(uint16_t _Outbox, uint16_t _InFlight)
+    {
+        s.outboxDepth = _Outbox;
+        s.inflightDepth = _InFlight;
+        s.outboxPeak = _Outbox > s.outboxPeak ? _Outbox : s.outboxPeak;
+        s.inflightPeak = _InFlight > s.inflightPeak ? _InFlight : s.inflightPeak;
+    }
+
+    void Ack(unsigned long _Ms)
+    {
+        byte b = 0;
+
+        while (b < MSN_STATS_BUCKETS - 1 && _Ms > MSN_STATS_BOUNDS[b])
+        {
+            b++;
+        }
+
+        s.acks++;
+        s.ackMsTotal += _Ms;
+        s.ackBuckets[b]++;
+    }
+
+    const MSN_STATS_SNAPSHOT &Snapshot() const { return s; }
+
+    void Reset() { memset(&s, 0, sizeof(s)); }
+};
+
+#else
+
+// Holds nothing, a device pays one octet for it.
+class MSN_DEVICE_STATS
+{
+
+public:
+    void In(const byte *, uint16_t) {}
+    void Out(const void *, uint16_t, bool) {}
+    void Retry(uint16_t) {}
+    void Drop(uint16_t) {}
+    void Begin() {}
+    void Restart() {}
+    void Renew() {}
+    void Depth(uint16_t, uint16_t) {}
+    void Ack(unsigned long) {}
+
+    const MSN_STATS_SNAPSHOT &Snapshot() const
+    {
+        static const MSN_STATS_SNAPSHOT zero = MSN_STATS_SNAPSHOT();
+
+        return zero;
+    }
+
+    void Reset() {}
+};
+
+#endif
+
+
+#if defined(__linux__)
+
+inline const char *MSN_StatsTypeName(byte _Index)
+{
+    static const char *names[MSN_STATS_TYPES] =
+    {
+        "ADVERTISE", "SEARCHGW", "GWINFO", "0x03", "CONNECT", "CONNACK", "WILLTOPICREQ", "WILLTOPIC",
+        "WILLMSGREQ", "WILLMSG", "REGISTER", "REGACK", "PUBLISH", "PUBACK", "PUBCOMP", "PUBREC",
+        "PUBREL", "0x11", "SUBSCRIBE", "SUBACK", "UNSUBSCRIBE", "UNSUBACK", "PINGREQ", "PINGRESP",
+        "DISCONNECT", "0x19", "WILLTOPICUPD", "WILLTOPICRESP", "WILLMSGUPD", "WILLMSGRESP", "CHUNK", "CHUNKACK",
+        "OTHER"
+    };
+
+    return names[_Index];
+}
+
+// Writes _Stats in the Prometheus text exposition format into _Out,
+// every metric prefixed with _Prefix, e.g. "mqttsn". Returns the
+// length written, or 0 when it does not fit in _Size.
+inline size_t MSN_StatsText(const MSN_STATS_SNAPSHOT &_Stats, const char *_Prefix, char *_Out, size_t _Size)
+{
+    size_t used = 0;
+    bool fits = true;
+
+    #define MSN_STATS_PRINT(...) \
+        do \
+        { \
+            int n = fits ? snprintf(_Out + used, _Size - used, __VA_ARGS__) : 0; \
+            if (n < 0 || (size_t)n >= _Size - used) { fits = false; } else { used += n; } \
+        } while (0)
+
+    MSN_STATS_PRINT("# TYPE %s_frames_total counter\n", _Prefix);
+
+    for (byte i = 0; i < MSN_STATS_TYPES; i++)
+    {
+        if (_Stats.framesIn[i])
+        {
+            MSN_STATS_PRINT("%s_frames_total{dir=\"in\",type=\"%s\"} %u\n", _Prefix, MSN_StatsTypeName(i), _Stats.framesIn[i]);
+        }
+
+        if (_Stats.framesOut[i])
+        {
+            MSN_STATS_PRINT("%s_frames_total{dir=\"out\",type=\"%s\"} %u\n", _Prefix, MSN_StatsTypeName(i), _Stats.framesOut[i]);
+        }
+    }
+
+    MSN_STATS_PRINT("# TYPE %s_bytes_total counter\n", _Prefix);
+    MSN_STATS_PRINT("%s_bytes_total{dir=\"in\"} %u\n", _Prefix, _Stats.bytesIn);
+    MSN_STATS_PRINT("%s_bytes_total{dir=\"out\"} %u\n", _Prefix, _Stats.bytesOut);
+
+    MSN_STATS_PRINT("# TYPE %s_write_failures_total counter\n%s_write_failures_total %u\n", _Prefix, _Prefix, _Stats.writeFailures);
+    MSN_STATS_PRINT("# TYPE %s_retries_total counter\n%s_retries_total %u\n", _Prefix, _Prefix, _Stats.retries);
+    MSN_STATS_PRINT("# TYPE %s_dropped_total counter\n%s_dropped_total %u\n", _Prefix, _Prefix, _Stats.dropped);
+
+    MSN_STATS_PRINT("# TYPE %s_link_events_total counter\n", _Prefix);
+    MSN_STATS_PRINT("%s_link_events_total{event=\"begin\"} %u\n", _Prefix, _Stats.begins);
+    MSN_STATS_PRINT("%s_link_events_total{event=\"restart\"} %u\n", _Prefix, _Stats.restarts);
+    MSN_STATS_PRINT("%s_link_events_total{event=\"renew\"} %u\n", _Prefix, _Stats.renewals);
+
+    MSN_STATS_PRINT("# TYPE %s_queue_depth gauge\n", _Prefix);
+    MSN_STATS_PRINT("%s_queue_depth{queue=\"outbox\"} %u\n", _Prefix, _Stats.outboxDepth);
+    MSN_STATS_PRINT("%s_queue_depth{queue=\"inflight\"} %u\n", _Prefix, _Stats.inflightDepth);
+    MSN_STATS_PRINT("# TYPE %s_queue_peak gauge\n", _Prefix);
+    MSN_STATS_PRINT("%s_queue_peak{queue=\"outbox\"} %u\n", _Prefix, _Stats.outboxPeak);
+    MSN_STATS_PRINT("%s_queue_peak{queue=\"inflight\"} %u\n", _Prefix, _Stats.inflightPeak);
+
+    MSN_STATS_PRINT("# TYPE %s_destination_retries_total counter\n", _Prefix);
+
+    for (byte i = 0; i < MSN_STATS_DESTS; i++)
+    {
+        const MSN_STATS_DEST &d = _Stats.destinations[i];
+
+        if (d.retries || d.dropped)
+        {
+            MSN_STATS_PRINT("%s_destination_retries_total{address=\"%u\"} %u\n", _Prefix, d.address, d.retries);
+        }
+    }
+
+    MSN_STATS_PRINT("# TYPE %s_destination_dropped_total counter\n", _Prefix);
+
+    for (byte i = 0; i < MSN_STATS_DESTS; i++)
+    {
+        const MSN_STATS_DEST &d = _Stats.destinations[i];
+
+        if (d.retries || d.dropped)
+        {
+            MSN_STATS_PRINT("%s_destination_dropped_total{address=\"%u\"} %u\n", _Prefix, d.address, d.dropped);
+        }
+    }
+
+    // Prometheus buckets are cumulative.
+    uint32_t below = 0;
+
+    MSN_STATS_PRINT("# TYPE %s_ack_rtt_ms histogram\n", _Prefix);
+
+    for (byte b = 0; b < MSN_STATS_BUCKETS - 1; b++)
+    {
+        below += _Stats.ackBuckets[b];
+        MSN_STATS_PRINT("%s_ack_rtt_ms_bucket{le=\"%u\"} %u\n", _Prefix, MSN_STATS_BOUNDS[b], below);
+    }
+
+    MSN_STATS_PRINT("%s_ack_rtt_ms_bucket{le=\"+Inf\"} %u\n", _Prefix, _Stats.acks);
+    MSN_STATS_PRINT("%s_ack_rtt_ms_sum %u\n", _Prefix, _Stats.ackMsTotal);
+    MSN_STATS_PRINT("%s_ack_rtt_ms_count %u\n", _Prefix, _Stats.acks);
+
+    #undef MSN_STATS_PRINT
+
+    return fits ? used : 0;
+}
+
+#endif
@@ -0,0 +1,448 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Streamed publishes, for data well past PUBLISH_SZ such as config
+// blobs or waveform captures. The PUBLISH is built in the 3-octet Length
+// form, up to 65535 octets, but never held whole by the sender: its
+// octets are cut into CHUNK frames of at most MSN_STREAM_CHUNK_SZ, the
+// data pulled from a callback as each chunk goes out.
+//
+//      CHUNK       Length, MsgType, MsgId(2), Offset(2), octets of the PUBLISH
+//      CHUNKACK    Length, MsgType, MsgId(2), Next(2), ReturnCode
+//
+// The receiver copies chunks that arrive in order into a buffer the
+// application hands it and acks each with the offset it needs next.
+// Up to MSN_STREAM_WINDOW chunks are unacked at once. When the acks stop
+// for MSN_STREAM_RETRY_MS the sender goes back to the last offset acked.
+// After MAX_RETRY_COUNT tries without progress it pauses, and a resume
+// carries on from that offset, as the receiver keeps what it has for
+// MSN_STREAM_IDLE_MS. The receiver takes one stream at a time and
+// answers other senders RC_REJ_CONGESTED, they wait and try again.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+
+
+// 0x01, Length(2), MsgType, Flags, TopicId(2), MsgId(2).
+#define MSN_STREAM_HEADER_SZ 9
+
+// PUBLISH octets carried by one CHUNK.
+#define MSN_STREAM_CHUNK_DATA (MSN_STREAM_CHUNK_SZ - 6)
+
+static_assert(MSN_STREAM_CHUNK_SZ > 6 + MSN_STREAM_HEADER_SZ && MSN_STREAM_CHUNK_SZ <= 255,
+    "MSN_STREAM_CHUNK_SZ must hold the PUBLISH header and fit a 1-octet Length");
+
+
+// Fills _Out with the _Len octets of data that start _Offset octets
+// into a streamed publish. A chunk sent again asks for the same octets
+// again, so reading must not consume them.
+typedef void (*MSN_STREAM_SOURCE)(uint16_t _Offset, byte *_Out, uint16_t _Len, void *_Context);
+
+// Called once a streamed publish is complete. _Frame is the whole
+// PUBLISH in the 3-octet form, in the buffer given to StreamInto,
+// e.g. MSN_VIEW<MSN_PUBLISH> pub(_Frame, _Len). The receiver tells
+// a repeated first chunk by it until the next stream starts.
+typedef void (*MSN_STREAM_HANDLER)(uint16_t _From, const byte *_Frame, uint16_t _Len, void *_Context);
+
+
+// What a CHUNKACK did to the stream being sent.
+enum MSN_StreamAck
+{
+    SA_NONE = 0,        // not for this stream, or nothing new
+    SA_PROGRESS,        // more of it is acked
+    SA_DONE,            // all of it is acked
+    SA_REJECTED,        // the receiver turned it down for good
+    SA_PAUSED           // the receiver is busy and attempts ran out
+};
+
+
+inline void MSN_ChunkAckFrame(byte *_Out, uint16_t _MsgID, uint16_t _Next, byte _ReturnCode)
+{
+    _Out[0] = 7;
+    _Out[1] = MSN_CHUNKACK;
+    _Out[2] = _MsgID >> 8;
+    _Out[3] = _MsgID & 0xff;
+    _Out[4] = _Next >> 8;
+    _Out[5] = _Next & 0xff;
+    _Out[6] = _ReturnCode;
+}
+
+
+#if MSN_NODE_STREAM
+
+class MSN_STREAM_SENDER
+{
+
+protected:
+    MSN_STREAM_SOURCE source;
+    void *context;
+
+    // Offsets into the PUBLISH frame.
+    uint16_t total;
+    uint16_t acked;
+    uint16_t sent;
+
+    uint16_t msgID;
+    uint16_t nextID;
+    uint16_t topicID;
+    byte flags;
+    byte attempts;
+    bool active;
+    bool paused;
+    bool rewound;
+    unsigned long retryAt;
+    unsigned long holdUntil;
+
+    uint16_t ChunkData() const
+    {
+        return total - sent < MSN_STREAM_CHUNK_DATA ? total - sent : MSN_STREAM_CHUNK_DATA;
+    }
+
+    // Out of attempts, wait for a Resume.
+    bool Attempt(unsigned long _Now)
+    {
+        sent = acked;
+        retryAt = _Now + MSN_STREAM_RETRY_MS;
+        rewound = true;
+
+        if (++attempts >= MAX_RETRY_COUNT)
+        {
+            paused = true;
+            return false;
+        }
+
+        return true;
+    }
+
+public:
+    MSN_STREAM_SENDER() : total(0), acked(0), sent(0), msgID(0), nextID(0), active(false), paused(false) {};
+
+    bool Active() const { return active; }
+    bool Paused() const { return paused; }
+    uint16_t MsgID() const { return msgID; }
+
+    // Octets of the PUBLISH frame in all and received so far.
+    uint16_t Total() const { return total; }
+    uint16_t Acked() const { return acked; }
+
+    // Starts streaming a PUBLISH of _Len data octets. False while
+    // another stream is going or when it would not fit 65535 octets.
+    bool Begin(uint16_t _TopicID, byte _Flags, uint16_t _Len, MSN_STREAM_SOURCE _Source, void *_Context, unsigned long _Now)
+    {
+        if (active || _Len > 0xffff - MSN_STREAM_HEADER_SZ)
+        {
+            return false;
+        }
+
+        if (++nextID == 0)
+        {
+            nextID = 1;
+        }
+
+        source = _Source;
+        context = _Context;
+        total = MSN_STREAM_HEADER_SZ + _Len;
+        acked = sent = 0;
+        msgID = nextID;
+        topicID = _TopicID;
+        flags = _Flags;
+        attempts = 0;
+        active = true;
+        paused = false;
+        rewound = false;
+        retryAt = _Now + MSN_STREAM_RETRY_MS;
+        holdUntil = _Now;
+
+        return true;
+    }
+
+    // Fills _Out with the next CHUNK and returns its length, 0 when
+    // everything is sent or the window is full.
+    uint16_t Chunk(byte *_Out, unsigned long _Now) const
+    {
+        if (!active || paused || sent == total || sent - acked >= MSN_STREAM_WINDOW * MSN_STREAM_CHUNK_DATA ||
+            (long)(_Now - holdUntil) < 0)
+        {
+            return 0;
+        }
+
+        uint16_t len = ChunkData();
+
+        _Out[0] = 6 + len;
+        _Out[1] = MSN_CHUNK;
+        _Out[2] = msgID >> 8;
+        _Out[3] = msgID & 0xff;
+        _Out[4] = sent >> 8;
+        _Out[5] = sent & 0xff;
+
+        byte header[MSN_STREAM_HEADER_SZ] =
+        {
+            0x01, (byte)(total >> 8), (byte)(total & 0xff), MSN_PUBLISH, flags,
+            (byte)(topicID >> 8), (byte)(topicID & 0xff), (byte)(msgID >> 8), (byte)(msgID & 0xff)
+        };
+
+        uint16_t head = 0;
+
+        for (; head < len && sent + head < MSN_STREAM_HEADER_SZ; head++)
+        {
+            _Out[6 + head] = header[sent + head];
+        }
+
+        if (head < len)
+        {
+            source(sent + head - MSN_STREAM_HEADER_SZ, _Out + 6 + head, len - head, context);
+        }
+
+        return 6 + len;
+    }
+
+    // The chunk from Chunk went out.
+    void Sent(unsigned long _Now)
+    {
+        if (sent == acked)
+        {
+            retryAt = _Now + MSN_STREAM_RETRY_MS;
+        }
+
+        sent += ChunkData();
+    }
+
+    MSN_StreamAck Ack(uint16_t _MsgID, uint16_t _Next, byte _ReturnCode, unsigned long _Now)
+    {
+        if (!active || _MsgID != msgID)
+        {
+            return SA_NONE;
+        }
+
+        if (_ReturnCode == RC_REJ_CONGESTED)
+        {
+            holdUntil = _Now + MSN_STREAM_RETRY_MS;
+
+            return Attempt(_Now) ? SA_NONE : SA_PAUSED;
+        }
+
+        if (_ReturnCode != RC_ACCEPTED || _Next > total)
+        {
+            active = false;
+            return SA_REJECTED;
+        }
+
+        if (_Next == 0)
+        {
+            // the receiver lost what it had, start over
+            acked = sent = 0;
+            return SA_NONE;
+        }
+
+        // a late ack, acks can be retried out of order
+        if (_Next < acked)
+        {
+            return SA_NONE;
+        }
+
+        if (_Next == acked)
+        {
+            // the receiver is missing _Next, go back once
+            if (sent > acked && !rewound)
+            {
+                sent = acked;
+                rewound = true;
+            }
+
+            return SA_NONE;
+        }
+
+        acked = _Next;
+        attempts = 0;
+        rewound = false;
+        retryAt = _Now + MSN_STREAM_RETRY_MS;
+
+        if (sent < acked)
+        {
+            sent = acked;
+        }
+
+        if (acked == total)
+        {
+            active = false;
+            return SA_DONE;
+        }
+
+        return SA_PROGRESS;
+    }
+
+    // Goes back to the last acked offset when nothing was acked
+    // for MSN_STREAM_RETRY_MS. True when that was the last attempt, the stream is
+    // paused from then on.
+    bool Expired(unsigned long _Now)
+    {
+        if (!active || paused || (long)(_Now - retryAt) < 0)
+        {
+            return false;
+        }
+
+        return !Attempt(_Now);
+    }
+
+    // Carries on with a paused stream from the last acked offset.
+    bool Resume(unsigned long _Now)
+    {
+        if (!active)
+        {
+            return false;
+        }
+
+        sent = acked;
+        attempts = 0;
+        paused = false;
+        retryAt = _Now + MSN_STREAM_RETRY_MS;
+        holdUntil = _Now;
+
+        return true;
+    }
+
+    // Gives up on the stream.
+    void End() { active = false; }
+};
+
+#else
+
+// Sends nothing, a node built with MSN_NODE_STREAM 0 turns every
+// PublishStream down.
+class MSN_STREAM_SENDER
+{
+
+public:
+    bool Active() const { return false; }
+    bool Paused() const { return false; }
+    uint16_t MsgID() const { return 0; }
+    uint16_t Total() const { return 0; }
+    uint16_t Acked() const { return 0; }
+
+    bool Begin(uint16_t, byte, uint16_t, MSN_STREAM_SOURCE, void *, unsigned long) { return false; }
+    uint16_t Chunk(byte *, unsigned long) const { return 0; }
+    void Sent(unsigned long) {}
+    MSN_StreamAck Ack(uint16_t, uint16_t, byte, unsigned long) { return SA_NONE; }
+    bool Expired(unsigned long) { return false; }
+    bool Resume(unsigned long) { return false; }
+    void End() {}
+};
+
+#endif
+
+
+class MSN_STREAM_RECEIVER
+{
+
+protected:
+    byte *buffer;
+    uint16_t size;
+
+    uint16_t from;
+    uint16_t msgID;
+    uint16_t next;
+    uint16_t total;
+    bool active;
+    bool complete;
+    unsigned long lastSeen;
+
+public:
+    MSN_STREAM_RECEIVER() : buffer(0), size(0), from(0), msgID(0), next(0), total(0), active(false), complete(false) {};
+
+    void Into(byte *_Buffer, uint16_t _Size)
+    {
+        buffer = _Buffer;
+        size = _Size;
+        active = complete = false;
+    }
+
+    bool Active() const { return active; }
+    const byte *Frame() const { return buffer; }
+    uint16_t Length() const { return total; }
+
+    // Takes a CHUNK and returns the ReturnCode of its CHUNKACK, with
+    // the offset to ack in _Next. _Complete is set by the chunk that
+    // completes the PUBLISH, not by ones repeated after it.
+    byte Chunk(uint16_t _From, uint16_t _MsgID, uint16_t _Offset, const byte *_Data, uint16_t _Len,
+        unsigned long _Now, uint16_t *_Next, bool *_Complete)
+    {
+        *_Next = 0;
+        *_Complete = false;
+
+        if (!buffer)
+        {
+            return RC_REJ_NOT_SUP;
+        }
+
+        bool same = from == _From && msgID == _MsgID;
+
+        // the CHUNKACK that completed it was lost and the sender went
+        // back to its last acked offset, for as long as the sender
+        // tries. A sender that restarted counts msgIDs from 1 again, a
+        // first chunk unlike the one taken starts a new stream.
+        if (complete && same && (long)(_Now - lastSeen) < (long)MSN_STREAM_IDLE_MS &&
+            (_Offset != 0 || memcmp(buffer, _Data, _Len < total ? _Len : total) == 0))
+        {
+            *_Next = total;
+            return RC_ACCEPTED;
+        }
+
+        if (active && !same)
+        {
+            if (from != _From && (long)(_Now - lastSeen) < (long)MSN_STREAM_IDLE_MS)
+            {
+                return RC_REJ_CONGESTED;
+            }
+
+            active = false;
+        }
+
+        if (!active)
+        {
+            if (_Offset != 0)
+            {
+                // start over, from the header
+                return RC_ACCEPTED;
+            }
+
+            if (_Len < 4 || _Data[0] != 0x01 || _Data[3] != MSN_PUBLISH)
+            {
+                return RC_REJ_NOT_SUP;
+            }
+
+            uint16_t len = ((uint16_t)_Data[1] << 8) | _Data[2];
+
+            if (len < MSN_STREAM_HEADER_SZ || len > size)
+            {
+                return RC_REJ_NOT_SUP;
+            }
+
+            from = _From;
+            msgID = _MsgID;
+            total = len;
+            next = 0;
+            active = true;
+            complete = false;
+        }
+
+        if (_Offset == next)
+        {
+            uint16_t len = _Len < total - next ? _Len : total - next;
+
+            memcpy(buffer + next, _Data, len);
+            next += len;
+        }
+
+        lastSeen = _Now;
+        *_Next = next;
+
+        if (next == total)
+        {
+            active = false;
+            complete = *_Complete = true;
+        }
+
+        return RC_ACCEPTED;
+    }
+};
@@ -0,0 +1,496 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Gateway side subscription index. Topic filters are kept in a trie
+// with one node per topic level. A node's plain children are found through
+// an open addressing index keyed by (parent, level), and its '+' and '#'
+// children hang off the node itself, so matching a topic name costs a few
+// probes per level and does not depend on how many clients subscribed.
+// Each node holds the list of mesh addresses subscribed to the filter
+// ending there.
+//
+// Subscriptions to a pre-defined topic id skip the trie, they are kept in
+// a map from topic id to address list.
+//
+// Like topic names, trie levels are never removed: a filter nobody uses
+// anymore keeps its nodes and takes them back when it is subscribed again.
+// No heap is used.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+#include <mqttSN_transport.h>
+
+
+#define MSN_NO_SUB 0xffff
+
+
+template<uint16_t NODES, uint16_t ENTRIES, uint16_t IDS, uint16_t ARENA>
+class MSN_SUBSCRIPTIONS
+{
+
+    static_assert(NODES && (NODES & (NODES - 1)) == 0, "subscription nodes must be a power of two");
+    static_assert(IDS && (IDS & (IDS - 1)) == 0, "subscription ids must be a power of two");
+    static_assert(NODES <= 0x4000 && IDS <= 0x4000, "subscription tables must be at most 16384");
+
+    static const uint16_t EDGE_SLOTS = 2 * NODES;
+    static const uint16_t ID_SLOTS = 2 * IDS;
+
+protected:
+    struct NODE
+    {
+        uint16_t parent;
+        uint16_t plus;          // '+' child
+        uint16_t hash;          // '#' child
+        uint16_t subs;          // first ENTRY subscribed here
+        uint16_t labelOffset;
+        uint16_t labelHash;
+        byte labelLength;
+    };
+
+    struct ENTRY
+    {
+        uint16_t address;
+        uint16_t next;
+    };
+
+    // Node 0 is the root, above the first level.
+    NODE nodes[NODES];
+    uint16_t nodeCount;
+
+    uint16_t edges[EDGE_SLOTS];
+
+    char labels[ARENA];
+    uint16_t labelsUsed;
+
+    ENTRY entries[ENTRIES];
+    uint16_t freeEntry;
+
+    uint16_t idKey[ID_SLOTS];
+    uint16_t idSubs[ID_SLOTS];
+    uint16_t idCount;
+
+    static uint16_t Hash(const char *_Label, uint16_t _Len)
+    {
+        uint32_t h = 2166136261u;
+
+        for (uint16_t i = 0; i < _Len; i++)
+        {
+            h = (h ^ (byte)_Label[i]) * 16777619u;
+        }
+
+        return (uint16_t)(h ^ (h >> 16));
+    }
+
+    static uint16_t EdgeSlot(uint16_t _Parent, uint16_t _LabelHash)
+    {
+        return ((uint16_t)(_Parent * 40503u) ^ _LabelHash) & (EDGE_SLOTS - 1);
+    }
+
+    static bool Is(const char *_Label, uint16_t _Len, char _Wildcard)
+    {
+        return _Len == 1 && _Label[0] == _Wildcard;
+    }
+
+    uint16_t NewNode(uint16_t _Parent)
+    {
+        if (nodeCount == NODES)
+        {
+            return MSN_NO_SUB;
+        }
+
+        NODE &n = nodes[nodeCount];
+
+        n.parent = _Parent;
+        n.plus = MSN_NO_SUB;
+        n.hash = MSN_NO_SUB;
+        n.subs = MSN_NO_SUB;
+        n.labelLength = 0;
+
+        return nodeCount++;
+    }
+
+    // Child of _Parent for one level of a filter or topic name,
+    // created when _Create is set. MSN_NO_SUB if there is none.
+    uint16_t Child(uint16_t _Parent, const char *_Label, uint16_t _Len, bool _Create)
+    {
+        if (Is(_Label, _Len, '+') || Is(_Label, _Len, '#'))
+        {
+            uint16_t &child = _Label[0] == '+' ? nodes[_Parent].plus : nodes[_Parent].hash;
+
+            if (child == MSN_NO_SUB && _Create)
+            {
+                child = NewNode(_Parent);
+            }
+
+            return child;
+        }
+
+        uint16_t h = Hash(_Label, _Len);
+        uint16_t i = EdgeSlot(_Parent, h);
+
+        for (; edges[i] != MSN_NO_SUB; i = (i + 1) & (EDGE_SLOTS - 1))
+        {
+            const NODE &n = nodes[edges[i]];
+
+            if (n.parent == _Parent && n.labelHash == h && n.labelLength == _Len &&
+                memcmp(labels + n.labelOffset, _Label, _Len) == 0)
+            {
+                return edges[i];
+            }
+        }
+
+        if (!_Create || ARENA - labelsUsed < _Len)
+        {
+            return MSN_NO_SUB;
+        }
+
+        uint16_t child = NewNode(_Parent);
+
+        if (child == MSN_NO_SUB)
+        {
+            return MSN_NO_SUB;
+        }
+
+        NODE &n = nodes[child];
+
+        memcpy(labels + labelsUsed, _Label, _Len);
+        n.labelOffset = labelsUsed;
+        n.labelLength = _Len;
+        n.labelHash = h;
+        labelsUsed += _Len;
+
+        edges[i] = child;
+
+        return child;
+    }
+
+    // Node a filter ends at, or MSN_NO_SUB when it is not valid
+    // or not there and _Create is clear.
+    uint16_t Walk(const char *_Filter, uint16_t _Len, bool _Create)
+    {
+        if (_Len == 0)
+        {
+            return MSN_NO_SUB;
+        }
+
+        uint16_t node = 0;
+        uint16_t start = 0;
+
+        for (uint16_t i = 0; i <= _Len; i++)
+        {
+            if (i < _Len && _Filter[i] != '/')
+            {
+                continue;
+            }
+
+            const char *label = _Filter + start;
+            uint16_t len = i - start;
+
+            // a wildcard takes a whole level, and '#' only the last one
+            for (uint16_t c = 0; c < len; c++)
+            {
+                if ((label[c] == '+' || label[c] == '#') && len != 1)
+                {
+                    return MSN_NO_SUB;
+                }
+            }
+
+            if (Is(label, len, '#') && i != _Len)
+            {
+                return MSN_NO_SUB;
+            }
+
+            node = Child(node, label, len, _Create);
+
+            if (node == MSN_NO_SUB)
+            {
+                return MSN_NO_SUB;
+            }
+
+            start = i + 1;
+        }
+
+        return node;
+    }
+
+    bool Add(uint16_t &_Head, uint16_t _Address)
+    {
+        for (uint16_t e = _Head; e != MSN_NO_SUB; e = entries[e].next)
+        {
+            if (entries[e].address == _Address)
+            {
+                return true;
+            }
+        }
+
+        if (freeEntry == MSN_NO_SUB)
+        {
+            return false;
+        }
+
+        uint16_t e = freeEntry;
+
+        freeEntry = entries[e].next;
+        entries[e].address = _Address;
+        entries[e].next = _Head;
+        _Head = e;
+
+        return true;
+    }
+
+    bool Drop(uint16_t &_Head, uint16_t _Address)
+    {
+        for (uint16_t *link = &_Head; *link != MSN_NO_SUB; link = &entries[*link].next)
+        {
+            uint16_t e = *link;
+
+            if (entries[e].address == _Address)
+            {
+                *link = entries[e].next;
+                entries[e].next = freeEntry;
+                freeEntry = e;
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Slot of _TopicID in the id map, or the empty slot it would go in.
+    uint16_t IDSlot(uint16_t _TopicID) const
+    {
+        uint16_t i = (uint16_t)(_TopicID * 40503u) & (ID_SLOTS - 1);
+
+        while (idKey[i] != MSN_NO_SUB && idKey[i] != _TopicID)
+        {
+            i = (i + 1) & (ID_SLOTS - 1);
+        }
+
+        return i;
+    }
+
+    static void Emit(uint16_t _Head, const ENTRY *_Entries, uint16_t *_Out, uint16_t _Max, uint16_t &_Count)
+    {
+        for (uint16_t e = _Head; e != MSN_NO_SUB && _Count < _Max; e = _Entries[e].next)
+        {
+            _Out[_Count++] = _Entries[e].address;
+        }
+    }
+
+    // An address can match through more than one filter, sorts
+    // the matches and drops the repeats.
+    static uint16_t Unique(uint16_t *_Out, uint16_t _Count)
+    {
+        for (uint16_t gap = _Count / 2; gap; gap /= 2)
+        {
+            for (uint16_t i = gap; i < _Count; i++)
+            {
+                uint16_t address = _Out[i];
+                uint16_t j = i;
+
+                for (; j >= gap && _Out[j - gap] > address; j -= gap)
+                {
+                    _Out[j] = _Out[j - gap];
+                }
+
+                _Out[j] = address;
+            }
+        }
+
+        uint16_t unique = 0;
+
+        for (uint16_t i = 0; i < _Count; i++)
+        {
+            if (!unique || _Out[unique - 1] != _Out[i])
+            {
+                _Out[unique++] = _Out[i];
+            }
+        }
+
+        return unique;
+    }
+
+    void Match(uint16_t _Node, const uint16_t *_Starts, const uint16_t *_Lengths, const char *_Topic,
+        uint16_t _Level, uint16_t _Levels, uint16_t *_Out, uint16_t _Max, uint16_t &_Count)
+    {
+        const NODE &n = nodes[_Node];
+
+        // '#' also matches the parent level, "a/#" takes "a"
+        if (n.hash != MSN_NO_SUB)
+        {
+            Emit(nodes[n.hash].subs, entries, _Out, _Max, _Count);
+        }
+
+        if (_Level == _Levels)
+        {
+            Emit(n.subs, entries, _Out, _Max, _Count);
+            return;
+        }
+
+        if (n.plus != MSN_NO_SUB)
+        {
+            Match(n.plus, _Starts, _Lengths, _Topic, _Level + 1, _Levels, _Out, _Max, _Count);
+        }
+
+        uint16_t child = Child(_Node, _Topic + _Starts[_Level], _Lengths[_Level], false);
+
+        if (child != MSN_NO_SUB)
+        {
+            Match(child, _Starts, _Lengths, _Topic, _Level + 1, _Levels, _Out, _Max, _Count);
+        }
+    }
+
+public:
+    MSN_SUBSCRIPTIONS() : nodeCount(0), labelsUsed(0), idCount(0)
+    {
+        for (uint16_t i = 0; i < EDGE_SLOTS; i++)
+        {
+            edges[i] = MSN_NO_SUB;
+        }
+
+        for (uint16_t i = 0; i < ENTRIES; i++)
+        {
+            entries[i].next = i + 1 < ENTRIES ? i + 1 : MSN_NO_SUB;
+        }
+
+        freeEntry = 0;
+
+        for (uint16_t i = 0; i < ID_SLOTS; i++)
+        {
+            idKey[i] = MSN_NO_SUB;
+        }
+
+        NewNode(MSN_NO_SUB);
+    };
+
+    // Subscribes _Address to a topic filter, '+' matching one level
+    // and a trailing '#' any number of them. False when the filter is
+    // not valid or the index is full.
+    bool Subscribe(uint16_t _Address, const char *_Filter, uint16_t _Len)
+    {
+        uint16_t node = Walk(_Filter, _Len, true);
+
+        return node != MSN_NO_SUB && Add(nodes[node].subs, _Address);
+    }
+
+    bool Unsubscribe(uint16_t _Address, const char *_Filter, uint16_t _Len)
+    {
+        uint16_t node = Walk(_Filter, _Len, false);
+
+        return node != MSN_NO_SUB && Drop(nodes[node].subs, _Address);
+    }
+
+    // Subscribes _Address to a pre-defined topic id.
+    bool Subscribe(uint16_t _Address, uint16_t _TopicID)
+    {
+        if (_TopicID == MSN_NO_SUB)
+        {
+            return false;
+        }
+
+        uint16_t i = IDSlot(_TopicID);
+
+        if (idKey[i] == MSN_NO_SUB)
+        {
+            // kept at most half full, like the other indexes
+            if (idCount == IDS)
+            {
+                return false;
+            }
+
+            idKey[i] = _TopicID;
+            idSubs[i] = MSN_NO_SUB;
+            idCount++;
+        }
+
+        return Add(idSubs[i], _Address);
+    }
+
+    bool Unsubscribe(uint16_t _Address, uint16_t _TopicID)
+    {
+        uint16_t i = IDSlot(_TopicID);
+
+        return idKey[i] != MSN_NO_SUB && Drop(idSubs[i], _Address);
+    }
+
+    // Drops every subscription of _Address, e.g. on a clean session.
+    void RemoveAll(uint16_t _Address)
+    {
+        for (uint16_t n = 0; n < nodeCount; n++)
+        {
+            Drop(nodes[n].subs, _Address);
+        }
+
+        for (uint16_t i = 0; i < ID_SLOTS; i++)
+        {
+            if (idKey[i] != MSN_NO_SUB)
+            {
+                Drop(idSubs[i], _Address);
+            }
+        }
+    }
+
+    // Writes the addresses subscribed to topic name _Topic into _Out,
+    // in order and each once. Returns how many. Matches past _Max,
+    // repeats included, are dropped.
+    uint16_t Match(const char *_Topic, uint16_t _Len, uint16_t *_Out, uint16_t _Max)
+    {
+        uint16_t starts[MSN_SUB_MAX_LEVELS];
+        uint16_t lengths[MSN_SUB_MAX_LEVELS];
+        uint16_t levels = 0;
+        uint16_t start = 0;
+
+        for (uint16_t i = 0; i <= _Len; i++)
+        {
+            if (i < _Len && _Topic[i] != '/')
+            {
+                continue;
+            }
+
+            if (levels == MSN_SUB_MAX_LEVELS)
+            {
+                return 0;
+            }
+
+            starts[levels] = start;
+            lengths[levels] = i - start;
+            levels++;
+            start = i + 1;
+        }
+
+        uint16_t count = 0;
+
+        // wildcards at the first level do not match topics starting with '$'
+        if (_Len && _Topic[0] == '$')
+        {
+            uint16_t child = Child(0, _Topic, lengths[0], false);
+
+            if (child != MSN_NO_SUB)
+            {
+                Match(child, starts, lengths, _Topic, 1, levels, _Out, _Max, count);
+            }
+
+            return Unique(_Out, count);
+        }
+
+        Match(0, starts, lengths, _Topic, 0, levels, _Out, _Max, count);
+
+        return Unique(_Out, count);
+    }
+
+    // Addresses subscribed to pre-defined topic id _TopicID.
+    uint16_t Match(uint16_t _TopicID, uint16_t *_Out, uint16_t _Max)
+    {
+        uint16_t i = IDSlot(_TopicID);
+        uint16_t count = 0;
+
+        if (idKey[i] != MSN_NO_SUB)
+        {
+            Emit(idSubs[i], entries, _Out, _Max, count);
+        }
+
+        return count;
+    }
+};
@@ -0,0 +1,477 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Threaded transport for Linux hosted gateways. MSN_THREADED_TRANSPORT
+// wraps another transport and gives it a thread of its own that does
+// nothing but service the link: Update, DHCP, reading every frame the
+// radio has and writing the frames the gateway queued. Frames cross
+// between that thread and the thread running Loop through two single
+// producer, single consumer rings, so neither side ever takes a lock and
+// a slow handler only lets the receive ring fill, it never holds up
+// the radio's own FIFO.
+//
+//      DEVICE_TYPE<DT_GATEWAY, MSN_THREADED_TRANSPORT<MSN_RF24_TRANSPORT> > gate(CE_PIN, CSN_PIN);
+//
+// The constructor arguments go to the wrapped transport. Write only
+// queues the frame, it returns false when the ring is full so the
+// outbox retries it. The radio thread tries a frame the link does not
+// take on MSN_RADIO_WRITE_TRIES passes and then drops it. Loop, the
+// handlers and everything else of the gateway, a broker bridge too, run
+// on the one thread that calls Loop. Link with -pthread.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_transport.h>
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <thread>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+#define MSN_CACHE_LINE 64
+
+
+// Fixed ring of frames from one producer thread to one consumer
+// thread. The producer fills the slot Reserve gives it and Commits
+// it, the consumer reads the slot at Front and Pops it, so a frame
+// is copied once on each side of the link at most.
+template<uint16_t SLOTS, uint16_t FRAME_SZ>
+class MSN_SPSC_RING
+{
+
+    static_assert(SLOTS && (SLOTS & (SLOTS - 1)) == 0, "ring slots must be a power of two");
+
+public:
+    struct SLOT
+    {
+        uint16_t address;
+        uint16_t length;
+        byte frame[FRAME_SZ];
+    };
+
+protected:
+    SLOT slot[SLOTS];
+
+    // Each index on its own cache line, beside the
+    // other side's index as last seen.
+    alignas(MSN_CACHE_LINE) std::atomic<uint32_t> head;
+    uint32_t tailSeen;
+
+    alignas(MSN_CACHE_LINE) std::atomic<uint32_t> tail;
+    uint32_t headSeen;
+
+public:
+    MSN_SPSC_RING() : head(0), tailSeen(0), tail(0), headSeen(0) {};
+
+    // Producer: the free slot to fill next, or 0 when the ring is full.
+    SLOT *Reserve()
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+
+        if (t - headSeen == SLOTS)
+        {
+            headSeen = head.load(std::memory_order_acquire);
+
+            if (t - headSeen == SLOTS)
+            {
+                return 0;
+            }
+        }
+
+        return &slot[t & (SLOTS - 1)];
+    }
+
+    // Producer: hands the reserved slot to the consumer.
+    void Commit()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+    }
+
+    // Consumer: the oldest frame, or 0 when the ring is empty.
+    SLOT *Front()
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+
+        if (h == tailSeen)
+        {
+            tailSeen = tail.load(std::memory_order_seq_cst);
+
+            if (h == tailSeen)
+            {
+                return 0;
+            }
+        }
+
+        return &slot[h & (SLOTS - 1)];
+    }
+
+    // Consumer: gives the slot at Front back to the producer.
+    void Pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Frames queued, exact only on the consumer side.
+    uint32_t Count() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+};
+
+
+struct MSN_RADIO_STATS
+{
+    uint32_t received;              // frames read from the link
+    uint32_t overruns;              // read but dropped, the receive ring was full
+    uint32_t written;               // frames the link took
+    uint32_t dropped;               // not taken after MSN_RADIO_WRITE_TRIES passes
+};
+
+
+template<class INNER>
+class MSN_THREADED_TRANSPORT
+{
+
+protected:
+    typedef MSN_SPSC_RING<MSN_RADIO_RX_SLOTS, MAX_PAYLOAD_SIZE> RX_RING;
+    typedef MSN_SPSC_RING<MSN_RADIO_TX_SLOTS, MAX_PAYLOAD_SIZE> TX_RING;
+
+    INNER inner;
+
+    RX_RING rx;
+    TX_RING tx;
+
+    std::thread radio;
+    std::atomic<bool> running;
+    std::atomic<bool> dhcp;
+
+    // Set while the gateway waits in Available, the radio
+    // thread then signals the eventfd after a frame.
+    std::atomic<bool> waiting;
+    int wake;
+
+    std::atomic<uint16_t> peerCount;
+    std::atomic<uint16_t> peers[MSN_RADIO_PEERS];
+
+    std::atomic<uint32_t> received;
+    std::atomic<uint32_t> overruns;
+    std::atomic<uint32_t> written;
+    std::atomic<uint32_t> dropped;
+
+    ////// [ RADIO THREAD ] //////
+
+    void CopyPeers()
+    {
+        uint16_t count = inner.PeerCount();
+
+        if (count > MSN_RADIO_PEERS)
+        {
+            count = MSN_RADIO_PEERS;
+        }
+
+        for (uint16_t i = 0; i < count; i++)
+        {
+            peers[i].store(inner.PeerAddress(i), std::memory_order_relaxed);
+        }
+
+        peerCount.store(count, std::memory_order_release);
+    }
+
+    // Reads everything the link has, true if there was anything.
+    bool Drain()
+    {
+        bool busy = false;
+
+        while (inner.Available())
+        {
+            typename RX_RING::SLOT *s = rx.Reserve();
+
+            busy = true;
+
+            if (!s)
+            {
+                byte discard[MAX_PAYLOAD_SIZE];
+                uint16_t from;
+
+                if (inner.Read(discard, sizeof(discard), &from))
+                {
+                    overruns.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                continue;
+            }
+
+            s->length = inner.Read(s->frame, MAX_PAYLOAD_SIZE, &s->address);
+
+            if (s->length == 0)
+            {
+                continue;
+            }
+
+            rx.Commit();
+            received.fetch_add(1, std::memory_order_relaxed);
+
+            if (waiting.load(std::memory_order_seq_cst) && waiting.exchange(false))
+            {
+                uint64_t one = 1;
+
+                if (write(wake, &one, sizeof(one)) < 0) {}
+            }
+        }
+
+        return busy;
+    }
+
+    // Writes the queued frames until the link refuses one, which
+    // stays at the front for the next pass. True if any went out.
+    bool Flush(byte &_Tries)
+    {
+        bool busy = false;
+
+        while (typename TX_RING::SLOT *s = tx.Front())
+        {
+            if (inner.Write(s->address, s->frame, s->length))
+            {
+                written.fetch_add(1, std::memory_order_relaxed);
+            }
+            else if (++_Tries < MSN_RADIO_WRITE_TRIES)
+            {
+                break;
+            }
+            else
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            _Tries = 0;
+            tx.Pop();
+            busy = true;
+        }
+
+        return busy;
+    }
+
+    void Run()
+    {
+        byte tries = 0;
+        unsigned long peersAt = inner.Millis();
+
+        CopyPeers();
+
+        while (running.load(std::memory_order_acquire))
+        {
+            inner.Update();
+
+            if (dhcp.load(std::memory_order_relaxed))
+            {
+                inner.DHCP();
+            }
+
+            bool busy = Drain();
+
+            busy = Flush(tries) || busy;
+
+            if (inner.Millis() - peersAt >= MSN_RADIO_PEER_MS)
+            {
+                CopyPeers();
+                peersAt = inner.Millis();
+            }
+
+            if (!busy)
+            {
+                timespec ts = { 0, MSN_RADIO_IDLE_US * 1000L };
+
+                nanosleep(&ts, 0);
+            }
+        }
+    }
+
+    void Start()
+    {
+        running.store(true);
+        radio = std::thread(&MSN_THREADED_TRANSPORT::Run, this);
+    }
+
+    void Stop()
+    {
+        if (radio.joinable())
+        {
+            running.store(false);
+            radio.join();
+        }
+    }
+
+public:
+    template<class... ARGS>
+    MSN_THREADED_TRANSPORT(ARGS... _Args)
+        : inner(_Args...), running(false), dhcp(false), waiting(false), peerCount(0),
+          received(0), overruns(0), written(0), dropped(0)
+    {
+        wake = eventfd(0, EFD_NONBLOCK);
+    };
+
+    MSN_THREADED_TRANSPORT(const MSN_THREADED_TRANSPORT&) = delete;
+    MSN_THREADED_TRANSPORT& operator=(const MSN_THREADED_TRANSPORT&) = delete;
+
+    ~MSN_THREADED_TRANSPORT()
+    {
+        Stop();
+
+        if (wake >= 0)
+        {
+            close(wake);
+        }
+    }
+
+    // Begins the wrapped transport on this thread, then starts
+    // the radio thread on it.
+    bool Begin(uint16_t _NodeID)
+    {
+        Stop();
+
+        if (wake < 0 || !inner.Begin(_NodeID))
+        {
+            return false;
+        }
+
+        Start();
+
+        return true;
+    }
+
+    // The calls that reconfigure the link pause the radio thread.
+    bool Restart()
+    {
+        Stop();
+        bool ok = inner.Restart();
+        Start();
+
+        return ok;
+    }
+
+    bool CheckConnection()
+    {
+        Stop();
+        bool ok = inner.CheckConnection();
+        Start();
+
+        return ok;
+    }
+
+    bool RenewAddress()
+    {
+        Stop();
+        bool ok = inner.RenewAddress();
+        Start();
+
+        return ok;
+    }
+
+    // The radio thread services the link.
+    void Update() {}
+
+    // Called by the gateway only, from then on the radio
+    // thread hands out addresses as well.
+    void DHCP() { dhcp.store(true, std::memory_order_relaxed); }
+
+    // Waits up to MSN_RADIO_WAIT_MS for a frame when none is
+    // queued, so Loop sleeps instead of spinning while idle.
+    bool Available()
+    {
+        if (rx.Front())
+        {
+            return true;
+        }
+
+        waiting.store(true, std::memory_order_seq_cst);
+
+        if (rx.Front())
+        {
+            return true;
+        }
+
+        pollfd signalled = { wake, POLLIN, 0 };
+
+        if (poll(&signalled, 1, MSN_RADIO_WAIT_MS) > 0)
+        {
+            uint64_t count;
+
+            if (read(wake, &count, sizeof(count)) < 0) {}
+        }
+
+        waiting.store(false, std::memory_order_relaxed);
+
+        return rx.Front() != 0;
+    }
+
+    uint16_t Read(byte *_Buffer, uint16_t _Size, uint16_t *_From)
+    {
+        typename RX_RING::SLOT *s = rx.Front();
+
+        if (!s)
+        {
+            return 0;
+        }
+
+        uint16_t len = s->length < _Size ? s->length : _Size;
+
+        memcpy(_Buffer, s->frame, len);
+        *_From = s->address;
+
+        rx.Pop();
+
+        return len;
+    }
+
+    // Queues the frame for the radio thread, false when the
+    // ring is full or the frame too long for it.
+    bool Write(uint16_t _To, const void *_Payload, uint16_t _Len)
+    {
+        typename TX_RING::SLOT *s = _Len <= MAX_PAYLOAD_SIZE ? tx.Reserve() : 0;
+
+        if (!s)
+        {
+            return false;
+        }
+
+        s->address = _To;
+        s->length = _Len;
+        memcpy(s->frame, _Payload, _Len);
+
+        tx.Commit();
+
+        return true;
+    }
+
+    // Copy of the wrapped transport's list, at most
+    // MSN_RADIO_PEER_MS old.
+    uint16_t PeerCount() { return peerCount.load(std::memory_order_acquire); }
+
+    uint16_t PeerAddress(uint16_t _Index) { return peers[_Index].load(std::memory_order_relaxed); }
+
+    unsigned long Millis() { return inner.Millis(); }
+
+    void Delay(unsigned long _Ms) { inner.Delay(_Ms); }
+
+    // Frames waiting in each direction.
+    uint32_t RxQueued() const { return rx.Count(); }
+    uint32_t TxQueued() const { return tx.Count(); }
+
+    MSN_RADIO_STATS Stats() const
+    {
+        MSN_RADIO_STATS s;
+
+        s.received = received.load(std::memory_order_relaxed);
+        s.overruns = overruns.load(std::memory_order_relaxed);
+        s.written = written.load(std::memory_order_relaxed);
+        s.dropped = dropped.load(std::memory_order_relaxed);
+
+        return s;
+    }
+};
+
+#endif
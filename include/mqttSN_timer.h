@@ -0,0 +1,356 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Fixed-size timer wheel. Timers are identified by an index in
+// [0, CAPACITY) owned by the caller (an outbox slot, a session ...) and
+// hang off one of BUCKETS intrusive lists chosen by their due tick, so
+// scheduling and cancelling are O(1) and Pop only looks at the buckets
+// the clock has moved across since the last call. MSN_TIMER_HIERARCHY
+// does the same for timeouts many turns of the wheel long, by stacking
+// wheels of coarser ticks. No heap is used.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_transport.h>
+
+
+#define MSN_NO_TIMER 0xffff
+
+
+template<uint16_t CAPACITY, uint16_t BUCKETS, uint16_t TICK_MS>
+class MSN_TIMER_WHEEL
+{
+
+protected:
+    uint16_t head[BUCKETS];
+    uint16_t next[CAPACITY];
+    uint16_t prev[CAPACITY];
+    unsigned long due[CAPACITY];
+    bool armed[CAPACITY];
+
+    unsigned long cursor;
+    bool started;
+
+    void Link(uint16_t _ID)
+    {
+        uint16_t bucket = due[_ID] % BUCKETS;
+
+        prev[_ID] = MSN_NO_TIMER;
+        next[_ID] = head[bucket];
+
+        if (head[bucket] != MSN_NO_TIMER)
+        {
+            prev[head[bucket]] = _ID;
+        }
+
+        head[bucket] = _ID;
+    }
+
+    void Unlink(uint16_t _ID)
+    {
+        if (prev[_ID] != MSN_NO_TIMER)
+        {
+            next[prev[_ID]] = next[_ID];
+        }
+        else
+        {
+            head[due[_ID] % BUCKETS] = next[_ID];
+        }
+
+        if (next[_ID] != MSN_NO_TIMER)
+        {
+            prev[next[_ID]] = prev[_ID];
+        }
+    }
+
+public:
+    MSN_TIMER_WHEEL() : cursor(0), started(false)
+    {
+        for (uint16_t i = 0; i < BUCKETS; i++)
+        {
+            head[i] = MSN_NO_TIMER;
+        }
+
+        for (uint16_t i = 0; i < CAPACITY; i++)
+        {
+            armed[i] = false;
+        }
+    };
+
+    bool Armed(uint16_t _ID) const { return armed[_ID]; }
+
+    // Arms (or re-arms) timer _ID to fire once the clock reaches _AtMs.
+    void Schedule(uint16_t _ID, unsigned long _AtMs)
+    {
+        if (armed[_ID])
+        {
+            Unlink(_ID);
+        }
+
+        due[_ID] = _AtMs / TICK_MS;
+        armed[_ID] = true;
+
+        Link(_ID);
+    }
+
+    void Cancel(uint16_t _ID)
+    {
+        if (armed[_ID])
+        {
+            Unlink(_ID);
+            armed[_ID] = false;
+        }
+    }
+
+    // Returns one timer that is due at _NowMs and disarms it,
+    // MSN_NO_TIMER once none is left. Call until it says so.
+    uint16_t Pop(unsigned long _NowMs)
+    {
+        unsigned long now = _NowMs / TICK_MS;
+
+        if (!started)
+        {
+            cursor = now;
+            started = true;
+        }
+
+        // every bucket is checked against now, so one
+        // revolution covers any gap in calls
+        if ((long)(now - cursor) >= (long)BUCKETS)
+        {
+            cursor = now - BUCKETS + 1;
+        }
+
+        for (;;)
+        {
+            for (uint16_t id = head[cursor % BUCKETS]; id != MSN_NO_TIMER; id = next[id])
+            {
+                if ((long)(due[id] - now) <= 0)
+                {
+                    Unlink(id);
+                    armed[id] = false;
+
+                    return id;
+                }
+            }
+
+            if ((long)(now - cursor) <= 0)
+            {
+                return MSN_NO_TIMER;
+            }
+
+            cursor++;
+        }
+    }
+};
+
+
+// Hierarchical timer wheel for long timeouts, such as keep alives
+// counted in seconds to hours. LEVELS wheels of 64 buckets, a bucket of
+// level n spans 64^n ticks. A timer hangs in the lowest level its
+// distance from the clock fits in and drops a level each time the wheel
+// above turns over, so Pop only touches timers that are due or about to
+// be, however many are armed. A timer never fires before _AtMs.
+template<uint16_t CAPACITY, byte LEVELS, uint16_t TICK_MS>
+class MSN_TIMER_HIERARCHY
+{
+
+    static const byte BITS = 6;
+    static const uint16_t BUCKETS = 1 << BITS;
+    static const uint16_t MASK = BUCKETS - 1;
+    static const unsigned long SPAN = 1UL << (BITS * LEVELS);
+
+    static_assert(LEVELS >= 1 && BITS * LEVELS < 32, "timer hierarchy needs 1 to 5 levels");
+
+protected:
+    uint16_t head[LEVELS * BUCKETS];
+    uint16_t next[CAPACITY];
+    uint16_t prev[CAPACITY];
+    uint16_t bucket[CAPACITY];
+    unsigned long due[CAPACITY];
+    bool armed[CAPACITY];
+    uint16_t count;
+
+    // tick whose level 0 bucket is being emptied
+    unsigned long cursor;
+    bool started;
+
+    uint16_t Bucket(unsigned long _Due) const
+    {
+        unsigned long at = (long)(_Due - cursor) > 0 ? _Due : cursor;
+        unsigned long delta = at - cursor;
+
+        // past the top level, park it as far out as it goes,
+        // it is placed again when that bucket comes round
+        if (delta >= SPAN)
+        {
+            at = cursor + SPAN - 1;
+            delta = SPAN - 1;
+        }
+
+        byte level = 0;
+
+        while (delta >= (1UL << (BITS * (level + 1))))
+        {
+            level++;
+        }
+
+        return level * BUCKETS + ((at >> (BITS * level)) & MASK);
+    }
+
+    void Link(uint16_t _ID)
+    {
+        uint16_t b = Bucket(due[_ID]);
+
+        bucket[_ID] = b;
+        prev[_ID] = MSN_NO_TIMER;
+        next[_ID] = head[b];
+
+        if (head[b] != MSN_NO_TIMER)
+        {
+            prev[head[b]] = _ID;
+        }
+
+        head[b] = _ID;
+    }
+
+    void Unlink(uint16_t _ID)
+    {
+        if (prev[_ID] != MSN_NO_TIMER)
+        {
+            next[prev[_ID]] = next[_ID];
+        }
+        else
+        {
+            head[bucket[_ID]] = next[_ID];
+        }
+
+        if (next[_ID] != MSN_NO_TIMER)
+        {
+            prev[next[_ID]] = prev[_ID];
+        }
+    }
+
+    // The clock moved on to a new tick: every wheel that turned
+    // over hands its current bucket down, top level first.
+    void Cascade()
+    {
+        for (byte level = LEVELS - 1; level > 0; level--)
+        {
+            if (cursor & ((1UL << (BITS * level)) - 1))
+            {
+                continue;
+            }
+
+            uint16_t b = level * BUCKETS + ((cursor >> (BITS * level)) & MASK);
+            uint16_t id = head[b];
+
+            head[b] = MSN_NO_TIMER;
+
+            while (id != MSN_NO_TIMER)
+            {
+                uint16_t after = next[id];
+
+                Link(id);
+                id = after;
+            }
+        }
+    }
+
+    void Start(unsigned long _Now)
+    {
+        if (!started)
+        {
+            cursor = _Now;
+            started = true;
+        }
+    }
+
+public:
+    MSN_TIMER_HIERARCHY() : count(0), cursor(0), started(false)
+    {
+        for (uint16_t i = 0; i < LEVELS * BUCKETS; i++)
+        {
+            head[i] = MSN_NO_TIMER;
+        }
+
+        for (uint16_t i = 0; i < CAPACITY; i++)
+        {
+            armed[i] = false;
+        }
+    };
+
+    bool Armed(uint16_t _ID) const { return armed[_ID]; }
+    uint16_t Count() const { return count; }
+
+    // Arms (or re-arms) timer _ID to fire once the clock, now at
+    // _NowMs, reaches _AtMs.
+    void Schedule(uint16_t _ID, unsigned long _AtMs, unsigned long _NowMs)
+    {
+        Start(_NowMs / TICK_MS);
+
+        if (armed[_ID])
+        {
+            Unlink(_ID);
+            count--;
+        }
+
+        due[_ID] = _AtMs / TICK_MS + (_AtMs % TICK_MS != 0);
+        armed[_ID] = true;
+        count++;
+
+        Link(_ID);
+    }
+
+    void Cancel(uint16_t _ID)
+    {
+        if (armed[_ID])
+        {
+            Unlink(_ID);
+            armed[_ID] = false;
+            count--;
+        }
+    }
+
+    // Returns one timer that is due at _NowMs and disarms it,
+    // MSN_NO_TIMER once none is left. Call until it says so.
+    uint16_t Pop(unsigned long _NowMs)
+    {
+        unsigned long now = _NowMs / TICK_MS;
+
+        Start(now);
+
+        // nothing to hand down, the clock can jump
+        if (!count && (long)(now - cursor) > 0)
+        {
+            cursor = now;
+        }
+
+        for (;;)
+        {
+            if ((long)(now - cursor) < 0)
+            {
+                return MSN_NO_TIMER;
+            }
+
+            uint16_t id = head[cursor & MASK];
+
+            if (id != MSN_NO_TIMER)
+            {
+                Unlink(id);
+                armed[id] = false;
+                count--;
+
+                return id;
+            }
+
+            if (cursor == now)
+            {
+                return MSN_NO_TIMER;
+            }
+
+            cursor++;
+            Cascade();
+        }
+    }
+};
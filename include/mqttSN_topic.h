@@ -0,0 +1,140 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Gateway side topic registry. Topic names are interned once into
+// a fixed arena and get a 16-bit topic id, the same id for every client.
+// ID to name is a direct index into a table of arena offsets, name to ID
+// is an open addressing index of ids keyed by a hash of the name, at most
+// half full and probed linearly. Names live as long as the gateway, so
+// nothing is ever removed and the arena never fragments. No heap is used.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+#include <mqttSN_transport.h>
+
+
+#define MSN_NO_TOPIC 0x0000
+
+static_assert(TOPIC_NAME_SZ <= 255, "TOPIC_NAME_SZ must fit the 1-octet name length of the registry");
+
+
+template<uint16_t CAPACITY, uint16_t ARENA>
+class MSN_TOPIC_REGISTRY
+{
+
+    static_assert(CAPACITY && (CAPACITY & (CAPACITY - 1)) == 0, "topic capacity must be a power of two");
+    static_assert(CAPACITY <= 0x4000, "topic capacity must be at most 16384");
+
+    static const uint16_t SLOTS = 2 * CAPACITY;
+    static const uint16_t MASK = SLOTS - 1;
+
+protected:
+    char arena[ARENA];
+    uint16_t arenaUsed;
+
+    // Topic id n is entry n - 1, ids 0x0000 and 0xFFFF are reserved.
+    uint16_t offset[CAPACITY];
+    byte length[CAPACITY];
+    uint16_t hash[CAPACITY];
+    uint16_t count;
+
+    uint16_t byName[SLOTS];
+
+    static uint16_t Hash(const char *_Name, uint16_t _Len)
+    {
+        uint32_t h = 2166136261u;
+
+        for (uint16_t i = 0; i < _Len; i++)
+        {
+            h = (h ^ (byte)_Name[i]) * 16777619u;
+        }
+
+        return (uint16_t)(h ^ (h >> 16));
+    }
+
+    // Slot in byName holding _Name, or the empty slot it would go in.
+    uint16_t Probe(const char *_Name, uint16_t _Len, uint16_t _Hash) const
+    {
+        uint16_t i = _Hash & MASK;
+
+        for (; byName[i] != MSN_NO_TOPIC; i = (i + 1) & MASK)
+        {
+            uint16_t e = byName[i] - 1;
+
+            if (hash[e] == _Hash && length[e] == _Len && memcmp(arena + offset[e], _Name, _Len) == 0)
+            {
+                break;
+            }
+        }
+
+        return i;
+    }
+
+public:
+    MSN_TOPIC_REGISTRY() : arenaUsed(0), count(0)
+    {
+        for (uint16_t i = 0; i < SLOTS; i++)
+        {
+            byName[i] = MSN_NO_TOPIC;
+        }
+    };
+
+    uint16_t Count() const { return count; }
+
+    // Octets of the arena still free.
+    uint16_t ArenaFree() const { return ARENA - arenaUsed; }
+
+    // Topic id of _Name (_Len octets, not NUL terminated), or MSN_NO_TOPIC.
+    uint16_t Find(const char *_Name, uint16_t _Len) const
+    {
+        return byName[Probe(_Name, _Len, Hash(_Name, _Len))];
+    }
+
+    // Topic id of _Name, interning it first if it is new. MSN_NO_TOPIC
+    // when the name is empty or too long, or the registry is full.
+    uint16_t Register(const char *_Name, uint16_t _Len)
+    {
+        if (_Len == 0 || _Len > TOPIC_NAME_SZ)
+        {
+            return MSN_NO_TOPIC;
+        }
+
+        uint16_t h = Hash(_Name, _Len);
+        uint16_t slot = Probe(_Name, _Len, h);
+
+        if (byName[slot] != MSN_NO_TOPIC)
+        {
+            return byName[slot];
+        }
+
+        if (count == CAPACITY || ARENA - arenaUsed < _Len)
+        {
+            return MSN_NO_TOPIC;
+        }
+
+        memcpy(arena + arenaUsed, _Name, _Len);
+        offset[count] = arenaUsed;
+        length[count] = _Len;
+        hash[count] = h;
+        arenaUsed += _Len;
+
+        byName[slot] = ++count;
+
+        return count;
+    }
+
+    // Name of topic _TopicID and its length, or 0.
+    const char *Name(uint16_t _TopicID, uint16_t *_Len) const
+    {
+        if (_TopicID == MSN_NO_TOPIC || _TopicID > count)
+        {
+            *_Len = 0;
+            return 0;
+        }
+
+        *_Len = length[_TopicID - 1];
+
+        return arena + offset[_TopicID - 1];
+    }
+};
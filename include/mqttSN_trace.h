@@ -0,0 +1,311 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Frame trace, a record of what crossed the link. Built with
+// MSN_TRACE_ENABLED 1 a gateway or node keeps the last MSN_TRACE_RECORDS
+// less one frames Loop took in and Send, SendTo and the retries wrote
+// out, each with its time, direction, the address at the other end
+// and its first MSN_TRACE_SNAP octets, in a fixed ring that overwrites
+// the oldest.
+//
+// Recording is a clock read, a copy of at most MSN_TRACE_SNAP octets
+// and an index bump, with no lock and no allocation, so it can stay on
+// in the field. Only the thread running Loop records. On Linux another
+// thread can read the ring while it does: Record leaves out whatever
+// was overwritten while it was being copied.
+//
+// On Linux MSN_TracePcap writes the ring as a pcap file, each frame in
+// an IPv4 UDP datagram to port 1883, where Wireshark's MQTT-SN
+// dissector picks it up. Mesh address a becomes 10.(a >> 8).(a & 0xff).1.
+//
+//      FILE *file = fopen("mqttsn.pcap", "wb");
+//      MSN_TracePcap(gate.Trace(), gate.Transport().Millis(), file);
+//
+// Without MSN_TRACE_ENABLED nothing is recorded and the ring is empty.
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+
+#if defined(__linux__)
+#include <atomic>
+#include <stdio.h>
+#include <sys/time.h>
+#endif
+
+
+static_assert(MSN_TRACE_RECORDS && (MSN_TRACE_RECORDS & (MSN_TRACE_RECORDS - 1)) == 0,
+    "MSN_TRACE_RECORDS must be a power of two");
+
+
+enum MSN_TraceDirection
+{
+    TD_IN = 0,          // read by Loop
+    TD_OUT,             // taken by the link
+    TD_REFUSED          // written but refused by the link
+};
+
+
+struct MSN_TRACE_RECORD
+{
+    uint32_t time;                  // the transport's Millis
+    uint16_t peer;                  // where it came from or went to
+    uint16_t length;                // octets of the whole frame
+    byte direction;                 // MSN_TraceDirection
+    byte data[MSN_TRACE_SNAP];      // its first octets
+};
+
+
+#if MSN_TRACE_ENABLED
+
+class MSN_DEVICE_TRACE
+{
+
+protected:
+    MSN_TRACE_RECORD ring[MSN_TRACE_RECORDS];
+
+    // Records made so far, the next goes in
+    // ring[head % MSN_TRACE_RECORDS].
+#if defined(__linux__)
+    std::atomic<uint32_t> head;
+#else
+    uint32_t head;
+#endif
+
+    uint16_t self;
+
+    // Whether record _Index is whole while _Head records are made,
+    // the one Add may be in the middle of takes the oldest slot.
+    static bool Kept(uint32_t _Head, uint32_t _Index)
+    {
+        return _Head - _Index - 1 < MSN_TRACE_RECORDS - 1;
+    }
+
+    template<class CLOCK>
+    void Add(CLOCK &_Clock, byte _Direction, uint16_t _Peer, const void *_Frame, uint16_t _Len)
+    {
+#if defined(__linux__)
+        uint32_t h = head.load(std::memory_order_relaxed);
+
+        // readers see the record as overwritten before any of it changes
+        std::atomic_thread_fence(std::memory_order_release);
+#else
+        uint32_t h = head;
+#endif
+
+        MSN_TRACE_RECORD &r = ring[h & (MSN_TRACE_RECORDS - 1)];
+
+        r.time = _Clock.Millis();
+        r.peer = _Peer;
+        r.length = _Len;
+        r.direction = _Direction;
+        memcpy(r.data, _Frame, _Len < MSN_TRACE_SNAP ? _Len : MSN_TRACE_SNAP);
+
+#if defined(__linux__)
+        head.store(h + 1, std::memory_order_release);
+#else
+        head = h + 1;
+#endif
+    }
+
+public:
+    MSN_DEVICE_TRACE() : head(0), self(0) {};
+
+    // The device's own address, the gateway's or the node id.
+    void Begin(uint16_t _Self) { self = _Self; }
+
+    template<class CLOCK>
+    void In(CLOCK &_Clock, uint16_t _From, const byte *_Frame, uint16_t _Len)
+    {
+        Add(_Clock, TD_IN, _From, _Frame, _Len);
+    }
+
+    template<class CLOCK>
+    void Out(CLOCK &_Clock, uint16_t _To, const void *_Frame, uint16_t _Len, bool _Written)
+    {
+        Add(_Clock, _Written ? TD_OUT : TD_REFUSED, _To, _Frame, _Len);
+    }
+
+    uint16_t Self() const { return self; }
+
+    // Records made since the device started. The ring holds the
+    // last MSN_TRACE_RECORDS - 1 of them, the slot of the one before
+    // is where the next record goes.
+    uint32_t Head() const
+    {
+#if defined(__linux__)
+        return head.load(std::memory_order_acquire);
+#else
+        return head;
+#endif
+    }
+
+    // Copies record _Index, counted from 0 like Head, into _Out. False
+    // when it is not in the ring, or was overwritten while copying.
+    bool Record(uint32_t _Index, MSN_TRACE_RECORD *_Out) const
+    {
+        if (!Kept(Head(), _Index))
+        {
+            return false;
+        }
+
+        *_Out = ring[_Index & (MSN_TRACE_RECORDS - 1)];
+
+#if defined(__linux__)
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        return Kept(head.load(std::memory_order_relaxed), _Index);
+#else
+        return true;
+#endif
+    }
+};
+
+#else
+
+// Holds nothing, a device pays one octet for it.
+class MSN_DEVICE_TRACE
+{
+
+public:
+    void Begin(uint16_t) {}
+
+    template<class CLOCK>
+    void In(CLOCK &, uint16_t, const byte *, uint16_t) {}
+
+    template<class CLOCK>
+    void Out(CLOCK &, uint16_t, const void *, uint16_t, bool) {}
+
+    uint16_t Self() const { return 0; }
+    uint32_t Head() const { return 0; }
+    bool Record(uint32_t, MSN_TRACE_RECORD *) const { return false; }
+};
+
+#endif
+
+
+#if defined(__linux__)
+
+// pcap link type for frames that start with an IPv4 header.
+#define MSN_PCAP_LINKTYPE_IPV4 228
+
+// UDP port Wireshark decodes as MQTT-SN.
+#define MSN_PCAP_PORT 1883
+
+// IPv4 and UDP headers in front of each frame.
+#define MSN_PCAP_HEADER_SZ 28
+
+
+inline void MSN_PcapAddress(byte *_Out, uint16_t _Address)
+{
+    _Out[0] = 10;
+    _Out[1] = _Address >> 8;
+    _Out[2] = _Address & 0xff;
+    _Out[3] = 1;
+}
+
+// The IPv4 and UDP headers for a frame of _Len octets from _From to _To.
+inline void MSN_PcapHeaders(byte *_Out, uint16_t _From, uint16_t _To, uint16_t _Len)
+{
+    uint16_t total = MSN_PCAP_HEADER_SZ + _Len;
+
+    byte header[MSN_PCAP_HEADER_SZ] =
+    {
+        0x45, 0, (byte)(total >> 8), (byte)(total & 0xff), 0, 0, 0, 0, 64, 17, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        MSN_PCAP_PORT >> 8, MSN_PCAP_PORT & 0xff, MSN_PCAP_PORT >> 8, MSN_PCAP_PORT & 0xff,
+        (byte)((total - 20) >> 8), (byte)((total - 20) & 0xff), 0, 0
+    };
+
+    MSN_PcapAddress(header + 12, _From);
+    MSN_PcapAddress(header + 16, _To);
+
+    uint32_t sum = 0;
+
+    for (byte i = 0; i < 20; i += 2)
+    {
+        sum += ((uint16_t)header[i] << 8) | header[i + 1];
+    }
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = ~(sum + (sum >> 16)) & 0xffff;
+
+    header[10] = sum >> 8;
+    header[11] = sum & 0xff;
+
+    memcpy(_Out, header, MSN_PCAP_HEADER_SZ);
+}
+
+// Writes the frames in _Trace to _Out as a pcap file, oldest first,
+// each cut to MSN_TRACE_SNAP octets. _Now is the transport's Millis,
+// it dates the records against the wall clock. Frames the link
+// refused never went out and are left out. Returns the frames
+// written, or -1 when writing failed.
+inline int MSN_TracePcap(const MSN_DEVICE_TRACE &_Trace, unsigned long _Now, FILE *_Out)
+{
+    struct
+    {
+        uint32_t magic;
+        uint16_t major;
+        uint16_t minor;
+        int32_t zone;
+        uint32_t sigfigs;
+        uint32_t snaplen;
+        uint32_t linktype;
+    } file = { 0xa1b2c3d4, 2, 4, 0, 0, MSN_PCAP_HEADER_SZ + MSN_TRACE_SNAP, MSN_PCAP_LINKTYPE_IPV4 };
+
+    if (fwrite(&file, sizeof(file), 1, _Out) != 1)
+    {
+        return -1;
+    }
+
+    timeval wall;
+
+    gettimeofday(&wall, 0);
+
+    uint64_t nowUs = (uint64_t)wall.tv_sec * 1000000 + wall.tv_usec;
+    uint32_t head = _Trace.Head();
+    int written = 0;
+
+    for (uint32_t i = head > MSN_TRACE_RECORDS - 1 ? head - (MSN_TRACE_RECORDS - 1) : 0; i != head; i++)
+    {
+        MSN_TRACE_RECORD r;
+
+        if (!_Trace.Record(i, &r) || r.direction == TD_REFUSED)
+        {
+            continue;
+        }
+
+        uint64_t at = nowUs - (uint64_t)(uint32_t)((uint32_t)_Now - r.time) * 1000;
+        uint16_t len = r.length < 0xffff - MSN_PCAP_HEADER_SZ ? r.length : 0xffff - MSN_PCAP_HEADER_SZ;
+        uint16_t kept = len < MSN_TRACE_SNAP ? len : MSN_TRACE_SNAP;
+
+        uint32_t record[4] = { (uint32_t)(at / 1000000), (uint32_t)(at % 1000000),
+            (uint32_t)(MSN_PCAP_HEADER_SZ + kept), (uint32_t)(MSN_PCAP_HEADER_SZ + len) };
+
+        byte frame[MSN_PCAP_HEADER_SZ + MSN_TRACE_SNAP];
+
+        if (r.direction == TD_IN)
+        {
+            MSN_PcapHeaders(frame, r.peer, _Trace.Self(), len);
+        }
+        else
+        {
+            MSN_PcapHeaders(frame, _Trace.Self(), r.peer, len);
+        }
+
+        memcpy(frame + MSN_PCAP_HEADER_SZ, r.data, kept);
+
+        if (fwrite(record, sizeof(record), 1, _Out) != 1 ||
+            fwrite(frame, MSN_PCAP_HEADER_SZ + kept, 1, _Out) != 1)
+        {
+            return -1;
+        }
+
+        written++;
+    }
+
+    return written;
+}
+
+#endif
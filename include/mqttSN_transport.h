@@ -0,0 +1,318 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Transport policies for DEVICE_TYPE. A transport owns the link
+// the MQTT-SN frames travel over and exposes the small set of calls the
+// gateway and node logic need, so the same protocol code runs over an
+// nRF24 mesh on a microcontroller or over UDP sockets on a Linux host.
+//
+// Every transport provides:
+//
+//      bool            Begin(uint16_t _NodeID)     join the network as _NodeID
+//      bool            Restart()                   re-join after a lost link
+//      void            Update()                    service the link
+//      void            DHCP()                      hand out addresses (gateway)
+//      bool            Available()                 a frame is waiting
+//      uint16_t        Read(buf, size, &from)      take the next frame, 0 if none
+//      bool            Write(to, payload, len)     send one frame
+//      bool            CheckConnection()
+//      bool            RenewAddress()
+//      uint16_t        PeerCount()                 nodes known to the gateway
+//      uint16_t        PeerAddress(i)
+//      unsigned long   Millis()                    the transport's clock
+//      void            Delay(unsigned long)
+//
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSN_config.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <string.h>
+typedef uint8_t byte;
+#endif
+
+// RF24Network header type carried by every MQTT-SN frame.
+#define MSN_HEADER_TYPE 'M'
+
+// Logical address of the gateway on every transport.
+#define MSN_GATEWAY_ADDRESS 0
+
+
+#if defined(ARDUINO) || defined(MSN_USE_RF24)
+
+#include <RF24.h>
+#include <RF24Network.h>
+#include <RF24Mesh.h>
+
+////// [ RF24 MESH TRANSPORT ] //////
+class MSN_RF24_TRANSPORT
+{
+
+protected:
+    RF24 radio;
+    RF24Network network;
+    RF24Mesh mesh;
+
+    // _Channels channels MSN_RF24_CHANNEL_STEP apart from channel,
+    // and the one last joined on.
+    byte channel;
+    byte channels;
+    byte joined;
+
+    // Tries the channel last joined on first, then the others.
+    bool Join()
+    {
+        for (byte i = 0; i < channels; i++)
+        {
+            byte next = (joined + i) % channels;
+
+            if (mesh.begin(channel + next * MSN_RF24_CHANNEL_STEP))
+            {
+                joined = next;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+public:
+    // A node given more than one channel joins whichever answers,
+    // e.g. the segments of a multi-radio gateway, see mqttSN_multi.h.
+    MSN_RF24_TRANSPORT(uint16_t _CE_PIN, uint16_t _CSN_PIN, byte _Channel = MSN_RF24_CHANNEL, byte _Channels = 1)
+        : radio(RF24(_CE_PIN, _CSN_PIN)),
+            network(radio), mesh(radio, network),
+            channel(_Channel), channels(_Channels ? _Channels : 1), joined(0) {};
+
+    bool Begin(uint16_t _NodeID)
+    {
+        mesh.setNodeID(_NodeID);
+        return Join();
+    }
+
+    bool Restart() { return Join(); }
+
+    void Update() { mesh.update(); }
+
+    void DHCP() { mesh.DHCP(); }
+
+    bool Available() { return network.available(); }
+
+    uint16_t Read(byte *_Buffer, uint16_t _Size, uint16_t *_From)
+    {
+        RF24NetworkHeader header;
+
+        network.peek(header);
+
+        // Anything that is not MQTT-SN is dropped so it
+        // cannot sit at the head of the queue forever.
+        if (header.type != MSN_HEADER_TYPE)
+        {
+            network.read(header, 0, 0);
+            return 0;
+        }
+
+        uint16_t len = network.read(header, _Buffer, _Size);
+
+        *_From = header.from_node;
+
+        return len;
+    }
+
+    bool Write(uint16_t _To, const void *_Payload, uint16_t _Len)
+    {
+        return mesh.write(_To, _Payload, MSN_HEADER_TYPE, _Len);
+    }
+
+    bool CheckConnection() { return mesh.checkConnection(); }
+
+    bool RenewAddress() { return mesh.renewAddress(); }
+
+    uint16_t PeerCount() { return mesh.addrListTop; }
+
+    uint16_t PeerAddress(uint16_t _Index) { return mesh.addrList[_Index].address; }
+
+    unsigned long Millis() { return millis(); }
+
+    void Delay(unsigned long _Ms) { delay(_Ms); }
+};
+
+#endif
+
+
+#if defined(__linux__)
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+////// [ LINUX UDP TRANSPORT ] //////
+// Each device binds MSN_UDP_BASE_PORT + node id on _Host, so the
+// logical address of a device is simply its node id. The gateway
+// learns the nodes it hears from, which stands in for the mesh
+// address list used by SendToAll.
+class MSN_UDP_TRANSPORT
+{
+
+protected:
+    int sock;
+    uint16_t basePort;
+    uint16_t nodeID;
+    in_addr host;
+
+    uint16_t peers[MSN_UDP_MAX_PEERS];
+    uint16_t peerTop;
+
+    void AddPeer(uint16_t _Address)
+    {
+        for (uint16_t i = 0; i < peerTop; i++)
+        {
+            if (peers[i] == _Address)
+            {
+                return;
+            }
+        }
+
+        if (peerTop < MSN_UDP_MAX_PEERS)
+        {
+            peers[peerTop++] = _Address;
+        }
+    }
+
+public:
+    MSN_UDP_TRANSPORT(uint16_t _BasePort = MSN_UDP_BASE_PORT, const char *_Host = "127.0.0.1")
+        : sock(-1), basePort(_BasePort), nodeID(0), peerTop(0)
+    {
+        inet_pton(AF_INET, _Host, &host);
+    };
+
+    MSN_UDP_TRANSPORT(const MSN_UDP_TRANSPORT&) = delete;
+    MSN_UDP_TRANSPORT& operator=(const MSN_UDP_TRANSPORT&) = delete;
+
+    ~MSN_UDP_TRANSPORT()
+    {
+        if (sock >= 0)
+        {
+            close(sock);
+        }
+    }
+
+    bool Begin(uint16_t _NodeID)
+    {
+        nodeID = _NodeID;
+
+        if (sock >= 0)
+        {
+            close(sock);
+        }
+
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+        if (sock < 0)
+        {
+            return false;
+        }
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr = host;
+        addr.sin_port = htons(basePort + _NodeID);
+
+        if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            close(sock);
+            sock = -1;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Restart() { return Begin(nodeID); }
+
+    void Update() {}
+
+    void DHCP() {}
+
+    bool Available()
+    {
+        byte probe;
+
+        return sock >= 0 && recv(sock, &probe, 1, MSG_PEEK | MSG_DONTWAIT) >= 0;
+    }
+
+    uint16_t Read(byte *_Buffer, uint16_t _Size, uint16_t *_From)
+    {
+        sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+
+        ssize_t len = recvfrom(sock, _Buffer, _Size, MSG_DONTWAIT, (sockaddr*)&addr, &addr_len);
+
+        if (len <= 0)
+        {
+            return 0;
+        }
+
+        *_From = ntohs(addr.sin_port) - basePort;
+
+        if (nodeID == MSN_GATEWAY_ADDRESS)
+        {
+            AddPeer(*_From);
+        }
+
+        return (uint16_t)len;
+    }
+
+    bool Write(uint16_t _To, const void *_Payload, uint16_t _Len)
+    {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr = host;
+        addr.sin_port = htons(basePort + _To);
+
+        return sendto(sock, _Payload, _Len, 0, (sockaddr*)&addr, sizeof(addr)) == (ssize_t)_Len;
+    }
+
+    bool CheckConnection() { return sock >= 0; }
+
+    bool RenewAddress() { return sock >= 0; }
+
+    uint16_t PeerCount() { return peerTop; }
+
+    uint16_t PeerAddress(uint16_t _Index) { return peers[_Index]; }
+
+    unsigned long Millis()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+    }
+
+    void Delay(unsigned long _Ms)
+    {
+        timespec ts;
+        ts.tv_sec = _Ms / 1000;
+        ts.tv_nsec = (_Ms % 1000) * 1000000L;
+
+        nanosleep(&ts, 0);
+    }
+};
+
+#endif
+
+
+// Transport picked when DEVICE_TYPE is declared without one.
+#if defined(ARDUINO) || defined(MSN_USE_RF24)
+typedef MSN_RF24_TRANSPORT MSN_DEFAULT_TRANSPORT;
+#elif defined(__linux__)
+typedef MSN_UDP_TRANSPORT MSN_DEFAULT_TRANSPORT;
+#endif
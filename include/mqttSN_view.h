@@ -0,0 +1,424 @@
+//////////////////////////////////////////////////////////////////////////////////
+// AUTHOR: Blake Merritt
+// ABOUT: Zero-copy, bounds-checked views over a received frame.
+// MSN_VIEW<M_TYPE> checks the Length field, the MsgType and that the
+// fixed fields fit once, when it is built. After that the accessors
+// read straight out of the frame, 2-octet fields most-significant
+// octet first, and variable fields are handed back as a pointer into
+// the frame plus a length (they are not NUL terminated).
+//
+//      MSN_VIEW<MSN_PUBLISH> pub(gate.Received(), gate.ReceivedLength());
+//
+//      if (pub.Valid())
+//      {
+//          use(pub.TopicID(), pub.Data(), pub.DataLength());
+//      }
+//////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <mqttSNmsg.h>
+
+
+// Any MQTT-SN frame: Length field, MsgType and the octets after it.
+class MSN_FRAME_VIEW
+{
+
+protected:
+    const byte *frame;
+    const byte *body;
+    uint16_t length;
+    uint16_t bodyLength;
+    bool valid;
+
+    byte Get8(uint16_t _Offset) const { return body[_Offset]; }
+
+    uint16_t Get16(uint16_t _Offset) const
+    {
+        return ((uint16_t)body[_Offset] << 8) | body[_Offset + 1];
+    }
+
+public:
+    MSN_FRAME_VIEW(const byte *_Frame, uint16_t _Len)
+        : frame(_Frame), body(0), length(0), bodyLength(0), valid(false)
+    {
+        if (_Len < 2)
+        {
+            return;
+        }
+
+        uint16_t header = MSN_HeaderLength(_Frame);
+
+        if (_Len < header + 1)
+        {
+            return;
+        }
+
+        length = MSN_FrameLength(_Frame);
+
+        if (length < header + 1 || length > _Len)
+        {
+            return;
+        }
+
+        body = _Frame + header + 1;
+        bodyLength = length - header - 1;
+        valid = true;
+    };
+
+    bool Valid() const { return valid; }
+
+    byte Type() const { return body[-1]; }
+
+    // Whole frame and its length, Length field included.
+    const byte *Frame() const { return frame; }
+    uint16_t Length() const { return length; }
+
+    // Octets after the MsgType.
+    const byte *Body() const { return body; }
+    uint16_t BodyLength() const { return bodyLength; }
+};
+
+
+// A frame of type M_TYPE carrying at least FIXED octets after the MsgType.
+template<MSN_MsgType M_TYPE, uint16_t FIXED>
+class MSN_TYPED_VIEW : public MSN_FRAME_VIEW
+{
+
+public:
+    MSN_TYPED_VIEW(const byte *_Frame, uint16_t _Len)
+        : MSN_FRAME_VIEW(_Frame, _Len)
+    {
+        valid = valid && body[-1] == M_TYPE && bodyLength >= FIXED;
+    };
+
+protected:
+    // Variable field that starts after the fixed ones.
+    const char *Tail() const { return (const char*)body + FIXED; }
+    uint16_t TailLength() const { return bodyLength - FIXED; }
+};
+
+
+template<MSN_MsgType M_TYPE>
+class MSN_VIEW;
+
+
+template<>
+class MSN_VIEW<MSN_ADVERTISE> : public MSN_TYPED_VIEW<MSN_ADVERTISE, 3>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte GwID() const { return Get8(0); }
+    uint16_t Duration() const { return Get16(1); }
+};
+
+template<>
+class MSN_VIEW<MSN_SEARCHGW> : public MSN_TYPED_VIEW<MSN_SEARCHGW, 1>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte Radius() const { return Get8(0); }
+};
+
+template<>
+class MSN_VIEW<MSN_GWINFO> : public MSN_TYPED_VIEW<MSN_GWINFO, 3>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte GwID() const { return Get8(0); }
+    uint16_t GwAdd() const { return Get16(1); }
+};
+
+template<>
+class MSN_VIEW<MSN_CONNECT> : public MSN_TYPED_VIEW<MSN_CONNECT, 4>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len)
+    {
+        valid = valid && TailLength() <= CLIENT_ID_SZ;
+    };
+
+    byte Flags() const { return Get8(0); }
+    byte ProtoID() const { return Get8(1); }
+    uint16_t Duration() const { return Get16(2); }
+    const char *ClientID() const { return Tail(); }
+    uint16_t ClientIDLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_CONNACK> : public MSN_TYPED_VIEW<MSN_CONNACK, 1>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte ReturnCode() const { return Get8(0); }
+};
+
+template<>
+class MSN_VIEW<MSN_WILLTOPICREQ> : public MSN_TYPED_VIEW<MSN_WILLTOPICREQ, 0>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+};
+
+template<>
+class MSN_VIEW<MSN_WILLTOPIC> : public MSN_TYPED_VIEW<MSN_WILLTOPIC, 1>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte Flags() const { return Get8(0); }
+    const char *WillTopic() const { return Tail(); }
+    uint16_t WillTopicLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_WILLMSGREQ> : public MSN_TYPED_VIEW<MSN_WILLMSGREQ, 0>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+};
+
+template<>
+class MSN_VIEW<MSN_WILLMSG> : public MSN_TYPED_VIEW<MSN_WILLMSG, 0>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    const char *WillMsg() const { return Tail(); }
+    uint16_t WillMsgLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_REGISTER> : public MSN_TYPED_VIEW<MSN_REGISTER, 4>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len)
+    {
+        valid = valid && TailLength() <= TOPIC_NAME_SZ;
+    };
+
+    uint16_t TopicID() const { return Get16(0); }
+    uint16_t MsgID() const { return Get16(2); }
+    const char *TopicName() const { return Tail(); }
+    uint16_t TopicNameLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_REGACK> : public MSN_TYPED_VIEW<MSN_REGACK, 5>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    uint16_t TopicID() const { return Get16(0); }
+    uint16_t MsgID() const { return Get16(2); }
+    byte ReturnCode() const { return Get8(4); }
+};
+
+template<>
+class MSN_VIEW<MSN_PUBLISH> : public MSN_TYPED_VIEW<MSN_PUBLISH, 5>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte Flags() const { return Get8(0); }
+    uint16_t TopicID() const { return Get16(1); }
+    uint16_t MsgID() const { return Get16(3); }
+    const char *Data() const { return Tail(); }
+    uint16_t DataLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_PUBACK> : public MSN_TYPED_VIEW<MSN_PUBACK, 6>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte Flags() const { return Get8(0); }
+    uint16_t TopicID() const { return Get16(1); }
+    uint16_t MsgID() const { return Get16(3); }
+    byte ReturnCode() const { return Get8(5); }
+};
+
+template<>
+class MSN_VIEW<MSN_PUBREC> : public MSN_TYPED_VIEW<MSN_PUBREC, 2>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    uint16_t MsgID() const { return Get16(0); }
+};
+
+template<>
+class MSN_VIEW<MSN_PUBREL> : public MSN_TYPED_VIEW<MSN_PUBREL, 2>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    uint16_t MsgID() const { return Get16(0); }
+};
+
+template<>
+class MSN_VIEW<MSN_PUBCOMP> : public MSN_TYPED_VIEW<MSN_PUBCOMP, 2>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    uint16_t MsgID() const { return Get16(0); }
+};
+
+template<>
+class MSN_VIEW<MSN_SUBSCRIBE> : public MSN_TYPED_VIEW<MSN_SUBSCRIBE, 3>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len)
+    {
+        valid = valid && (HasTopicID() ? TailLength() == 2 : TailLength() <= TOPIC_NAME_SZ);
+    };
+
+    byte Flags() const { return Get8(0); }
+    uint16_t MsgID() const { return Get16(1); }
+
+    // A pre-defined topic id, or else a topic name.
+    bool HasTopicID() const { return (Flags() & TOPIC_ID_TYPE) == PD_TOPIC_ID_ON; }
+    uint16_t TopicID() const { return HasTopicID() ? Get16(3) : 0; }
+    const char *TopicName() const { return Tail(); }
+    uint16_t TopicNameLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_UNSUBSCRIBE> : public MSN_TYPED_VIEW<MSN_UNSUBSCRIBE, 3>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len)
+    {
+        valid = valid && (HasTopicID() ? TailLength() == 2 : TailLength() <= TOPIC_NAME_SZ);
+    };
+
+    byte Flags() const { return Get8(0); }
+    uint16_t MsgID() const { return Get16(1); }
+
+    // A pre-defined topic id, or else a topic name.
+    bool HasTopicID() const { return (Flags() & TOPIC_ID_TYPE) == PD_TOPIC_ID_ON; }
+    uint16_t TopicID() const { return HasTopicID() ? Get16(3) : 0; }
+    const char *TopicName() const { return Tail(); }
+    uint16_t TopicNameLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_SUBACK> : public MSN_TYPED_VIEW<MSN_SUBACK, 6>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte Flags() const { return Get8(0); }
+    uint16_t TopicID() const { return Get16(1); }
+    uint16_t MsgID() const { return Get16(3); }
+    byte ReturnCode() const { return Get8(5); }
+};
+
+template<>
+class MSN_VIEW<MSN_UNSUBACK> : public MSN_TYPED_VIEW<MSN_UNSUBACK, 2>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    uint16_t MsgID() const { return Get16(0); }
+};
+
+template<>
+class MSN_VIEW<MSN_PINGREQ> : public MSN_TYPED_VIEW<MSN_PINGREQ, 0>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len)
+    {
+        valid = valid && TailLength() <= CLIENT_ID_SZ;
+    };
+
+    // Empty unless a sleeping client is asking for its messages.
+    const char *ClientID() const { return Tail(); }
+    uint16_t ClientIDLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_PINGRESP> : public MSN_TYPED_VIEW<MSN_PINGRESP, 0>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+};
+
+template<>
+class MSN_VIEW<MSN_DISCONNECT> : public MSN_TYPED_VIEW<MSN_DISCONNECT, 0>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    // The Duration is only present when the client goes to sleep.
+    bool HasDuration() const { return bodyLength >= 2; }
+    uint16_t Duration() const { return HasDuration() ? Get16(0) : 0; }
+};
+
+template<>
+class MSN_VIEW<MSN_WILLTOPICUPD> : public MSN_TYPED_VIEW<MSN_WILLTOPICUPD, 1>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte Flags() const { return Get8(0); }
+    const char *WillTopic() const { return Tail(); }
+    uint16_t WillTopicLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_WILLMSGUPD> : public MSN_TYPED_VIEW<MSN_WILLMSGUPD, 0>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    const char *WillMsg() const { return Tail(); }
+    uint16_t WillMsgLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_WILLTOPICRESP> : public MSN_TYPED_VIEW<MSN_WILLTOPICRESP, 1>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte ReturnCode() const { return Get8(0); }
+};
+
+template<>
+class MSN_VIEW<MSN_WILLMSGRESP> : public MSN_TYPED_VIEW<MSN_WILLMSGRESP, 1>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    byte ReturnCode() const { return Get8(0); }
+};
+
+template<>
+class MSN_VIEW<MSN_CHUNK> : public MSN_TYPED_VIEW<MSN_CHUNK, 4>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    uint16_t MsgID() const { return Get16(0); }
+    uint16_t Offset() const { return Get16(2); }
+    const byte *Data() const { return body + 4; }
+    uint16_t DataLength() const { return TailLength(); }
+};
+
+template<>
+class MSN_VIEW<MSN_CHUNKACK> : public MSN_TYPED_VIEW<MSN_CHUNKACK, 5>
+{
+public:
+    MSN_VIEW(const byte *_Frame, uint16_t _Len) : MSN_TYPED_VIEW(_Frame, _Len) {};
+
+    uint16_t MsgID() const { return Get16(0); }
+    uint16_t Next() const { return Get16(2); }
+    byte ReturnCode() const { return Get8(4); }
+};
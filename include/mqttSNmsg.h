@@ -9,14 +9,19 @@
 #pragma once
 
 #include <mqttSN_config.h>
-#include <Arduino.h>
-#include <RF24.h>
-#include <RF24Network.h>
-#include <RF24Mesh.h>
+#include <mqttSN_transport.h>
+#include <mqttSN_outbox.h>
+#include <mqttSN_fanout.h>
+#include <mqttSN_session.h>
+#include <mqttSN_keepalive.h>
+#include <mqttSN_sleep.h>
+#include <mqttSN_topic.h>
+#include <mqttSN_subscription.h>
 
-byte msg_type;
-byte data_buffer[MAX_PAYLOAD_SIZE];
-uint16_t from_addr;
+static_assert(MSN_RX_BUFFER_SZ >= 4, "MSN_RX_BUFFER_SZ must hold at least a 3-octet Length and a MsgType");
+
+static_assert(!MSN_NODE_STREAM || (MSN_NODE_OUTBOX && MSN_STREAM_CHUNK_SZ <= MSN_OUTBOX_FRAME_SZ),
+    "a node builds each CHUNK in an outbox slot");
 
 //  [ MQTT SN FLAG FIELDS ]
 // Duplicates 0 if sent first time 1 
@@ -28,6 +33,8 @@ uint16_t from_addr;
 //      QOS_0           0b00000000
 #define QOS_1           0b00000100
 #define QOS_2           0b00000110
+// QoS -1, no session and a pre-defined topic id
+#define QOS_N1          0b00000010
 
 // Retain (PUBLISH)
 //      RET_OFF         0b00000000
@@ -51,6 +58,7 @@ uint16_t from_addr;
 #define PD_TOPIC_ID_ON  0b01000000
 #define TOPIC_NAME      0b10000000
 //      RESERVED        0b11000000
+#define TOPIC_ID_TYPE   0b11000000
 
 
 
@@ -86,292 +94,1915 @@ enum MSN_MsgType
     MSN_WILLTOPICUPD    = 0x1A,
     MSN_WILLTOPICRESP   = 0x1B,
     MSN_WILLMSGUPD      = 0x1C,
-    MSN_WILLMSGRESP     = 0x1D
+    MSN_WILLMSGRESP     = 0x1D,
+
+    // Streamed publishes, mqttSN_stream.h. Not part of the
+    // specification, which leaves these types reserved.
+    MSN_CHUNK           = 0x1E,
+    MSN_CHUNKACK        = 0x1F
+
+};
+
+// One past the highest MsgType, the size of tables indexed by
+// type. Keep it on the last type above when adding one.
+#define MSN_TYPE_COUNT (MSN_CHUNKACK + 1)
+
+
+////// [ MQTT SN MSG RETURN CODES ] //////
+enum MSN_ReturnCode
+{
+    RC_ACCEPTED        = 0x00, // Accepted
+    RC_REJ_CONGESTED   = 0x01, // Rejected - Congested
+    RC_REJ_INV_ID      = 0x02, // Rejected - Invalid ID
+    RC_REJ_NOT_SUP     = 0x03  // Rejected - Not Supportedz
+
+};
+
+enum MSN_DeviceType
+{
+    DT_NODE = 1,
+    DT_GATEWAY
+};
+
+
+
+template <MSN_DeviceType MDT, class TRANSPORT = MSN_DEFAULT_TRANSPORT>
+class DEVICE_TYPE {};
+
+
+template<MSN_MsgType M_TYPE>
+struct MSN_MESSAGE;
+
+
+// Total length of a frame as given by its Length field,
+// either the 1-octet or the 3-octet (0x01, MSB, LSB) form.
+inline uint16_t MSN_FrameLength(const void *_Payload)
+{
+    const byte *frame = (const byte*)_Payload;
+
+    if (frame[0] == 0x01)
+    {
+        return ((uint16_t)frame[1] << 8) | frame[2];
+    }
+
+    return frame[0];
+}
+
+// Octets taken by the Length field of a frame.
+inline uint16_t MSN_HeaderLength(const void *_Payload)
+{
+    return ((const byte*)_Payload)[0] == 0x01 ? 3 : 1;
+}
+
+// MsgType of a frame, which follows the Length field.
+inline byte MSN_FrameType(const void *_Payload)
+{
+    return ((const byte*)_Payload)[MSN_HeaderLength(_Payload)];
+}
+
+
+// Views and the QoS window only need the types above, the
+// devices read received frames through them.
+#include <mqttSN_view.h>
+#include <mqttSN_qos.h>
+#include <mqttSN_stream.h>
+#include <mqttSN_stats.h>
+#include <mqttSN_trace.h>
+
+
+template<class TRANSPORT>
+class DEVICE_TYPE<DT_GATEWAY, TRANSPORT>
+{
+
+protected:
+    TRANSPORT transport;
+
+    // The frame being handled. Each device has its own, so any
+    // number of them can run in one process.
+    byte msg_type;
+    byte data_buffer[MSN_RX_BUFFER_SZ];
+    uint16_t data_length;
+    uint16_t from_addr;
+
+    MSN_OUTBOX<MSN_GATEWAY_OUTBOX> outbox;
+    MSN_SENT_HANDLER sent_handler;
+    void *sent_context;
+
+    MSN_FANOUT<MSN_FANOUT_DESTS, MSN_FANOUT_DEAD> fanout;
+    MSN_FANOUT_HANDLER fanout_handler;
+    void *fanout_context;
+
+    MSN_SESSION_TABLE<MSN_MAX_SESSIONS> sessions;
+    MSN_KEEPALIVE<MSN_MAX_SESSIONS> keepalive;
+    MSN_DOWNLINK<MSN_MAX_SESSIONS, MSN_SLEEP_DEPTH, MSN_SLEEP_FRAMES> downlink;
+    MSN_TOPIC_REGISTRY<MSN_MAX_TOPICS, MSN_TOPIC_ARENA> topics;
+    MSN_SUBSCRIPTIONS<MSN_SUB_NODES, MSN_SUB_ENTRIES, MSN_SUB_IDS, MSN_SUB_ARENA> subscriptions;
+
+    MSN_QOS_WINDOW<MSN_GATEWAY_QOS_SLOTS, MSN_GATEWAY_QOS_FRAME_SZ> inflight;
+    MSN_QOS_RECEIVED<MSN_GATEWAY_QOS_RECEIVED> received;
+    MSN_PUBLISHED_HANDLER published_handler;
+    void *published_context;
+
+    MSN_STREAM_RECEIVER streams;
+    MSN_STREAM_HANDLER stream_handler;
+    void *stream_context;
+
+    MSN_DEVICE_STATS stats;
+    MSN_DEVICE_TRACE trace;
+
+    // Every frame goes out through here, so it is counted and traced.
+    bool Write(uint16_t _To, const void *_Payload, uint16_t _Len)
+    {
+        bool written = transport.Write(_To, _Payload, _Len);
+
+        stats.Out(_Payload, _Len, written);
+        trace.Out(transport, _To, _Payload, _Len, written);
+
+        return written;
+    }
+
+    bool Receive();
+    void Track();
+    bool Answer();
+    void Retransmit();
+    void Republish();
+    void Resend(uint16_t _Slot, unsigned long _Now);
+    void Published(uint16_t _Slot, bool _Delivered, byte _ReturnCode);
+    bool Deliver(const byte *_Frame, uint16_t _Len, uint16_t _ToAddress, uint16_t *_MsgID = 0);
+    void FanOut();
+    void FanOutResult(uint16_t _ToAddress, MSN_FanoutResult _Result);
+    void Supervise();
+    void AnswerWill();
+    void PublishWill(uint16_t _Record);
+    uint16_t Asleep(uint16_t _ToAddress);
+    void Wake(MSN_SESSION *_Session);
+   
+private:
+
+public:
+    // Arguments are handed to the transport, e.g. the CE and
+    // CSN pins for RF24 or the base port for UDP.
+    template<class... ARGS>
+    DEVICE_TYPE(ARGS... _Args) 
+        : transport(_Args...), sent_handler(0), sent_context(0),
+          fanout_handler(0), fanout_context(0),
+          published_handler(0), published_context(0),
+          stream_handler(0), stream_context(0) {};
+    
+    bool Setup();
+    bool SendTo(void *_Payload, uint16_t _ToAddress);
+    bool SendToAll(void *_Payload);
+
+    // The link the frames go over, e.g. for the counters
+    // of a threaded transport.
+    TRANSPORT &Transport() { return transport; }
+
+    // The frame handed to the handler, until the handler returns,
+    // e.g. MSN_VIEW<MSN_PUBLISH> pub(gate.Received(), gate.ReceivedLength()).
+    const byte *Received() const { return data_buffer; }
+    uint16_t ReceivedLength() const { return data_length; }
+
+    // Encode the message and send only the octets it uses.
+    template<MSN_MsgType M_TYPE>
+    bool SendTo(const MSN_MESSAGE<M_TYPE> &_Msg, uint16_t _ToAddress);
+    template<MSN_MsgType M_TYPE>
+    bool SendToAll(const MSN_MESSAGE<M_TYPE> &_Msg);
+
+    // Reports the outcome of each destination of a SendToAll.
+    void OnFanOut(MSN_FANOUT_HANDLER _Handler, void *_Context);
+    bool FanOutActive() const { return fanout.Active(); }
+
+    // Client sessions, opened by CONNECT and kept up to date
+    // by every frame received, e.g. Session(*sender_addr).
+    MSN_SESSION *Session(uint16_t _Address) { return sessions.Find(_Address); }
+    MSN_SESSION_TABLE<MSN_MAX_SESSIONS> &Sessions() { return sessions; }
+
+    // Keep alive timers and wills, by session record.
+    MSN_KEEPALIVE<MSN_MAX_SESSIONS> &KeepAlive() { return keepalive; }
+
+    // Frames held for sleeping clients, by session record.
+    MSN_DOWNLINK<MSN_MAX_SESSIONS, MSN_SLEEP_DEPTH, MSN_SLEEP_FRAMES> &Downlink() { return downlink; }
+
+    // Registered topic names, REGISTER is answered from here.
+    MSN_TOPIC_REGISTRY<MSN_MAX_TOPICS, MSN_TOPIC_ARENA> &Topics() { return topics; }
+
+    // Subscriptions, SUBSCRIBE and UNSUBSCRIBE are answered from here.
+    MSN_SUBSCRIPTIONS<MSN_SUB_NODES, MSN_SUB_ENTRIES, MSN_SUB_IDS, MSN_SUB_ARENA> &Subscriptions() { return subscriptions; }
+
+    // Addresses subscribed to the topic a PUBLISH with _Flags and
+    // _TopicID goes to, at most _Max of them. Returns how many.
+    uint16_t Subscribers(byte _Flags, uint16_t _TopicID, uint16_t *_Out, uint16_t _Max);
+
+    // Sends a PUBLISH frame only to the nodes subscribed to its
+    // topic, returns how many it went to, 0 for frames longer
+    // than MAX_PAYLOAD_SIZE, or at QoS 1 and 2 than
+    // MSN_GATEWAY_QOS_FRAME_SZ.
+    uint16_t SendToSubscribers(void *_Payload);
+
+    // Publishes to one node. At QoS 1 and 2 the message gets the
+    // next msgID, written back into _Msg, and is kept until acked.
+    // False when the window toward the node is full. A node that is
+    // asleep gets it, and its msgID, when it wakes.
+    bool Publish(MSN_MESSAGE<MSN_PUBLISH> &_Msg, uint16_t _ToAddress);
+
+    // Reports the outcome of each QoS 1 and 2 publish.
+    void OnPublished(MSN_PUBLISHED_HANDLER _Handler, void *_Context);
+
+    // Takes streamed publishes, reassembled into _Buffer of _Size
+    // octets one at a time, and hands each whole PUBLISH to
+    // _Handler. Streams are turned down until this is called.
+    void StreamInto(byte *_Buffer, uint16_t _Size, MSN_STREAM_HANDLER _Handler, void *_Context);
+
+    void Loop(void (*event_handler)(byte*, byte*, uint16_t*));
+    void Loop(void (*event_handler)(byte*, byte*, uint16_t*), unsigned long _BlockTime);
+
+    // Hands each frame to the handler HANDLERS registers for its
+    // type, see mqttSN_dispatch.h, together with _Context.
+    template<class HANDLERS>
+    void Loop(void *_Context, unsigned long _BlockTime);
+
+    // Reports the outcome of frames that went to the outbox. A frame
+    // whose client fell asleep meanwhile is held for it instead,
+    // and reported delivered once it is.
+    void OnSent(MSN_SENT_HANDLER _Handler, void *_Context);
+    uint16_t Pending() const { return outbox.Pending(); }
+
+    // Counters kept with MSN_STATS_ENABLED, see mqttSN_stats.h.
+    const MSN_STATS_SNAPSHOT &Stats() const { return stats.Snapshot(); }
+    void ResetStats() { stats.Reset(); }
+
+    // The last frames in and out with MSN_TRACE_ENABLED, see mqttSN_trace.h.
+    const MSN_DEVICE_TRACE &Trace() const { return trace; }
+
+    void Update();
+};
+
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Setup()
+{
+
+    if(!transport.Begin(MSN_GATEWAY_ADDRESS))
+    {
+        return false;
+    }
+
+    stats.Begin();
+    trace.Begin(MSN_GATEWAY_ADDRESS);
+    
+    transport.Update();
+
+    return true;
+
+}
+
+
+// mesh.update needs to be called periodically, normal 
+// use of mqttSN will handle this, but if users have extended
+// delays and or wish to they can call it manually here.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Update()
+{
+    transport.Update();
+    transport.DHCP();
+
+    Retransmit();
+    FanOut();
+    Supervise();
+}
+
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::OnSent(MSN_SENT_HANDLER _Handler, void *_Context)
+{
+    sent_handler = _Handler;
+    sent_context = _Context;
+}
+
+
+// Writes every outbox frame that is due again, and releases
+// the ones that got through or ran out of attempts.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Retransmit()
+{
+    stats.Depth(outbox.Pending(), inflight.Used());
+
+    Republish();
+
+    if (!outbox.Pending())
+    {
+        return;
+    }
+
+    unsigned long now = transport.Millis();
+    uint16_t slot;
+
+    while ((slot = outbox.Due(now)) != MSN_NO_TIMER)
+    {
+        uint16_t record = Asleep(outbox.To(slot));
+        bool sent;
+
+        // the client cannot hear it, it waits for the next PINGREQ
+        if (record != MSN_NO_SESSION)
+        {
+            sent = downlink.Push(record, outbox.Frame(slot), outbox.Length(slot));
+        }
+        else
+        {
+            stats.Retry(outbox.To(slot));
+
+            sent = Write(outbox.To(slot), outbox.Frame(slot), outbox.Length(slot));
+
+            if (!sent && outbox.Retry(slot, now + MSN_RETRY_INTERVAL))
+            {
+                continue;
+            }
+        }
+
+        if (!sent)
+        {
+            stats.Drop(outbox.To(slot));
+        }
+
+        if (sent_handler)
+        {
+            sent_handler(outbox.To(slot), outbox.Frame(slot), sent, sent_context);
+        }
+
+        outbox.Release(slot);
+    }
+}
+
+
+// Sends every unacked publish that is due again, flagged as a
+// duplicate, and gives up on the ones out of attempts.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Republish()
+{
+    if (!inflight.Used())
+    {
+        return;
+    }
+
+    unsigned long now = transport.Millis();
+    uint16_t slot;
+
+    while ((slot = inflight.Due(now)) != MSN_NO_TIMER)
+    {
+        // sent again when the client wakes, see Wake
+        if (Asleep(inflight.To(slot)) != MSN_NO_SESSION)
+        {
+            inflight.Defer(slot, now + MSN_QOS_RETRY_MS);
+            continue;
+        }
+
+        Resend(slot, now);
+    }
+}
+
+
+// Writes the frame in _Slot again, or gives up on it once
+// it is out of attempts.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Resend(uint16_t _Slot, unsigned long _Now)
+{
+    if (!inflight.Retry(_Slot, _Now + MSN_QOS_RETRY_MS))
+    {
+        stats.Drop(inflight.To(_Slot));
+        Published(_Slot, false, 0);
+        return;
+    }
+
+    stats.Retry(inflight.To(_Slot));
+    Write(inflight.To(_Slot), inflight.Frame(_Slot), inflight.Length(_Slot));
+}
+
+
+// Reports the publish in _Slot and frees the slot.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Published(uint16_t _Slot, bool _Delivered, byte _ReturnCode)
+{
+    if (_Delivered)
+    {
+        stats.Ack(transport.Millis() - inflight.Opened(_Slot));
+    }
+
+    if (published_handler)
+    {
+        published_handler(inflight.To(_Slot), inflight.MsgID(_Slot), _Delivered, _ReturnCode, published_context);
+    }
+
+    inflight.Close(_Slot);
+}
+
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::OnPublished(MSN_PUBLISHED_HANDLER _Handler, void *_Context)
+{
+    published_handler = _Handler;
+    published_context = _Context;
+}
+
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::StreamInto(byte *_Buffer, uint16_t _Size, MSN_STREAM_HANDLER _Handler, void *_Context)
+{
+    streams.Into(_Buffer, _Size);
+    stream_handler = _Handler;
+    stream_context = _Context;
+}
+
+
+// Takes the next frame off the transport into data_buffer,
+// false if there was none.
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Receive()
+{
+    data_length = transport.Read(data_buffer, MSN_RX_BUFFER_SZ, &from_addr);
+
+    // too short for its Length field, 3 octets in the long
+    // form, and a MsgType
+    if (data_length < 2 || data_length < MSN_HeaderLength(data_buffer) + 1)
+    {
+        return false;
+    }
+
+    stats.In(data_buffer, data_length);
+    trace.In(transport, from_addr, data_buffer, data_length);
+
+    msg_type = MSN_FrameType(data_buffer);
+
+    fanout.Alive(from_addr);
+
+    Track();
+
+    return Answer();
+}
+
+
+// Requests the gateway answers itself. The frame is still
+// handed to the application afterwards, unless it is a CONNECT
+// that got no session, a QoS 2 PUBLISH seen before or a QoS 1 or
+// 2 PUBLISH turned down, then this is false.
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Answer()
+{
+    if (msg_type == MSN_PINGREQ)
+    {
+        MSN_SESSION *session = sessions.Find(from_addr);
+
+        if (session && session->state == SS_ASLEEP)
+        {
+            Wake(session);
+            return true;
+        }
+
+        byte resp[2] = { 2, MSN_PINGRESP };
+
+        SendTo(resp, from_addr);
+    }
+    else if (msg_type == MSN_CONNECT || msg_type == MSN_WILLTOPIC || msg_type == MSN_WILLMSG ||
+        msg_type == MSN_WILLTOPICUPD || msg_type == MSN_WILLMSGUPD)
+    {
+        if (msg_type == MSN_CONNECT)
+        {
+            MSN_VIEW<MSN_CONNECT> con(data_buffer, data_length);
+
+            // a CONNECT that does not parse, a ClientId too long among
+            // them, or one Track found no room for, the application
+            // must not accept it
+            if (!con.Valid() || !sessions.Find(con.ClientID(), con.ClientIDLength()))
+            {
+                byte ack[3] = { 3, MSN_CONNACK, (byte)(con.Valid() ? RC_REJ_CONGESTED : RC_REJ_NOT_SUP) };
+
+                SendTo(ack, from_addr);
+
+                return false;
+            }
+        }
+
+        AnswerWill();
+    }
+    else if (msg_type == MSN_REGISTER)
+    {
+        MSN_VIEW<MSN_REGISTER> reg(data_buffer, data_length);
+
+        if (!reg.Valid())
+        {
+            return true;
+        }
+
+        uint16_t topic_id = topics.Register(reg.TopicName(), reg.TopicNameLength());
+
+        byte ack[7] =
+        {
+            7, MSN_REGACK,
+            (byte)(topic_id >> 8), (byte)(topic_id & 0xff),
+            (byte)(reg.MsgID() >> 8), (byte)(reg.MsgID() & 0xff),
+            (byte)(topic_id != MSN_NO_TOPIC ? RC_ACCEPTED : RC_REJ_CONGESTED)
+        };
+
+        SendTo(ack, from_addr);
+    }
+    else if (msg_type == MSN_SUBSCRIBE)
+    {
+        MSN_VIEW<MSN_SUBSCRIBE> sub(data_buffer, data_length);
+
+        if (!sub.Valid())
+        {
+            return true;
+        }
+
+        uint16_t topic_id = sub.TopicID();
+        bool accepted;
+
+        if (sub.HasTopicID())
+        {
+            accepted = subscriptions.Subscribe(from_addr, topic_id);
+        }
+        else
+        {
+            accepted = subscriptions.Subscribe(from_addr, sub.TopicName(), sub.TopicNameLength());
+
+            // a name without wildcards gets its topic id back
+            if (accepted && !memchr(sub.TopicName(), '+', sub.TopicNameLength()) &&
+                !memchr(sub.TopicName(), '#', sub.TopicNameLength()))
+            {
+                topic_id = topics.Register(sub.TopicName(), sub.TopicNameLength());
+            }
+        }
+
+        byte ack[8] =
+        {
+            8, MSN_SUBACK, sub.Flags(),
+            (byte)(topic_id >> 8), (byte)(topic_id & 0xff),
+            (byte)(sub.MsgID() >> 8), (byte)(sub.MsgID() & 0xff),
+            (byte)(accepted ? RC_ACCEPTED : RC_REJ_CONGESTED)
+        };
+
+        SendTo(ack, from_addr);
+    }
+    else if (msg_type == MSN_UNSUBSCRIBE)
+    {
+        MSN_VIEW<MSN_UNSUBSCRIBE> unsub(data_buffer, data_length);
+
+        if (!unsub.Valid())
+        {
+            return true;
+        }
+
+        if (unsub.HasTopicID())
+        {
+            subscriptions.Unsubscribe(from_addr, unsub.TopicID());
+        }
+        else
+        {
+            subscriptions.Unsubscribe(from_addr, unsub.TopicName(), unsub.TopicNameLength());
+        }
+
+        byte ack[4] = { 4, MSN_UNSUBACK, (byte)(unsub.MsgID() >> 8), (byte)(unsub.MsgID() & 0xff) };
+
+        SendTo(ack, from_addr);
+    }
+    else if (msg_type == MSN_PUBLISH)
+    {
+        MSN_VIEW<MSN_PUBLISH> pub(data_buffer, data_length);
+        byte qos = pub.Flags() & QOS_MASK;
+
+        // QoS -1 needs no session, only a topic id known in advance
+        if (pub.Valid() && qos == QOS_N1)
+        {
+            return (pub.Flags() & TOPIC_ID_TYPE) == PD_TOPIC_ID_ON;
+        }
+
+        if (!pub.Valid() || (qos != QOS_1 && qos != QOS_2))
+        {
+            return true;
+        }
+
+        uint16_t len;
+        byte rc = (pub.Flags() & TOPIC_ID_TYPE) != 0 || topics.Name(pub.TopicID(), &len) ? RC_ACCEPTED : RC_REJ_INV_ID;
+
+        if (qos == QOS_2 && rc == RC_ACCEPTED)
+        {
+            MSN_QosReceived seen = received.Accept(from_addr, pub.MsgID(), transport.Millis());
+
+            if (seen != QR_FULL)
+            {
+                byte rec[4];
+                MSN_MsgIdFrame(rec, MSN_PUBREC, pub.MsgID());
+
+                SendTo(rec, from_addr);
+
+                return seen == QR_NEW;
+            }
+
+            rc = RC_REJ_CONGESTED;
+        }
+
+        byte ack[8];
+        MSN_PubAckFrame(ack, pub.TopicID(), pub.MsgID(), rc);
+
+        SendTo(ack, from_addr);
+
+        // a publish that was rejected is not delivered
+        return qos == QOS_1 && rc == RC_ACCEPTED;
+    }
+    else if (msg_type == MSN_PUBACK)
+    {
+        MSN_VIEW<MSN_PUBACK> ack(data_buffer, data_length);
+
+        if (!ack.Valid())
+        {
+            return true;
+        }
+
+        // a QoS 2 publish is acked with a PUBACK when it is rejected
+        uint16_t slot = inflight.Find(from_addr, ack.MsgID(), QS_PUBACK);
+
+        if (slot == MSN_NO_TIMER)
+        {
+            slot = inflight.Find(from_addr, ack.MsgID(), QS_PUBREC);
+        }
+
+        if (slot != MSN_NO_TIMER)
+        {
+            Published(slot, true, ack.ReturnCode());
+        }
+    }
+    else if (msg_type == MSN_PUBREC)
+    {
+        MSN_VIEW<MSN_PUBREC> rec(data_buffer, data_length);
+
+        if (!rec.Valid())
+        {
+            return true;
+        }
+
+        uint16_t slot = inflight.Find(from_addr, rec.MsgID(), QS_PUBREC);
+
+        if (slot != MSN_NO_TIMER)
+        {
+            inflight.Release(slot, transport.Millis() + MSN_QOS_RETRY_MS);
+        }
+        else
+        {
+            // the PUBREL went out already, the receiver did not get it
+            slot = inflight.Find(from_addr, rec.MsgID(), QS_PUBCOMP);
+        }
+
+        if (slot != MSN_NO_TIMER)
+        {
+            Write(from_addr, inflight.Frame(slot), inflight.Length(slot));
+        }
+    }
+    else if (msg_type == MSN_PUBREL)
+    {
+        MSN_VIEW<MSN_PUBREL> rel(data_buffer, data_length);
+
+        if (!rel.Valid())
+        {
+            return true;
+        }
+
+        received.Release(from_addr, rel.MsgID());
+
+        byte comp[4];
+        MSN_MsgIdFrame(comp, MSN_PUBCOMP, rel.MsgID());
+
+        SendTo(comp, from_addr);
+    }
+    else if (msg_type == MSN_PUBCOMP)
+    {
+        MSN_VIEW<MSN_PUBCOMP> comp(data_buffer, data_length);
+
+        if (!comp.Valid())
+        {
+            return true;
+        }
+
+        uint16_t slot = inflight.Find(from_addr, comp.MsgID(), QS_PUBCOMP);
+
+        if (slot != MSN_NO_TIMER)
+        {
+            Published(slot, true, RC_ACCEPTED);
+        }
+    }
+    else if (msg_type == MSN_CHUNK)
+    {
+        MSN_VIEW<MSN_CHUNK> chunk(data_buffer, data_length);
+
+        if (!chunk.Valid())
+        {
+            return false;
+        }
+
+        uint16_t next;
+        bool complete;
+        byte rc = streams.Chunk(from_addr, chunk.MsgID(), chunk.Offset(), chunk.Data(), chunk.DataLength(),
+            transport.Millis(), &next, &complete);
+
+        byte ack[7];
+        MSN_ChunkAckFrame(ack, chunk.MsgID(), next, rc);
+
+        SendTo(ack, from_addr);
+
+        if (complete && stream_handler)
+        {
+            stream_handler(from_addr, streams.Frame(), streams.Length(), stream_context);
+        }
+
+        // the application gets the whole PUBLISH instead
+        return false;
+    }
+
+    return true;
+}
+
+
+template<class TRANSPORT>
+uint16_t DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Subscribers(byte _Flags, uint16_t _TopicID, uint16_t *_Out, uint16_t _Max)
+{
+    if ((_Flags & TOPIC_ID_TYPE) == PD_TOPIC_ID_ON)
+    {
+        return subscriptions.Match(_TopicID, _Out, _Max);
+    }
+
+    uint16_t len;
+    const char *name = topics.Name(_TopicID, &len);
+
+    return name ? subscriptions.Match(name, len, _Out, _Max) : 0;
+}
+
+
+// Registered topic ids are the same for every client, so the
+// frame goes out unchanged.
+template<class TRANSPORT>
+uint16_t DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::SendToSubscribers(void *_Payload)
+{
+    uint16_t len = MSN_FrameLength(_Payload);
+    MSN_VIEW<MSN_PUBLISH> pub((const byte*)_Payload, len);
+
+    const byte *frame = (const byte*)_Payload;
+    byte copy[MAX_PAYLOAD_SIZE];
+
+    // a 3-octet Length can claim more than any link carries
+    if (!pub.Valid() || len > sizeof(copy))
+    {
+        return 0;
+    }
+
+    byte qos = pub.Flags() & QOS_MASK;
+
+    // nor may a QoS 1 or 2 frame outgrow an in-flight slot, no
+    // subscriber would ever get it
+    if ((qos == QOS_1 || qos == QOS_2) && !inflight.Fits(len))
+    {
+        return 0;
+    }
+
+    uint16_t to[MSN_FANOUT_DESTS];
+    uint16_t count = Subscribers(pub.Flags(), pub.TopicID(), to, MSN_FANOUT_DESTS);
+
+    // QoS -1 only goes from a client to the gateway, it is
+    // passed on to the subscribers at QoS 0
+    if (qos == QOS_N1)
+    {
+        memcpy(copy, _Payload, len);
+        copy[MSN_HeaderLength(copy) + 1] &= ~QOS_MASK;
+        frame = copy;
+    }
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        Deliver(frame, len, to[i]);
+    }
+
+    return count;
+}
+
+
+// Sends a PUBLISH frame to one node. QoS 1 and 2 frames go through
+// the in-flight window under a msgID of their own, the rest through
+// SendTo. False when the window toward the node is full.
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Deliver(const byte *_Frame, uint16_t _Len, uint16_t _ToAddress, uint16_t *_MsgID)
+{
+    byte qos = _Frame[MSN_HeaderLength(_Frame) + 1] & QOS_MASK;
+
+    if (qos != QOS_1 && qos != QOS_2)
+    {
+        return SendTo((void*)_Frame, _ToAddress);
+    }
+
+    // held as it is, it gets its msgID when the client wakes
+    uint16_t record = Asleep(_ToAddress);
+
+    if (record != MSN_NO_SESSION)
+    {
+        return downlink.Push(record, _Frame, _Len);
+    }
+
+    uint16_t slot = inflight.Open(_ToAddress, _Frame, _Len, qos == QOS_2 ? QS_PUBREC : QS_PUBACK,
+        transport.Millis() + MSN_QOS_RETRY_MS);
+
+    if (slot == MSN_NO_TIMER)
+    {
+        return false;
+    }
+
+    if (_MsgID)
+    {
+        *_MsgID = inflight.MsgID(slot);
+    }
+
+    Write(_ToAddress, inflight.Frame(slot), inflight.Length(slot));
+
+    return true;
+}
+
+
+// Session bookkeeping for the frame in data_buffer, before it
+// is handed to the application.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Track()
+{
+    unsigned long now = transport.Millis();
+
+    if (msg_type == MSN_CONNECT)
+    {
+        MSN_VIEW<MSN_CONNECT> con(data_buffer, data_length);
+
+        if (con.Valid())
+        {
+            MSN_SESSION *last = sessions.Find(from_addr);
+
+            // subscriptions go by address, they are dropped for a clean
+            // session or another client taking over the address
+            bool clean = (con.Flags() & CLEAN_ON) || !last ||
+                strncmp(last->clientID, con.ClientID(), con.ClientIDLength()) != 0 ||
+                last->clientID[con.ClientIDLength()] != 0;
+
+            bool known = sessions.Find(con.ClientID(), con.ClientIDLength()) != 0;
+
+            // a full table hands the Idle session over, unless the
+            // session at this address makes room
+            MSN_SESSION *idle = known || last || sessions.Count() < sessions.Capacity() ? 0 : sessions.Idle();
+            uint16_t idle_addr = idle ? idle->address : from_addr;
+
+            MSN_SESSION *session = sessions.Connect(from_addr, con.ClientID(), con.ClientIDLength(), con.Flags(), con.Duration(), now);
+
+            if (session)
+            {
+                uint16_t record = sessions.Record(session);
+
+                // only once it has a session, a CONNECT turned down
+                // leaves the old one as it was
+                if (clean)
+                {
+                    subscriptions.RemoveAll(from_addr);
+                }
+
+                // the subscriptions of the session handed over go with it
+                if (idle_addr != from_addr)
+                {
+                    subscriptions.RemoveAll(idle_addr);
+                }
+
+                // a will, if any, follows in WILLTOPIC and WILLMSG
+                keepalive.ClearWill(record);
+                keepalive.Watch(record, now, con.Duration(), now);
+
+                // frames held for a client that slept are kept for
+                // its next PINGREQ, unless it starts over
+                if (!known || (con.Flags() & CLEAN_ON))
+                {
+                    downlink.Clear(record);
+                }
+            }
+        }
+
+        return;
+    }
+
+    MSN_SESSION *session = sessions.Find(from_addr);
+
+    if (!session)
+    {
+        return;
+    }
+
+    session->lastSeen = now;
+
+    if (msg_type == MSN_DISCONNECT)
+    {
+        MSN_VIEW<MSN_DISCONNECT> disc(data_buffer, data_length);
+
+        uint16_t record = sessions.Record(session);
+
+        // MSN_MESSAGE<MSN_DISCONNECT> always carries a Duration,
+        // 0 for a client that leaves rather than sleeps
+        if (disc.Valid() && disc.Duration() != 0)
+        {
+            session->state = SS_ASLEEP;
+            session->duration = disc.Duration();
+
+            keepalive.Watch(record, now, disc.Duration(), now);
+        }
+        else if (disc.Valid())
+        {
+            // a client that says goodbye leaves no will
+            session->state = SS_DISCONNECTED;
+
+            keepalive.Stop(record);
+            keepalive.ClearWill(record);
+            downlink.Clear(record);
+        }
+    }
+}
+
+
+// The will exchange: WILLTOPICREQ after a CONNECT with WILL_ON,
+// WILLMSGREQ after the WILLTOPIC, and the two updates.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::AnswerWill()
+{
+    MSN_SESSION *session = sessions.Find(from_addr);
+
+    if (!session)
+    {
+        return;
+    }
+
+    uint16_t record = sessions.Record(session);
+
+    if (msg_type == MSN_CONNECT)
+    {
+        if (session->flags & WILL_ON)
+        {
+            byte req[2] = { 2, MSN_WILLTOPICREQ };
+
+            SendTo(req, from_addr);
+        }
+    }
+    else if (msg_type == MSN_WILLTOPIC || msg_type == MSN_WILLTOPICUPD)
+    {
+        MSN_FRAME_VIEW frame(data_buffer, data_length);
+
+        if (!frame.Valid())
+        {
+            return;
+        }
+
+        // an empty WILLTOPIC or WILLTOPICUPD takes the will away
+        if (frame.BodyLength() == 0)
+        {
+            keepalive.ClearWill(record);
+        }
+        else
+        {
+            keepalive.SetWillTopic(record, frame.Body()[0], (const char*)frame.Body() + 1, frame.BodyLength() - 1);
+        }
+
+        if (msg_type == MSN_WILLTOPICUPD)
+        {
+            byte ack[3] = { 3, MSN_WILLTOPICRESP, RC_ACCEPTED };
+
+            SendTo(ack, from_addr);
+        }
+        else if (frame.BodyLength())
+        {
+            byte req[2] = { 2, MSN_WILLMSGREQ };
+
+            SendTo(req, from_addr);
+        }
+    }
+    else if (msg_type == MSN_WILLMSG || msg_type == MSN_WILLMSGUPD)
+    {
+        MSN_FRAME_VIEW frame(data_buffer, data_length);
+
+        if (!frame.Valid())
+        {
+            return;
+        }
+
+        keepalive.SetWillMsg(record, (const char*)frame.Body(), frame.BodyLength());
+
+        if (msg_type == MSN_WILLMSGUPD)
+        {
+            byte ack[3] = { 3, MSN_WILLMSGRESP, RC_ACCEPTED };
+
+            SendTo(ack, from_addr);
+        }
+    }
+}
+
+
+// Marks the clients whose keep alive ran out as lost and
+// publishes their wills. Timers of clients heard from since
+// they were set are set again from lastSeen.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Supervise()
+{
+    unsigned long now = transport.Millis();
+    uint16_t record;
+
+    while ((record = keepalive.Due(now)) != MSN_NO_TIMER)
+    {
+        MSN_SESSION *session = sessions.At(record);
+
+        if (!session || session->state == SS_DISCONNECTED || session->state == SS_LOST)
+        {
+            continue;
+        }
+
+        if ((long)(now - (session->lastSeen + keepalive.Grace(session->duration))) < 0)
+        {
+            keepalive.Watch(record, session->lastSeen, session->duration, now);
+            continue;
+        }
+
+        session->state = SS_LOST;
+
+        downlink.Clear(record);
+        PublishWill(record);
+    }
+}
+
+
+// Sends the will of session _Record to the subscribers of its
+// topic, as a PUBLISH with the QoS and retain it was left with.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::PublishWill(uint16_t _Record)
+{
+    MSN_WILL &will = keepalive.Will(_Record);
+
+    if (!will.topicLength)
+    {
+        return;
+    }
+
+    uint16_t topic_id = topics.Register(will.topic, will.topicLength);
+
+    if (topic_id == MSN_NO_TOPIC)
+    {
+        return;
+    }
+
+    byte frame[7 + WILL_MSG_SZ] =
+    {
+        (byte)(7 + will.msgLength), MSN_PUBLISH,
+        (byte)(will.flags & (QOS_MASK | RET_ON)),
+        (byte)(topic_id >> 8), (byte)(topic_id & 0xff),
+        0x00, 0x00
+    };
+
+    memcpy(frame + 7, will.msg, will.msgLength);
+
+    keepalive.ClearWill(_Record);
+
+    SendToSubscribers(frame);
+}
+
+
+// Session record of _ToAddress if its client is asleep and frames
+// toward it are to be held, MSN_NO_SESSION otherwise.
+template<class TRANSPORT>
+uint16_t DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Asleep(uint16_t _ToAddress)
+{
+    MSN_SESSION *session = sessions.Find(_ToAddress);
+
+    return session && session->state == SS_ASLEEP ? sessions.Record(session) : MSN_NO_SESSION;
+}
+
+
+// A sleeping client sent PINGREQ: the publishes still unacked
+// toward it and everything held for it go out now, the PINGRESP
+// after them sends it back to sleep.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Wake(MSN_SESSION *_Session)
+{
+    uint16_t record = sessions.Record(_Session);
+    uint16_t len;
+    const byte *frame;
+    unsigned long now = transport.Millis();
+
+    _Session->state = SS_AWAKE;
+
+    for (uint16_t slot = 0; (slot = inflight.Next(_Session->address, slot)) != MSN_NO_TIMER; slot++)
+    {
+        Resend(slot, now);
+    }
+
+    while ((frame = downlink.Front(record, &len)) != 0)
+    {
+        bool sent = MSN_FrameType(frame) == MSN_PUBLISH ? Deliver(frame, len, _Session->address) : SendTo((void*)frame, _Session->address);
+
+        // no room in the QoS window, the rest waits for the next PINGREQ
+        if (!sent)
+        {
+            break;
+        }
+
+        downlink.Pop(record);
+    }
+
+    byte resp[2] = { 2, MSN_PINGRESP };
+
+    SendTo(resp, _Session->address);
+
+    _Session->state = SS_ASLEEP;
+}
+
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Loop(void (*event_handler)(byte*, byte*, uint16_t*))
+{
+
+    while(1)
+    {
+        transport.Update();
+        transport.DHCP();
+
+        Retransmit();
+        FanOut();
+        Supervise();
+
+        while (transport.Available())
+        {
+            if (Receive())
+            {
+                event_handler(&msg_type, data_buffer, &from_addr);
+            }
+         
+        }
+        
+    }
+    
+}
+
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Loop(void (*event_handler)(byte*, byte*, uint16_t*), unsigned long _BlockTime)
+{
+
+    unsigned long start_time = transport.Millis();
+
+    do
+    {
+        transport.Update();
+        transport.DHCP();
+
+        Retransmit();
+        FanOut();
+        Supervise();
+
+        while (transport.Available())
+        {
+            if (Receive())
+            {
+                event_handler(&msg_type, data_buffer, &from_addr);
+            }
+            
+        }
+
+    } while (transport.Millis() - start_time < _BlockTime);
+    
+}
+
+
+template<class TRANSPORT>
+template<class HANDLERS>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Loop(void *_Context, unsigned long _BlockTime)
+{
+
+    unsigned long start_time = transport.Millis();
+
+    do
+    {
+        transport.Update();
+        transport.DHCP();
+
+        Retransmit();
+        FanOut();
+        Supervise();
+
+        while (transport.Available())
+        {
+            if (Receive())
+            {
+                HANDLERS::Dispatch(data_buffer, data_length, from_addr, _Context);
+            }
+            
+        }
+
+    } while (transport.Millis() - start_time < _BlockTime);
+    
+}
+
+
+// Makes one attempt and leaves the frame in the outbox if it
+// fails, Loop or Update retries it. False only when the outbox
+// is full and the frame was dropped. A frame toward a client
+// that is asleep is held for it instead, false when there is
+// no room for it.
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::SendTo(void *_Payload, uint16_t _ToAddress)
+{
+    transport.Update();
+    transport.DHCP();
+
+    uint16_t len = MSN_FrameLength(_Payload);
+    uint16_t record = Asleep(_ToAddress);
+
+    if (record != MSN_NO_SESSION)
+    {
+        return downlink.Push(record, _Payload, len);
+    }
+
+    if (Write(_ToAddress, _Payload, len))
+    {
+        return true;
+    }
+
+    return outbox.Push(_ToAddress, _Payload, len, transport.Millis() + MSN_RETRY_INTERVAL);
+
+}
+
+// Starts a fan-out of the frame to every known node and makes
+// the first pass over them, Loop or Update makes the rest.
+// False while the previous fan-out is still running.
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::SendToAll(void *_Payload)
+{
+    transport.Update();
+    transport.DHCP();
+
+    unsigned long now = transport.Millis();
+
+    if ( ! fanout.Start(_Payload, MSN_FrameLength(_Payload), now))
+    {
+        return false;
+    }
+
+    for (uint16_t i= 0; i < transport.PeerCount(); i++)
+    {
+        uint16_t to_addr = transport.PeerAddress(i);
+
+        MSN_FanoutResult result = fanout.Add(to_addr, now);
+
+        if (result != FO_PENDING)
+        {
+            FanOutResult(to_addr, result);
+        }
+
+    }    
+
+    FanOut();
+
+    return true;
+
+}
+
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::OnFanOut(MSN_FANOUT_HANDLER _Handler, void *_Context)
+{
+    fanout_handler = _Handler;
+    fanout_context = _Context;
+}
+
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::FanOutResult(uint16_t _ToAddress, MSN_FanoutResult _Result)
+{
+    if (fanout_handler)
+    {
+        fanout_handler(_ToAddress, _Result, fanout_context);
+    }
+}
+
+
+// One pass of the running fan-out: a write to every destination
+// still pending, or a timeout for each once the deadline is gone.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::FanOut()
+{
+    if ( ! fanout.PassDue(transport.Millis()))
+    {
+        return;
+    }
+
+    for (uint16_t i = 0; i < fanout.Count(); i++)
+    {
+        if (fanout.Result(i) != FO_PENDING)
+        {
+            continue;
+        }
+
+        unsigned long now = transport.Millis();
+        MSN_FanoutResult result;
+
+        if (fanout.Expired(now) || ! fanout.Attempt(i))
+        {
+            result = FO_TIMED_OUT;
+        }
+        else if (Write(fanout.Address(i), fanout.Frame(), fanout.Length()))
+        {
+            result = FO_DELIVERED;
+        }
+        else
+        {
+            continue;
+        }
+
+        fanout.Finish(i, result, now);
+        FanOutResult(fanout.Address(i), result);
+    }
+}
+
+template<class TRANSPORT>
+template<MSN_MsgType M_TYPE>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::SendTo(const MSN_MESSAGE<M_TYPE> &_Msg, uint16_t _ToAddress)
+{
+    byte frame[MAX_PAYLOAD_SIZE];
+
+    if (!MSN_Encode(_Msg, frame, MAX_PAYLOAD_SIZE))
+    {
+        return false;
+    }
+
+    return SendTo(frame, _ToAddress);
+}
+
+template<class TRANSPORT>
+template<MSN_MsgType M_TYPE>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::SendToAll(const MSN_MESSAGE<M_TYPE> &_Msg)
+{
+    byte frame[MAX_PAYLOAD_SIZE];
+
+    if (!MSN_Encode(_Msg, frame, MAX_PAYLOAD_SIZE))
+    {
+        return false;
+    }
+
+    return SendToAll(frame);
+}
+
+
+
+
+
+
+template<class TRANSPORT>
+class DEVICE_TYPE<DT_NODE, TRANSPORT>
+{
+
+protected:
+    TRANSPORT transport;
+
+    // The frame being handled. Each device has its own, so any
+    // number of them can run in one process.
+    byte msg_type;
+    byte data_buffer[MSN_RX_BUFFER_SZ];
+    uint16_t data_length;
+    uint16_t from_addr;
+
+    MSN_OUTBOX<MSN_NODE_OUTBOX> outbox;
+    MSN_SENT_HANDLER sent_handler;
+    void *sent_context;
+
+    MSN_QOS_WINDOW<MSN_NODE_QOS_SLOTS, MSN_NODE_QOS_FRAME_SZ> inflight;
+    MSN_QOS_RECEIVED<MSN_NODE_QOS_RECEIVED> received;
+    MSN_PUBLISHED_HANDLER published_handler;
+    void *published_context;
+
+    MSN_STREAM_SENDER stream;
+
+    MSN_DEVICE_STATS stats;
+    MSN_DEVICE_TRACE trace;
+
+    // Every frame goes out through here, so it is counted and traced.
+    bool Write(uint16_t _To, const void *_Payload, uint16_t _Len)
+    {
+        bool written = transport.Write(_To, _Payload, _Len);
+
+        stats.Out(_Payload, _Len, written);
+        trace.Out(transport, _To, _Payload, _Len, written);
+
+        return written;
+    }
+
+    bool Receive();
+    bool Answer();
+    void Retransmit();
+    void Republish();
+    void Published(uint16_t _Slot, bool _Delivered, byte _ReturnCode);
+    void Streamed(bool _Delivered, byte _ReturnCode);
+    void PumpStream();
+    void Rejoin();
+   
+private:
+
+public:
+    // Arguments are handed to the transport, e.g. the CE and
+    // CSN pins for RF24 or the base port for UDP.
+    template<class... ARGS>
+    DEVICE_TYPE(ARGS... _Args) 
+        : transport(_Args...), sent_handler(0), sent_context(0),
+          published_handler(0), published_context(0) {};
+    
+    bool Setup(int _NodeID);
+    bool Send(void *_Payload, int _Len);
+
+    // The link the frames go over, e.g. to Flush a batching
+    // transport before the node sleeps.
+    TRANSPORT &Transport() { return transport; }
+
+    // The frame handed to the handler, until the handler returns,
+    // e.g. MSN_VIEW<MSN_PUBLISH> pub(gate.Received(), gate.ReceivedLength()).
+    const byte *Received() const { return data_buffer; }
+    uint16_t ReceivedLength() const { return data_length; }
+
+    // Encode the message and send only the octets it uses.
+    template<MSN_MsgType M_TYPE>
+    bool Send(const MSN_MESSAGE<M_TYPE> &_Msg);
+
+    // Publishes to the gateway. At QoS 1 and 2 the message gets the
+    // next msgID, written back into _Msg, and is kept until acked, up to
+    // MSN_QOS_INFLIGHT at once. False when the window is full.
+    bool Publish(MSN_MESSAGE<MSN_PUBLISH> &_Msg);
+
+    // Reports the outcome of each QoS 1 and 2 publish.
+    void OnPublished(MSN_PUBLISHED_HANDLER _Handler, void *_Context);
+
+    // Publishes at QoS -1 to the pre-defined _TopicID, without a
+    // CONNECT or REGISTER first. Nothing is acked, a node can send
+    // one reading and go back to sleep.
+    bool PublishNoSession(uint16_t _TopicID, const void *_Data, byte _Len);
+
+    // Streams a PUBLISH of _Len data octets, up to 65526, to the
+    // gateway in chunks, pulling the data from _Source as it goes.
+    // The outcome is reported through OnPublished. False while
+    // another stream is going.
+    bool PublishStream(uint16_t _TopicID, byte _Flags, uint16_t _Len, MSN_STREAM_SOURCE _Source, void *_Context);
+
+    // Carries on with a stream that was reported undelivered, from
+    // the last octet the gateway acked. False if there is none.
+    bool ResumeStream();
+
+    // The stream being sent, for its progress.
+    const MSN_STREAM_SENDER &Streaming() const { return stream; }
+
+    void Loop(void (*event_handler)(byte*, byte*));
+    void Loop(void (*event_handler)(byte*, byte*), unsigned long _BlockTime);
+
+    // Hands each frame to the handler HANDLERS registers for its
+    // type, see mqttSN_dispatch.h, together with _Context.
+    template<class HANDLERS>
+    void Loop(void *_Context, unsigned long _BlockTime);
+
+    // Reports the outcome of frames that went to the outbox.
+    void OnSent(MSN_SENT_HANDLER _Handler, void *_Context);
+    uint16_t Pending() const { return outbox.Pending(); }
+
+    // Counters kept with MSN_STATS_ENABLED, see mqttSN_stats.h.
+    const MSN_STATS_SNAPSHOT &Stats() const { return stats.Snapshot(); }
+    void ResetStats() { stats.Reset(); }
+
+    // The last frames in and out with MSN_TRACE_ENABLED, see mqttSN_trace.h.
+    const MSN_DEVICE_TRACE &Trace() const { return trace; }
+
+    void Update();
+};
+
+
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::Setup(int _NodeID)
+{
+
+    if(!transport.Begin(_NodeID))
+    {
+        return false;
+    }
+
+    stats.Begin();
+    trace.Begin(_NodeID);
+    
+    transport.Update();
+
+    return true;
+}
+
+
+// mesh.update needs to be called periodically, normal 
+// use of mqttSN will handle this, but if users have extended
+// delays and or wish to they can call it manually here.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Update()
+{
+    transport.Update();
+
+    Retransmit();
+}
+
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::OnSent(MSN_SENT_HANDLER _Handler, void *_Context)
+{
+    sent_handler = _Handler;
+    sent_context = _Context;
+}
+
+
+// Writes every outbox frame that is due again, and releases
+// the ones that got through or ran out of attempts. A node
+// that lost its link to the mesh tries to get it back first.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Retransmit()
+{
+    stats.Depth(outbox.Pending(), inflight.Used());
+
+    Republish();
+    PumpStream();
+
+    if (!outbox.Pending())
+    {
+        return;
+    }
+
+    unsigned long now = transport.Millis();
+    uint16_t slot;
+
+    while ((slot = outbox.Due(now)) != MSN_NO_TIMER)
+    {
+        stats.Retry(MSN_GATEWAY_ADDRESS);
+
+        bool sent = Write(MSN_GATEWAY_ADDRESS, outbox.Frame(slot), outbox.Length(slot));
+
+        if (!sent)
+        {
+            Rejoin();
+        }
+
+        if (!sent && outbox.Retry(slot, now + MSN_RETRY_INTERVAL))
+        {
+            continue;
+        }
+
+        if (!sent)
+        {
+            stats.Drop(MSN_GATEWAY_ADDRESS);
+        }
+
+        if (sent_handler)
+        {
+            sent_handler(MSN_GATEWAY_ADDRESS, outbox.Frame(slot), sent, sent_context);
+        }
+
+        outbox.Release(slot);
+    }
+}
+
+
+// After a failed write, gets the link to the mesh back if it
+// was lost: a new address, or failing that joining again.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Rejoin()
+{
+    if (transport.CheckConnection())
+    {
+        return;
+    }
+
+    stats.Renew();
+
+    if (!transport.RenewAddress())
+    {
+        stats.Restart();
+        transport.Restart();
+    }
+}
+
+
+// Sends every unacked publish that is due again, flagged as a
+// duplicate, and gives up on the ones out of attempts.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Republish()
+{
+    if (!inflight.Used())
+    {
+        return;
+    }
+
+    unsigned long now = transport.Millis();
+    uint16_t slot;
+
+    while ((slot = inflight.Due(now)) != MSN_NO_TIMER)
+    {
+        if (!inflight.Retry(slot, now + MSN_QOS_RETRY_MS))
+        {
+            stats.Drop(MSN_GATEWAY_ADDRESS);
+            Published(slot, false, 0);
+            continue;
+        }
+
+        stats.Retry(MSN_GATEWAY_ADDRESS);
+        Write(MSN_GATEWAY_ADDRESS, inflight.Frame(slot), inflight.Length(slot));
+    }
+}
+
+
+// Reports the publish in _Slot and frees the slot.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Published(uint16_t _Slot, bool _Delivered, byte _ReturnCode)
+{
+    if (_Delivered)
+    {
+        stats.Ack(transport.Millis() - inflight.Opened(_Slot));
+    }
 
-};
+    if (published_handler)
+    {
+        published_handler(MSN_GATEWAY_ADDRESS, inflight.MsgID(_Slot), _Delivered, _ReturnCode, published_context);
+    }
 
+    inflight.Close(_Slot);
+}
 
-////// [ MQTT SN MSG RETURN CODES ] //////
-enum MSN_ReturnCode
+
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::OnPublished(MSN_PUBLISHED_HANDLER _Handler, void *_Context)
 {
-    RC_ACCEPTED        = 0x00, // Accepted
-    RC_REJ_CONGESTED   = 0x01, // Rejected - Congested
-    RC_REJ_INV_ID      = 0x02, // Rejected - Invalid ID
-    RC_REJ_NOT_SUP     = 0x03  // Rejected - Not Supportedz
+    published_handler = _Handler;
+    published_context = _Context;
+}
 
-};
 
-enum MSN_DeviceType
+// Reports the stream that just ended or paused.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Streamed(bool _Delivered, byte _ReturnCode)
 {
-    DT_NODE = 1,
-    DT_GATEWAY
-};
+    if (published_handler)
+    {
+        published_handler(MSN_GATEWAY_ADDRESS, stream.MsgID(), _Delivered, _ReturnCode, published_context);
+    }
+}
 
 
+// Sends the chunks the window has room for, and goes back to
+// the last acked one when the acks stopped coming.
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::PumpStream()
+{
+    if (!stream.Active())
+    {
+        return;
+    }
 
-template <MSN_DeviceType MDT>
-class DEVICE_TYPE {};
+    unsigned long now = transport.Millis();
 
+    if (stream.Expired(now))
+    {
+        Streamed(false, 0);
+        return;
+    }
 
-template<>
-class DEVICE_TYPE<DT_GATEWAY>
-{
+    // built in a free outbox slot, when there is none the outbox is
+    // retrying and the stream waits for it
+    byte *chunk = outbox.Spare();
+    uint16_t len;
 
-protected:
-    RF24 radio;
-    RF24Network network;
-    RF24Mesh mesh;
-   
-private:
+    while (chunk && (len = stream.Chunk(chunk, now)) && Write(MSN_GATEWAY_ADDRESS, chunk, len))
+    {
+        stream.Sent(now);
+    }
+}
 
-public:
-    DEVICE_TYPE(uint16_t _CE_PIN, uint16_t _CSN_PIN) 
-        : radio(RF24(_CE_PIN, _CSN_PIN)), 
-            network(radio), mesh(radio, network) {};
-    
-    bool Setup();
-    bool SendTo(void *_Payload, uint16_t _ToAddress);
-    void SendToAll(void *_Payload);
-    void Loop(void (*event_handler)(byte*, byte*, uint16_t*));
-    void Loop(void (*event_handler)(byte*, byte*, uint16_t*), unsigned long _BlockTime);
-    void Update();
-};
 
-bool DEVICE_TYPE<DT_GATEWAY>::Setup()
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::PublishStream(uint16_t _TopicID, byte _Flags, uint16_t _Len, MSN_STREAM_SOURCE _Source, void *_Context)
 {
+    transport.Update();
 
-    mesh.setNodeID(0);
-
-    if(!mesh.begin())
+    if (!stream.Begin(_TopicID, _Flags, _Len, _Source, _Context, transport.Millis()))
     {
         return false;
     }
-    
-    mesh.update();
 
-    return true;
+    PumpStream();
 
+    return true;
 }
 
 
-// mesh.update needs to be called periodically, normal 
-// use of mqttSN will handle this, but if users have extended
-// delays and or wish to they can call it manually here.
-void DEVICE_TYPE<DT_GATEWAY>::Update()
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::ResumeStream()
 {
-    mesh.update();
-    mesh.DHCP();
-}
+    if (!stream.Resume(transport.Millis()))
+    {
+        return false;
+    }
 
+    PumpStream();
+
+    return true;
+}
 
-void DEVICE_TYPE<DT_GATEWAY>::Loop(void (*event_handler)(byte*, byte*, uint16_t*))
+// Takes the next frame off the transport into data_buffer,
+// false if there was none.
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::Receive()
 {
+    data_length = transport.Read(data_buffer, MSN_RX_BUFFER_SZ, &from_addr);
 
-    while(1)
+    // too short for its Length field, 3 octets in the long
+    // form, and a MsgType
+    if (data_length < 2 || data_length < MSN_HeaderLength(data_buffer) + 1)
     {
-        mesh.update();
-        mesh.DHCP();
-
-        while (network.available())
-        {
-            RF24NetworkHeader header;
-
-            network.peek(header);
+        return false;
+    }
 
-            switch (header.type)
-            {
-            case 'M' :
-                
-                network.read(header, &data_buffer, MAX_PAYLOAD_SIZE);
-                
-                msg_type = data_buffer[1];
-                
-                from_addr = header.from_node;
-                
-                event_handler(&msg_type, data_buffer, &from_addr);
+    stats.In(data_buffer, data_length);
+    trace.In(transport, from_addr, data_buffer, data_length);
 
-                break;
-            
-            default:
-                break;
+    msg_type = MSN_FrameType(data_buffer);
 
-            }
-         
-        }
-        
-    }
-    
+    return Answer();
 }
 
 
-void DEVICE_TYPE<DT_GATEWAY>::Loop(void (*event_handler)(byte*, byte*, uint16_t*), unsigned long _BlockTime)
+// Acks the node handles itself. The frame is still handed
+// to the application afterwards, unless it is a QoS 2 PUBLISH
+// seen before or a QoS 1 or 2 PUBLISH turned down, then this is
+// false.
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::Answer()
 {
-
-    unsigned long start_time = millis();
-
-    do
+    if (msg_type == MSN_PUBLISH)
     {
-        mesh.update();
-        mesh.DHCP();
+        MSN_VIEW<MSN_PUBLISH> pub(data_buffer, data_length);
+        byte qos = pub.Flags() & QOS_MASK;
 
-        while (network.available())
+        if (!pub.Valid() || (qos != QOS_1 && qos != QOS_2))
         {
-            RF24NetworkHeader header;
-            
-            network.peek(header);
+            return true;
+        }
 
-            switch (header.type)
-            {
-            case 'M' :
-                
-                network.read(header, &data_buffer, MAX_PAYLOAD_SIZE);
-                
-                msg_type = data_buffer[1];
-
-                from_addr = header.from_node;
-                
-                event_handler(&msg_type, data_buffer, &from_addr);
+        byte rc = RC_ACCEPTED;
 
-                break;
-            
-            default:
-                break;
-                
-            }
-            
-        }
+        if (qos == QOS_2)
+        {
+            MSN_QosReceived seen = received.Accept(MSN_GATEWAY_ADDRESS, pub.MsgID(), transport.Millis());
 
-    } while (millis() - start_time < _BlockTime);
-    
-}
+            if (seen != QR_FULL)
+            {
+                byte rec[4];
+                MSN_MsgIdFrame(rec, MSN_PUBREC, pub.MsgID());
 
+                Send(rec, 4);
 
-bool DEVICE_TYPE<DT_GATEWAY>::SendTo(void *_Payload, uint16_t _ToAddress)
-{
-    mesh.update();
-    mesh.DHCP();
+                return seen == QR_NEW;
+            }
 
-    bool msg_sent = false;
+            rc = RC_REJ_CONGESTED;
+        }
 
-    int it = 0;
+        byte ack[8];
+        MSN_PubAckFrame(ack, pub.TopicID(), pub.MsgID(), rc);
 
-    RF24NetworkHeader header(_ToAddress, OCT);
+        Send(ack, 8);
 
-    while ( ! msg_sent && (it < MAX_RETRY_COUNT))
+        // a publish that was rejected is not delivered
+        return qos == QOS_1 && rc == RC_ACCEPTED;
+    }
+    else if (msg_type == MSN_PUBACK)
     {
-        if (network.write(header, _Payload , sizeof(_Payload))) {
-            
-            msg_sent = true;
+        MSN_VIEW<MSN_PUBACK> ack(data_buffer, data_length);
 
-            break;
-            
+        if (!ack.Valid())
+        {
+            return true;
         }
 
-        delay(1000);
-        it++;          
-    }
-     
-    return msg_sent;
-
-}
+        // a QoS 2 publish is acked with a PUBACK when it is rejected
+        uint16_t slot = inflight.Find(MSN_GATEWAY_ADDRESS, ack.MsgID(), QS_PUBACK);
 
-void DEVICE_TYPE<DT_GATEWAY>::SendToAll(void *_Payload)
-{
-    mesh.update();
-    mesh.DHCP();
+        if (slot == MSN_NO_TIMER)
+        {
+            slot = inflight.Find(MSN_GATEWAY_ADDRESS, ack.MsgID(), QS_PUBREC);
+        }
 
-    for (int i= 0; i < mesh.addrListTop; i++)
+        if (slot != MSN_NO_TIMER)
+        {
+            Published(slot, true, ack.ReturnCode());
+        }
+    }
+    else if (msg_type == MSN_PUBREC)
     {
+        MSN_VIEW<MSN_PUBREC> rec(data_buffer, data_length);
 
+        if (!rec.Valid())
+        {
+            return true;
+        }
 
-        int it = 0;
-
-        RF24NetworkHeader header(mesh.addrList[i].address, OCT);
+        uint16_t slot = inflight.Find(MSN_GATEWAY_ADDRESS, rec.MsgID(), QS_PUBREC);
 
-        while (it < MAX_RETRY_COUNT)
+        if (slot != MSN_NO_TIMER)
         {
-            if (network.write(header, _Payload , sizeof(_Payload))) {
-                
-                break;
-                
-            }
-
-            delay(1000);
-            it++;          
+            inflight.Release(slot, transport.Millis() + MSN_QOS_RETRY_MS);
+        }
+        else
+        {
+            // the PUBREL went out already, the receiver did not get it
+            slot = inflight.Find(MSN_GATEWAY_ADDRESS, rec.MsgID(), QS_PUBCOMP);
         }
 
-    }    
+        if (slot != MSN_NO_TIMER)
+        {
+            Write(MSN_GATEWAY_ADDRESS, inflight.Frame(slot), inflight.Length(slot));
+        }
+    }
+    else if (msg_type == MSN_PUBREL)
+    {
+        MSN_VIEW<MSN_PUBREL> rel(data_buffer, data_length);
 
-}
+        if (!rel.Valid())
+        {
+            return true;
+        }
 
+        received.Release(MSN_GATEWAY_ADDRESS, rel.MsgID());
 
+        byte comp[4];
+        MSN_MsgIdFrame(comp, MSN_PUBCOMP, rel.MsgID());
 
+        Send(comp, 4);
+    }
+    else if (msg_type == MSN_PUBCOMP)
+    {
+        MSN_VIEW<MSN_PUBCOMP> comp(data_buffer, data_length);
 
+        if (!comp.Valid())
+        {
+            return true;
+        }
 
+        uint16_t slot = inflight.Find(MSN_GATEWAY_ADDRESS, comp.MsgID(), QS_PUBCOMP);
 
-template<>
-class DEVICE_TYPE<DT_NODE>
-{
+        if (slot != MSN_NO_TIMER)
+        {
+            Published(slot, true, RC_ACCEPTED);
+        }
+    }
+    else if (msg_type == MSN_CHUNKACK)
+    {
+        MSN_VIEW<MSN_CHUNKACK> ack(data_buffer, data_length);
 
-protected:
-    RF24 radio;
-    RF24Network network;
-    RF24Mesh mesh;
-   
-private:
+        if (!ack.Valid())
+        {
+            return true;
+        }
 
-public:
-    DEVICE_TYPE(uint16_t _CE_PIN, uint16_t _CSN_PIN) 
-        : radio(RF24(_CE_PIN, _CSN_PIN)), 
-            network(radio), mesh(radio, network) {};
-    
-    bool Setup(int _NodeID);
-    bool Send(void *_Payload, int _Len);
-    void Loop(void (*event_handler)(byte*, byte*));
-    void Loop(void (*event_handler)(byte*, byte*), unsigned long _BlockTime);
-    void Update();
-};
+        switch (stream.Ack(ack.MsgID(), ack.Next(), ack.ReturnCode(), transport.Millis()))
+        {
 
+        case SA_DONE:
+            Streamed(true, RC_ACCEPTED);
+            break;
 
-bool DEVICE_TYPE<DT_NODE>::Setup(int _NodeID)
-{
+        case SA_REJECTED:
+        case SA_PAUSED:
+            Streamed(false, ack.ReturnCode());
+            break;
 
-    mesh.setNodeID(_NodeID);
-    if(!mesh.begin())
-    {
-        return false;
+        default:
+            // keep the window full
+            PumpStream();
+            break;
+        }
     }
-    
-    mesh.update();
 
     return true;
 }
 
 
-// mesh.update needs to be called periodically, normal 
-// use of mqttSN will handle this, but if users have extended
-// delays and or wish to they can call it manually here.
-void DEVICE_TYPE<DT_NODE>::Update()
-{
-    mesh.update();
-}
-
-void DEVICE_TYPE<DT_NODE>::Loop(void (*event_handler)(byte*, byte*))
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Loop(void (*event_handler)(byte*, byte*))
 {
 
     while(1)
     {
-        mesh.update();
-
-        while (network.available())
-        {
-            RF24NetworkHeader header;
-
-            network.read(header, &data_buffer, MAX_PAYLOAD_SIZE);
+        transport.Update();
 
-            msg_type = data_buffer[1];
+        Retransmit();
 
-            event_handler(&msg_type, data_buffer);
+        while (transport.Available())
+        {
+            if (Receive())
+            {
+                event_handler(&msg_type, data_buffer);
+            }
             
         }
         
@@ -380,62 +2011,76 @@ void DEVICE_TYPE<DT_NODE>::Loop(void (*event_handler)(byte*, byte*))
 }
 
 
-void DEVICE_TYPE<DT_NODE>::Loop(void (*event_handler)(byte*, byte*), unsigned long _BlockTime)
+template<class TRANSPORT>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Loop(void (*event_handler)(byte*, byte*), unsigned long _BlockTime)
 {
 
-    unsigned long start_time = millis();
+    unsigned long start_time = transport.Millis();
 
     do
     {
-        mesh.update();
-
-        while (network.available())
-        {
-            RF24NetworkHeader header;
-
-            network.read(header, &data_buffer, MAX_PAYLOAD_SIZE);
+        transport.Update();
 
-            msg_type = data_buffer[1];
+        Retransmit();
 
-            event_handler(&msg_type, data_buffer);
+        while (transport.Available())
+        {
+            if (Receive())
+            {
+                event_handler(&msg_type, data_buffer);
+            }
             
         }
 
 
-    } while (millis() - start_time < _BlockTime);
+    } while (transport.Millis() - start_time < _BlockTime);
     
 
 }
 
-bool DEVICE_TYPE<DT_NODE>::Send(void *_Payload, int _Len)
+template<class TRANSPORT>
+template<class HANDLERS>
+void DEVICE_TYPE<DT_NODE, TRANSPORT>::Loop(void *_Context, unsigned long _BlockTime)
 {
-    mesh.update();
-    bool msg_sent = false;
-    int it = 0;
 
+    unsigned long start_time = transport.Millis();
 
-    while ( ! msg_sent && (it < MAX_RETRY_COUNT))
+    do
     {
-        if (mesh.write(_Payload, 'M', _Len)) {
-            
-            msg_sent = true;
-            
-        } else if ( ! mesh.checkConnection() ) {
-            
-            if( ! mesh.renewAddress()){
+        transport.Update();
 
-                mesh.begin();
+        Retransmit();
 
+        while (transport.Available())
+        {
+            if (Receive())
+            {
+                HANDLERS::Dispatch(data_buffer, data_length, from_addr, _Context);
             }
+            
+        }
 
+    } while (transport.Millis() - start_time < _BlockTime);
+    
+}
 
-        }
 
-        delay(1000);
-        it++;          
+// Makes one attempt and leaves the frame in the outbox if it
+// fails, Loop or Update retries it. False only when the outbox
+// is full and the frame was dropped.
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::Send(void *_Payload, int _Len)
+{
+    transport.Update();
+
+    if (Write(MSN_GATEWAY_ADDRESS, _Payload, _Len))
+    {
+        return true;
     }
-     
-    return msg_sent;
+
+    Rejoin();
+
+    return outbox.Push(MSN_GATEWAY_ADDRESS, _Payload, _Len, transport.Millis() + MSN_RETRY_INTERVAL);
 
 }
 
@@ -445,6 +2090,7 @@ bool DEVICE_TYPE<DT_NODE>::Send(void *_Payload, int _Len)
 
 
 
+
 #pragma pack(1)
 
 
@@ -848,6 +2494,12 @@ struct MSN_MESSAGE<MSN_REGISTER>
     */
     uint16_t msgID;
 
+    /*
+    *    The TopicName field has a variable length and contains the topic name. Only the octets up
+    *    to the terminating NUL go on air.
+    */
+    char topicName[TOPIC_NAME_SZ];
+
 
 };
 
@@ -1187,6 +2839,13 @@ struct MSN_MESSAGE<MSN_SUBSCRIBE>
     */
 	uint16_t topicID;
 
+    /*
+    *    The TopicName field replaces the TopicId unless the TopicIdType flag is PD_TOPIC_ID_ON: a topic
+    *    name, possibly with wildcards, or a 2 character short topic name. Only the octets up to the
+    *    terminating NUL go on air.
+    */
+    char topicName[TOPIC_NAME_SZ];
+
 };
 
 template<>
@@ -1246,6 +2905,13 @@ struct MSN_MESSAGE<MSN_UNSUBSCRIBE>
     */
 	uint16_t topicID;
 
+    /*
+    *    The TopicName field replaces the TopicId unless the TopicIdType flag is PD_TOPIC_ID_ON: a topic
+    *    name, possibly with wildcards, or a 2 character short topic name. Only the octets up to the
+    *    terminating NUL go on air.
+    */
+    char topicName[TOPIC_NAME_SZ];
+
 };
 
 
@@ -1606,3 +3272,104 @@ struct MSN_MESSAGE<MSN_WILLMSGRESP>
 #pragma pack(0)
 
 
+#include <mqttSN_codec.h>
+#include <mqttSN_dispatch.h>
+
+
+// The calls that encode a message come after the codec.
+template<class TRANSPORT>
+template<MSN_MsgType M_TYPE>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::Send(const MSN_MESSAGE<M_TYPE> &_Msg)
+{
+    // only as long as this message can get
+    byte frame[MSN_FRAME_MAX<M_TYPE>::VALUE];
+
+    uint16_t len = MSN_Encode(_Msg, frame, sizeof(frame));
+
+    if (!len)
+    {
+        return false;
+    }
+
+    return Send(frame, len);
+}
+
+
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_GATEWAY, TRANSPORT>::Publish(MSN_MESSAGE<MSN_PUBLISH> &_Msg, uint16_t _ToAddress)
+{
+    byte frame[MSN_FRAME_MAX<MSN_PUBLISH>::VALUE];
+
+    uint16_t len = MSN_Encode(_Msg, frame, sizeof(frame));
+
+    if (!len)
+    {
+        return false;
+    }
+
+    uint16_t msg_id = _Msg.msgID;
+
+    if (!Deliver(frame, len, _ToAddress, &msg_id))
+    {
+        return false;
+    }
+
+    _Msg.msgID = msg_id;
+
+    return true;
+}
+
+
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::Publish(MSN_MESSAGE<MSN_PUBLISH> &_Msg)
+{
+    byte frame[MSN_FRAME_MAX<MSN_PUBLISH>::VALUE];
+
+    uint16_t len = MSN_Encode(_Msg, frame, sizeof(frame));
+
+    if (!len)
+    {
+        return false;
+    }
+
+    byte qos = _Msg.flags & QOS_MASK;
+
+    if (qos != QOS_1 && qos != QOS_2)
+    {
+        return Send(frame, len);
+    }
+
+    transport.Update();
+
+    uint16_t slot = inflight.Open(MSN_GATEWAY_ADDRESS, frame, len, qos == QOS_2 ? QS_PUBREC : QS_PUBACK,
+        transport.Millis() + MSN_QOS_RETRY_MS);
+
+    if (slot == MSN_NO_TIMER)
+    {
+        return false;
+    }
+
+    _Msg.msgID = inflight.MsgID(slot);
+
+    Write(MSN_GATEWAY_ADDRESS, inflight.Frame(slot), inflight.Length(slot));
+
+    return true;
+}
+
+
+template<class TRANSPORT>
+bool DEVICE_TYPE<DT_NODE, TRANSPORT>::PublishNoSession(uint16_t _TopicID, const void *_Data, byte _Len)
+{
+    MSN_MESSAGE<MSN_PUBLISH> msg;
+
+    msg.flags = QOS_N1 | PD_TOPIC_ID_ON;
+    msg.topicID = _TopicID;
+    msg.msgID = 0x0000;
+
+    if (!MSN_SetPublishData(msg, _Data, _Len))
+    {
+        return false;
+    }
+
+    return Send(msg);
+}